@@ -0,0 +1,195 @@
+// Builds synthetic plugins from `my_plugin.c` and reports what opening and
+// initializing one costs when everything is bound up front (RTLD_NOW) and
+// when functions are bound on their first call (RTLD_LAZY), see
+// PluginOpenFlags.
+//
+//   make bench
+//   ./bench/plugins [count]
+
+#define VOLV_NO_MAIN
+#include "../src/main.c"
+
+#include <time.h>
+
+#define BENCH_PLUGINS 200
+#define BENCH_RUNS 5
+#define BENCH_TEMPLATE "my_plugin.c"
+
+// NOTE: every plugin calls these, each one is a relocation to bind at load
+static const char benchImports[] =
+    "\n"
+    "#include <ctype.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <strings.h>\n"
+    "#include <time.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "void benchImports(const char *s) {\n"
+    "    strlen(s); free(strdup(s)); atoi(s); atol(s); atof(s); getenv(s); puts(s); perror(s);\n"
+    "    strchr(s, 'a'); strrchr(s, 'a'); strstr(s, s); strcmp(s, s); strncmp(s, s, 1);\n"
+    "    strcasecmp(s, s); strspn(s, s); strcspn(s, s); strpbrk(s, s); strtol(s, NULL, 10);\n"
+    "    strtoul(s, NULL, 10); strtod(s, NULL); memchr(s, 0, 1); memcmp(s, s, 1);\n"
+    "    free(realloc(calloc(1, 1), 2)); free(malloc(1)); abs(1); labs(1); rand(); srand(1);\n"
+    "    time(NULL); clock(); getpid(); isatty(0); fflush(NULL); fputs(s, stdout);\n"
+    "    fprintf(stderr, \"%s\", s); snprintf(NULL, 0, \"%s\", s); toupper(1); tolower(1);\n"
+    "    VolConfigGet(s, s); GetCCompiler(); PrintFlags(0);\n"
+    "}\n";
+
+static double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static char *readTemplate(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
+
+    char *source = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&source, &len);
+
+    char line[1024];
+    while (fgets(&line[0], sizeof(line), file)) {
+        // NOTE: the plugins build against this tree, not an installed volv
+        if (strstr(&line[0], "<volva/plugins.h>")) {
+            fputs("#include \"plugins.h\"\n", out);
+            continue;
+        }
+
+        // NOTE: commands are looked up by name, every plugin needs its own
+        char *name = strstr(&line[0], "\"example\"");
+        if (name) {
+            fprintf(out, "%.*s\"example\" BENCH_ID%s", (int)(name - &line[0]), &line[0], name + strlen("\"example\""));
+            continue;
+        }
+
+        fputs(&line[0], out);
+    }
+
+    fputs(benchImports, out);
+    fclose(out);
+    fclose(file);
+
+    return source;
+}
+
+static b32 buildPlugins(const char *dir, const char *source, u32 count) {
+    char sourcePath[1024];
+    snprintf(&sourcePath[0], sizeof(sourcePath), "%s/plugin.c", dir);
+
+    FILE *file = fopen(&sourcePath[0], "w");
+    if (!file) return false;
+    fputs(source, file);
+    fclose(file);
+
+    VolProcessPool *pool = VolProcessPoolCreate(0);
+
+    for (u32 i = 0; i < count; i += 1) {
+        char define[64], output[1024];
+        snprintf(&define[0], sizeof(define), "-DBENCH_ID=\"%u\"", i);
+        snprintf(&output[0], sizeof(output), "%s/plugin%u.so", dir, i);
+
+        const char *argv[] = {
+            GetCCompiler(), "-shared", "-fPIC", "-O0", "-fno-builtin", "-w", "-Isrc", &define[0],
+#ifdef __APPLE__
+            "-Wl,-undefined,dynamic_lookup",
+#endif
+            "-o", &output[0], &sourcePath[0], NULL
+        };
+
+        VolProcessPoolSpawn(pool, argv, 0);
+    }
+
+    int status = VolProcessPoolWait(pool);
+    VolProcessPoolFree(pool);
+
+    return status == 0;
+}
+
+// Opens and initializes every plugin, returns the milliseconds it took. The
+// plugins are closed again afterwards.
+static double loadPlugins(const char *dir, u32 count, int flags) {
+    void **handles = calloc(count, sizeof(void *));
+    double total = 0;
+
+    for (u32 i = 0; i < count; i += 1) {
+        char path[1024];
+        snprintf(&path[0], sizeof(path), "%s/plugin%u.so", dir, i);
+
+        double start = nowMs();
+
+        handles[i] = dlopen(&path[0], flags);
+        u32 capabilities;
+        if (!handles[i] || !InitPlugin(handles[i], i, &path[0], &capabilities)) {
+            fprintf(stderr, "ERROR: Unable to load %s: %s\n", &path[0], dlerror() ?: "init failed");
+            exit(1);
+        }
+
+        total += nowMs() - start;
+    }
+
+    for (u32 i = 0; i < count; i += 1) {
+        RemovePluginCommands(i);
+        RemovePluginFlags(i);
+        dlclose(handles[i]);
+    }
+
+    free(handles);
+    return total;
+}
+
+int main(i32 argc, const char **argv) {
+    u32 count = argc > 1 ? (u32)atoi(argv[1]) : BENCH_PLUGINS;
+    if (!count || count > MAX_COMMAND_COUNT / 2) {
+        fprintf(stderr, "ERROR: expected between 1 and %d plugins\n", MAX_COMMAND_COUNT / 2);
+        return 1;
+    }
+
+    char *source = readTemplate(BENCH_TEMPLATE);
+    if (!source) {
+        fprintf(stderr, "ERROR: Unable to read %s, run from the repository root\n", BENCH_TEMPLATE);
+        return 1;
+    }
+
+    char dir[] = "/tmp/volv-bench-XXXXXX";
+    if (!mkdtemp(&dir[0])) {
+        fprintf(stderr, "ERROR: Unable to create a temporary directory\n");
+        return 1;
+    }
+
+    if (!buildPlugins(&dir[0], source, count)) {
+        fprintf(stderr, "ERROR: Unable to build the plugins in %s\n", &dir[0]);
+        return 1;
+    }
+
+    // NOTE: one warm up each so neither strategy pays for a cold page cache
+    loadPlugins(&dir[0], count, RTLD_NOW | RTLD_LOCAL);
+    loadPlugins(&dir[0], count, RTLD_LAZY | RTLD_LOCAL);
+
+    double nowTotal = 0, lazyTotal = 0;
+    for (u32 run = 0; run < BENCH_RUNS; run += 1) {
+        nowTotal += loadPlugins(&dir[0], count, RTLD_NOW | RTLD_LOCAL);
+        lazyTotal += loadPlugins(&dir[0], count, RTLD_LAZY | RTLD_LOCAL);
+    }
+
+    printf("plugins count=%u runs=%d now_us=%.2f lazy_us=%.2f now_total_ms=%.3f lazy_total_ms=%.3f\n",
+        count, BENCH_RUNS,
+        nowTotal * 1000 / BENCH_RUNS / count, lazyTotal * 1000 / BENCH_RUNS / count,
+        nowTotal / BENCH_RUNS, lazyTotal / BENCH_RUNS);
+
+    for (u32 i = 0; i < count; i += 1) {
+        char path[1024];
+        snprintf(&path[0], sizeof(path), "%s/plugin%u.so", &dir[0], i);
+        unlink(&path[0]);
+    }
+
+    char path[1024];
+    snprintf(&path[0], sizeof(path), "%s/plugin.c", &dir[0]);
+    unlink(&path[0]);
+    rmdir(&dir[0]);
+
+    free(source);
+    return 0;
+}
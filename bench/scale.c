@@ -0,0 +1,287 @@
+// Generates plugins from `my_plugin.c`, each registering a number of commands
+// and flags, builds them with `plugins build` and reports how volv copes with
+// that many: startup time and RSS of a whole invocation, FlagForName lookups
+// and dispatching a command.
+//
+//   make bench
+//   ./bench/scale [plugins] [commands] [flags]
+//
+// Everything is reported on one `scale key=value...` line, keys are only ever
+// added so results can be compared across revisions.
+
+#define VOLV_NO_MAIN
+#include "../src/main.c"
+
+#include <limits.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define BENCH_PLUGINS 200
+#define BENCH_COMMANDS 5
+// NOTE: enough for the plugins to run into the 256 flag limit
+#define BENCH_FLAGS 2
+#define BENCH_STARTUP_RUNS 10
+#define BENCH_LOOKUPS 200000
+#define BENCH_TEMPLATE "my_plugin.c"
+
+static double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// The template with its command and flag renamed after the plugin, and a new
+// PluginInit that runs the template's and then registers the generated ones.
+static b32 writePluginSource(const char *path, const char *header, u32 plugin, u32 commandsPerPlugin, u32 flagsPerPlugin) {
+    FILE *template = fopen(BENCH_TEMPLATE, "r");
+    if (!template) return false;
+
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fclose(template);
+        return false;
+    }
+
+    fprintf(out, "#define PluginInit templateInit\n");
+
+    char line[1024];
+    while (fgets(&line[0], sizeof(line), template)) {
+        char *name;
+
+        if (strstr(&line[0], "<volva/plugins.h>")) {
+            // NOTE: the plugins build against this tree, not an installed volv
+            fprintf(out, "#include \"%s\"\n", header);
+        } else if ((name = strstr(&line[0], "\"example\""))) {
+            fprintf(out, "%.*s\"bench%u\"%s", (int)(name - &line[0]), &line[0], plugin, name + strlen("\"example\""));
+        } else if ((name = strstr(&line[0], "\"test\""))) {
+            fprintf(out, "%.*s\"bench%u_f0\"%s", (int)(name - &line[0]), &line[0], plugin, name + strlen("\"test\""));
+        } else {
+            fputs(&line[0], out);
+        }
+    }
+
+    fprintf(out,
+        "\n"
+        "#undef PluginInit\n"
+        "\n"
+        "static int benchCommand(const char **args, size_t argc) {\n"
+        "    return PLUGIN_OK;\n"
+        "}\n"
+        "\n"
+        "static char benchNames[%u][32];\n"
+        "static bool benchFlags[%u];\n"
+        "\n"
+        "int PluginInit() {\n"
+        "    templateInit();\n"
+        "\n"
+        "    CommandId id = exampleId;\n"
+        "    for (int i = 1; i < %u; i += 1) {\n"
+        "        snprintf(benchNames[i], 32, \"bench%u_%%d\", i);\n"
+        "        id = RegisterCommand(benchNames[i], \"A generated command\", benchCommand);\n"
+        "    }\n"
+        "\n"
+        "    for (int i = 1; i < %u; i += 1) {\n"
+        "        snprintf(benchNames[%u + i], 32, \"bench%u_f%%d\", i);\n"
+        "        RegisterFlag(id, (struct CLIFlag){ CLIFlagKind_Bool, .name = benchNames[%u + i], .ptr.b = &benchFlags[i], .help = \"A generated flag\" });\n"
+        "    }\n"
+        "\n"
+        "    return PLUGIN_OK;\n"
+        "}\n",
+        commandsPerPlugin + flagsPerPlugin, flagsPerPlugin,
+        commandsPerPlugin, plugin,
+        flagsPerPlugin, commandsPerPlugin, plugin, commandsPerPlugin
+    );
+
+    fclose(template);
+    fclose(out);
+    return true;
+}
+
+// What `volv <command>` does, minus talking to a server
+static i32 runStartup(const char *command) {
+    i32 argc = 2;
+    const char *args[] = { "volv", command, NULL };
+    const char **argv = &args[0];
+
+    ParseBuiltinFlags(&argc, &argv);
+
+    LoadConfig();
+    ConfigBufferedInput = true;
+
+    LoadPlugins();
+    ApplyConfigFlags();
+    SaveFlagDefaults();
+
+    return RunCommand(argc, argv);
+}
+
+// Runs a whole invocation in a new process, returns how long it took and how
+// much memory it used at most
+static b32 measureStartup(const char *self, const char *command, double *ms, long *rssKb) {
+    double start = nowMs();
+
+    pid_t pid = fork();
+    if (pid < 0) return false;
+
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        // NOTE: errors such as dropped flags are reported once, by the run in this process
+        dup2(null, STDERR_FILENO);
+        execl(self, self, "--startup", command, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return false;
+
+    *ms = nowMs() - start;
+
+    // NOTE: macOS reports bytes, everything else kilobytes
+#ifdef __APPLE__
+    *rssKb = usage.ru_maxrss / 1024;
+#else
+    *rssKb = usage.ru_maxrss;
+#endif
+    return true;
+}
+
+int main(i32 argc, const char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--startup") == 0)
+        return runStartup(argv[2]);
+
+    u32 pluginCount = argc > 1 ? (u32)atoi(argv[1]) : BENCH_PLUGINS;
+    u32 commandsPerPlugin = argc > 2 ? (u32)atoi(argv[2]) : BENCH_COMMANDS;
+    u32 flagsPerPlugin = argc > 3 ? (u32)atoi(argv[3]) : BENCH_FLAGS;
+
+    // NOTE: the template brings one command and one flag, dispatch needs a generated command
+    if (!pluginCount || commandsPerPlugin < 2 || !flagsPerPlugin) {
+        fprintf(stderr, "ERROR: expected at least 1 plugin with 2 commands and 1 flag\n");
+        return 1;
+    }
+
+    char cwd[1024];
+    if (!getcwd(&cwd[0], sizeof(cwd)) || access(BENCH_TEMPLATE, R_OK) != 0) {
+        fprintf(stderr, "ERROR: Unable to read %s, run from the repository root\n", BENCH_TEMPLATE);
+        return 1;
+    }
+
+    char self[PATH_MAX + 1024];
+    int selfLen = snprintf(&self[0], sizeof(self), "%s%s%s", argv[0][0] == '/' ? "" : &cwd[0], argv[0][0] == '/' ? "" : "/", argv[0]);
+    if (selfLen < 0 || (size_t)selfLen >= sizeof(self)) {
+        fprintf(stderr, "ERROR: The path to %s is too long\n", argv[0]);
+        return 1;
+    }
+
+    // NOTE: a home of its own keeps the plugins, the cache and the config apart from the real ones
+    char home[] = "/tmp/volv-scale-XXXXXX";
+    if (!mkdtemp(&home[0])) {
+        fprintf(stderr, "ERROR: Unable to create a temporary directory\n");
+        return 1;
+    }
+    setenv("HOME", &home[0], true);
+    setenv("VOLV_NO_SERVE", "1", true);
+
+    char header[sizeof(cwd) + sizeof("/src/plugins.h")];
+    snprintf(&header[0], sizeof(header), "%s/src/plugins.h", &cwd[0]);
+
+    char (*names)[1024] = malloc(pluginCount * sizeof(*names));
+    const char **nameList = malloc(pluginCount * sizeof(const char *));
+
+    for (u32 i = 0; i < pluginCount; i += 1) {
+        snprintf(&names[i][0], sizeof(names[i]), "%s/bench%u", &home[0], i);
+        nameList[i] = &names[i][0];
+
+        char source[1100];
+        snprintf(&source[0], sizeof(source), "%s.c", &names[i][0]);
+        if (!writePluginSource(&source[0], &header[0], i, commandsPerPlugin, flagsPerPlugin)) {
+            fprintf(stderr, "ERROR: Unable to write %s\n", &source[0]);
+            return 1;
+        }
+    }
+
+    double buildStart = nowMs();
+    if (BuildPlugins(nameList, pluginCount) != 0) {
+        fprintf(stderr, "ERROR: Unable to build the plugins in %s\n", &home[0]);
+        return 1;
+    }
+    double buildMs = nowMs() - buildStart;
+
+    char command[64];
+    snprintf(&command[0], sizeof(command), "bench%u_%u", pluginCount - 1, commandsPerPlugin - 1);
+
+    // NOTE: the first run warms the page cache, the median of the rest is reported
+    double startups[BENCH_STARTUP_RUNS];
+    long rssKb = 0;
+    for (u32 run = 0; run <= BENCH_STARTUP_RUNS; run += 1) {
+        double ms;
+        long rss;
+        if (!measureStartup(&self[0], &command[0], &ms, &rss)) {
+            fprintf(stderr, "ERROR: Running `volv %s` with the plugins failed\n", &command[0]);
+            return 1;
+        }
+
+        if (run) startups[run - 1] = ms;
+        if (rss > rssKb) rssKb = rss;
+    }
+    qsort(&startups[0], BENCH_STARTUP_RUNS, sizeof(double), compareDoubles);
+
+    // NOTE: the same setup in this process, for the lookups
+    LoadConfig();
+    ConfigBufferedInput = true;
+
+    double loadStart = nowMs();
+    LoadPlugins();
+    double loadMs = nowMs() - loadStart;
+
+    ApplyConfigFlags();
+    SaveFlagDefaults();
+
+    // NOTE: every registered flag in turn, so late registrations weigh in as much as early ones
+    volatile uintptr_t found = 0;
+    double lookupStart = nowMs();
+    for (u32 i = 0; i < BENCH_LOOKUPS; i += 1)
+        found += (uintptr_t)FlagForName(flags[i % flagCount].name);
+    double lookupMs = nowMs() - lookupStart;
+
+    double missStart = nowMs();
+    for (u32 i = 0; i < BENCH_LOOKUPS; i += 1)
+        found += (uintptr_t)FlagForName("no-such-flag");
+    double missMs = nowMs() - missStart;
+
+    const char *dispatchArgs[] = { "volv", &command[0], NULL };
+    double dispatchStart = nowMs();
+    for (u32 i = 0; i < BENCH_LOOKUPS; i += 1) {
+        RunCommand(2, &dispatchArgs[0]);
+        ResetFlags();
+    }
+    double dispatchMs = nowMs() - dispatchStart;
+
+    u32 registeredCommands = 0;
+    for (size_t i = 0; i < commands.count; i += 1)
+        registeredCommands += commands.names[i] != NULL;
+
+    printf(
+        "scale plugins=%u commands=%u flags=%u build_ms=%.1f load_ms=%.3f startup_ms=%.3f startup_rss_kb=%ld"
+        " flag_lookup_ns=%.1f flag_miss_ns=%.1f dispatch_ns=%.1f flags_dropped=%u\n",
+        pluginCount, registeredCommands, (u32)flagCount, buildMs, loadMs,
+        startups[BENCH_STARTUP_RUNS / 2], rssKb,
+        lookupMs * 1e6 / BENCH_LOOKUPS, missMs * 1e6 / BENCH_LOOKUPS, dispatchMs * 1e6 / BENCH_LOOKUPS,
+        DroppedFlagCount
+    );
+
+    VolRun((const char *[]){ "rm", "-rf", &home[0], NULL });
+
+    free(nameList);
+    free(names);
+    return 0;
+}
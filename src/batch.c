@@ -0,0 +1,325 @@
+// `volv batch <file|->`, runs a list of command lines in this process so the
+// config, plugins and connections are set up once for all of them:
+//
+//   # deploy.volv
+//   -app shop env get DATABASE_URL
+//   -app shop env set FEATURE_X=1
+//   -app blog env get /^CACHE_/ &
+//   -app docs env get /^CACHE_/ &
+//   resource
+//
+// One command per line in shell-like words: quotes and backslashes work, `#`
+// starts a comment and a leading `volv` may be left out. Every line starts from
+// the flags `batch` itself was given. A line ending in `&` runs alongside the
+// lines that follow; its output is printed in line order once it's done. The
+// next line without `&` waits for them first. The batch stops at the first
+// line that fails.
+//
+// Commands that take a context run in the background on the job pool, sharing
+// this process's connections. The others read the flag variables, those lines
+// run in a copy of this process forked for them.
+
+struct BatchJob {
+    u32 line;
+
+    // NOTE: a line on the job pool has a task, a forked one a pid
+    VolJob *task;
+    VolContext *ctx;
+    const char **argv;
+    i32 argc;
+    i32 status;
+
+    pid_t pid;
+    FILE *out;
+    // NOTE: only for forked lines, the others share this process's stderr
+    FILE *err;
+};
+
+struct Batch {
+    struct BatchJob *jobs;
+    u32 jobCount;
+    u32 running;
+    u32 limit;
+
+    // NOTE: the first line that failed, and its status
+    u32 failedLine;
+    i32 status;
+};
+
+// Splits `line` into words in place. Returns how many, -1 for an unterminated
+// quote.
+static i32 splitBatchLine(char *line, const char **words, i32 cap) {
+    i32 count = 0;
+    char *in = line, *out = line;
+
+    while (*in) {
+        while (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n')
+            in++;
+
+        if (!*in || *in == '#') break;
+        if (count >= cap) return -1;
+
+        words[count++] = out;
+
+        while (*in && *in != ' ' && *in != '\t' && *in != '\r' && *in != '\n') {
+            if (*in == '\'') {
+                in++;
+                while (*in && *in != '\'')
+                    *out++ = *in++;
+                if (!*in) return -1;
+                in++;
+            } else if (*in == '"') {
+                in++;
+                while (*in && *in != '"') {
+                    if (*in == '\\' && (in[1] == '"' || in[1] == '\\'))
+                        in++;
+                    *out++ = *in++;
+                }
+                if (!*in) return -1;
+                in++;
+            } else if (*in == '\\' && in[1]) {
+                in++;
+                *out++ = *in++;
+            } else {
+                *out++ = *in++;
+            }
+        }
+
+        // NOTE: the terminator may overwrite the separator, never text still to be read
+        if (*in) in++;
+        *out++ = '\0';
+    }
+
+    return count;
+}
+
+static void batchFailed(struct Batch *batch, u32 line, i32 status) {
+    if (!batch->status || line < batch->failedLine) {
+        batch->failedLine = line;
+        batch->status = status;
+    }
+}
+
+static void batchCopyOutput(FILE *from, FILE *to) {
+    char buffer[4096];
+    size_t count;
+
+    rewind(from);
+    while ((count = fread(&buffer[0], 1, sizeof(buffer), from)) > 0)
+        fwrite(&buffer[0], 1, count, to);
+
+    fclose(from);
+}
+
+// Waits for the background lines and prints their output in line order
+static void batchWait(struct Batch *batch) {
+    for (u32 i = 0; i < batch->jobCount; i += 1) {
+        struct BatchJob *job = &batch->jobs[i];
+
+        i32 status = 1;
+        if (job->task) {
+            VolWait(job->task);
+            status = job->status;
+            free(job->argv);
+        } else if (job->pid > 0) {
+            int wstatus;
+            while (waitpid(job->pid, &wstatus, 0) < 0 && errno == EINTR);
+            status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+        }
+
+        batchCopyOutput(job->out, stdout);
+        if (job->err)
+            batchCopyOutput(job->err, stderr);
+        fflush(stdout);
+        fflush(stderr);
+
+        if (status)
+            batchFailed(batch, job->line, status);
+    }
+
+    batch->jobCount = 0;
+    batch->running = 0;
+}
+
+static i32 batchRun(i32 argc, const char **argv, union FlagValue *flagValues) {
+    // NOTE: the line may be given flags the batch wasn't
+    RestoreFlagValues(flagValues);
+
+    i32 status = RunCommand(argc, argv);
+    fflush(stdout);
+    fflush(stderr);
+
+    return status;
+}
+
+// Whether the line's command takes a context, so it can run on another thread
+static b32 batchInProcess(i32 argc, const char **argv) {
+    // NOTE: the line reports its own flag errors when it runs
+    VolContext *ctx = ContextCreate(-1);
+    ParseContextFlags(ctx, &argc, &argv, true);
+
+    i32 command = ctx->commandName ? CommandForName(ctx->commandName) : -1;
+    b32 inProcess = command >= 0 && commands.contextFunctions[command]
+        && !ctx->values[BuiltinFlag_Help].b && !ctx->values[BuiltinFlag_Version].b;
+
+    ContextFree(ctx);
+    return inProcess;
+}
+
+static void batchRunTask(void *data) {
+    struct BatchJob *job = (struct BatchJob *)data;
+
+    job->status = RunContextCommand(job->ctx, job->argc, job->argv);
+
+    // NOTE: writes what's left of the output to the line's file
+    ContextFree(job->ctx);
+    job->ctx = NULL;
+}
+
+static void batchStart(struct Batch *batch, u32 line, i32 argc, const char **argv, union FlagValue *flagValues) {
+    // NOTE: the background lines of a batch run at most as many at once as other processes
+    if (batch->running >= batch->limit)
+        batchWait(batch);
+
+    b32 inProcess = batchInProcess(argc, argv);
+
+    struct BatchJob *job = &batch->jobs[batch->jobCount++];
+    memset(job, 0, sizeof(*job));
+    job->line = line;
+    job->out = tmpfile();
+    job->err = inProcess ? NULL : tmpfile();
+    job->pid = -1;
+
+    if (!job->out || (!inProcess && !job->err)) {
+        fprintf(stderr, "ERROR: Unable to capture the output of line %u\n", line);
+        if (job->out) fclose(job->out);
+        if (job->err) fclose(job->err);
+        batch->jobCount--;
+        batchFailed(batch, line, 1);
+        return;
+    }
+
+    if (inProcess) {
+        // NOTE: the words live on the caller's stack
+        job->argc = argc;
+        job->argv = calloc(argc + 1, sizeof(const char *));
+        memcpy(job->argv, argv, argc * sizeof(const char *));
+
+        // NOTE: the flag variables hold the batch's own flags while lines run
+        job->ctx = ContextCreate(fileno(job->out));
+        job->ctx->background = true;
+
+        job->task = VolSubmit(batchRunTask, job);
+        batch->running++;
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    job->pid = fork();
+    if (job->pid == 0) {
+        int null = open("/dev/null", O_RDONLY);
+        dup2(null, STDIN_FILENO);
+        dup2(fileno(job->out), STDOUT_FILENO);
+        dup2(fileno(job->err), STDERR_FILENO);
+
+        SandboxAfterFork();
+
+        _exit(batchRun(argc, argv, flagValues));
+    }
+
+    if (job->pid < 0)
+        fprintf(stderr, "ERROR: Unable to start line %u: %s\n", line, strerror(errno));
+
+    batch->running++;
+}
+
+int BatchCommand(const char **args, size_t count) {
+    if (count != 1) {
+        printf("ERROR: expected a file with one command per line, or - for stdin\n");
+        return PLUGIN_SHOW_HELP;
+    }
+
+    // NOTE: read up front, the commands get stdin to themselves
+    FILE *file = strcmp(args[0], "-") == 0 ? stdin : fopen(args[0], "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to read %s\n", args[0]);
+        return 1;
+    }
+
+    char **lines = NULL;
+    u32 lineCount = 0;
+
+    char *line = NULL;
+    size_t lineCap = 0;
+    while (getline(&line, &lineCap, file) > 0) {
+        lines = realloc(lines, (lineCount + 1) * sizeof(char *));
+        lines[lineCount++] = strdup(line);
+    }
+    free(line);
+
+    if (file != stdin) fclose(file);
+
+    struct Batch batch = {0};
+    batch.jobs = calloc(lineCount + 1, sizeof(struct BatchJob));
+    batch.limit = ProcessLimit();
+
+    const char *commandName = CommandName;
+    union FlagValue *flagValues = SaveFlagValues();
+
+    for (u32 i = 0; i < lineCount && !batch.status; i += 1) {
+        const char *words[256];
+        words[0] = "volv";
+
+        i32 wordCount = splitBatchLine(lines[i], &words[1], 255);
+        if (wordCount < 0) {
+            fprintf(stderr, "ERROR: %s:%u: unterminated quote or too many words\n", args[0], i + 1);
+            batchFailed(&batch, i + 1, 1);
+            break;
+        }
+
+        if (wordCount && strcmp(words[1], "volv") == 0) {
+            words[1] = "volv";
+            wordCount--;
+            memmove(&words[1], &words[2], wordCount * sizeof(const char *));
+        }
+
+        b32 background = wordCount && strcmp(words[wordCount], "&") == 0;
+        if (background) wordCount--;
+
+        if (!wordCount) continue;
+
+        if (background) {
+            batchStart(&batch, i + 1, wordCount + 1, &words[0], flagValues);
+            continue;
+        }
+
+        batchWait(&batch);
+        if (batch.status) break;
+
+        i32 status = batchRun(wordCount + 1, &words[0], flagValues);
+        if (status)
+            batchFailed(&batch, i + 1, status);
+
+        // NOTE: the background lines that follow start from these
+        RestoreFlagValues(flagValues);
+    }
+
+    batchWait(&batch);
+
+    // NOTE: back to the batch's own command line for whatever runs after it
+    RestoreFlagValues(flagValues);
+    FreeFlagValues(flagValues);
+    CommandName = commandName;
+
+    if (batch.status)
+        fprintf(stderr, "ERROR: %s:%u failed with status %d\n", args[0], batch.failedLine, batch.status);
+
+    for (u32 i = 0; i < lineCount; i += 1)
+        free(lines[i]);
+    free(lines);
+    free(batch.jobs);
+
+    return batch.status;
+}
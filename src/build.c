@@ -0,0 +1,168 @@
+// `plugins build` with a compilation cache. Every build is stored in
+// `~/.volva/cache/plugins/` keyed on the source, the compiler, the flags and the
+// plugin API version, so rebuilding an unchanged plugin only reinstalls it.
+
+#ifdef __APPLE__
+#define PLUGIN_BUILD_FLAGS "-Wl,-export_dynamic", "-Wl,-undefined,dynamic_lookup", "-fPIC", "-Werror"
+#else
+// NOTE: ELF shared objects may leave symbols undefined, volv provides them at load
+#define PLUGIN_BUILD_FLAGS "-shared", "-fPIC", "-Werror"
+#endif
+
+static const char *pluginBuildFlags[] = { PLUGIN_BUILD_FLAGS };
+
+static b32 pluginBuildKey(const char *source, u64 *out) {
+    u64 sourceHash;
+    if (!HashFile(source, &sourceHash)) {
+        fprintf(stderr, "ERROR: Unable to read %s\n", source);
+        return false;
+    }
+
+    const char *compiler = GetCCompiler();
+
+    // NOTE: the compiler is identified by its resolved path and binary so an
+    // upgrade invalidates the cache without having to run `cc --version`
+    struct stat st = {0};
+    stat(compiler, &st);
+
+    char identity[2048];
+    int len = snprintf(
+        &identity[0], sizeof(identity),
+        "%s|%llu|%lld|%d",
+        compiler,
+        (unsigned long long)st.st_size,
+        (long long)st.st_mtime,
+        VOLV_PLUGINS_VERSION
+    );
+
+    for (size_t i = 0; i < sizeof(pluginBuildFlags)/sizeof(pluginBuildFlags[0]); i += 1) {
+        if (len >= sizeof(identity)) break;
+        len += snprintf(&identity[len], sizeof(identity)-len, "|%s", pluginBuildFlags[i]);
+    }
+
+    if (len >= sizeof(identity)) len = sizeof(identity)-1;
+
+    *out = Hash64(&identity[0], len, sourceHash);
+    return true;
+}
+
+// Atomically places a copy of `from` at `to`. Never a hard link: something
+// writing over the installed file in place would corrupt the cached build too.
+static b32 installFile(const char *from, char *to) {
+    return copyFile(from, to, 0755);
+}
+
+struct PluginBuild {
+    const char *name;
+    char source[1024];
+    char output[1024];
+    char cached[1024];
+    char cachedTmp[1024];
+    char installed[1024];
+    VolProcess *compile;
+};
+
+static b32 preparePluginBuild(struct PluginBuild *build, const char *name) {
+    const char *pluginDir = GetPluginDir();
+    const char *cacheDir = GetCacheDir();
+    if (!pluginDir || !cacheDir) return false;
+
+    build->name = name;
+    build->compile = NULL;
+
+    snprintf(&build->source[0], sizeof(build->source), "%s.c", name);
+    snprintf(&build->output[0], sizeof(build->output), "%s.so", name);
+
+    const char *baseName = strrchr(name, '/');
+    baseName = baseName ? baseName+1 : name;
+
+    u64 key;
+    if (!pluginBuildKey(&build->source[0], &key)) return false;
+
+    snprintf(&build->cached[0], sizeof(build->cached), "%splugins/%s-%016llx.so", cacheDir, baseName, (unsigned long long)key);
+    snprintf(&build->cachedTmp[0], sizeof(build->cachedTmp), "%s.%d.tmp", &build->cached[0], (int)getpid());
+    snprintf(&build->installed[0], sizeof(build->installed), "%s%s.so", pluginDir, baseName);
+
+    return true;
+}
+
+static i32 finishPluginBuild(struct PluginBuild *build) {
+    if (build->compile) {
+        // NOTE: the process is owned by the pool that spawned it
+        i32 status = VolProcessWait(build->compile);
+
+        if (status) {
+            unlink(&build->cachedTmp[0]);
+            return status;
+        }
+
+        if (rename(&build->cachedTmp[0], &build->cached[0]) != 0) {
+            fprintf(stderr, "ERROR: Unable to write %s\n", &build->cached[0]);
+            unlink(&build->cachedTmp[0]);
+            return 1;
+        }
+    }
+
+    makeParentDirs(&build->installed[0]);
+
+    if (!installFile(&build->cached[0], &build->output[0]) || !installFile(&build->cached[0], &build->installed[0])) {
+        fprintf(stderr, "ERROR: Unable to install %s\n", &build->installed[0]);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Builds and installs every plugin in `names`, compiling the ones that aren't
+// cached in parallel.
+i32 BuildPlugins(const char **names, size_t count) {
+    struct PluginBuild *builds = calloc(count, sizeof(struct PluginBuild));
+    b32 *prepared = calloc(count, sizeof(b32));
+    VolProcessPool *pool = VolProcessPoolCreate(0);
+
+    if (FlagVerbose)
+        printf("Using C compiler: %s\n", GetCCompiler());
+
+    for (size_t i = 0; i < count; i += 1) {
+        struct PluginBuild *build = &builds[i];
+        if (!(prepared[i] = preparePluginBuild(build, names[i])))
+            continue;
+
+        if (access(&build->cached[0], R_OK) == 0) {
+            if (FlagVerbose)
+                printf("Using cached build: %s\n", &build->cached[0]);
+            continue;
+        }
+
+        makeParentDirs(&build->cached[0]);
+
+        const char *args[] = {
+            GetCCompiler(),
+            PLUGIN_BUILD_FLAGS,
+            "-o", &build->cachedTmp[0],
+            &build->source[0],
+            NULL
+        };
+
+        build->compile = VolProcessPoolSpawn(pool, &args[0], 0);
+    }
+
+    VolProcessPoolWait(pool);
+
+    i32 status = 0;
+    for (size_t i = 0; i < count; i += 1) {
+        if (!prepared[i]) {
+            status = status ?: 1;
+            continue;
+        }
+
+        i32 err = finishPluginBuild(&builds[i]);
+        status = status ?: err;
+    }
+
+    VolProcessPoolFree(pool);
+    free(prepared);
+    free(builds);
+
+    return status;
+}
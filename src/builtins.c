@@ -0,0 +1,185 @@
+// The builtin commands and flags as static data. They fill the first slots of
+// `commands` and `flags`, so an invocation that only uses builtins doesn't
+// register or allocate anything for them. Plugins register theirs after them.
+//
+// Each table has an index of its names sorted by HashString, looked up by
+// CommandForName and FlagForName. The indexes are built from the tables on the
+// first lookup, adding a builtin is only its enum value and its entry.
+
+static struct Commands commands = {
+    .names = {
+        [BuiltinCommand_Plugins]  = "plugins",
+        [BuiltinCommand_Resource] = "resource",
+        [BuiltinCommand_Serve]    = "serve",
+        [BuiltinCommand_Env]      = "env",
+        [BuiltinCommand_Completions] = "completions",
+        [BuiltinCommand_Batch]    = "batch",
+    },
+    .helpTexts = {
+        [BuiltinCommand_Plugins]  = "Commands for creating and managing plugins",
+        [BuiltinCommand_Resource] = "Copy over Vapor Resources and Views",
+        [BuiltinCommand_Serve]    = "Keeps volv loaded in the background, later invocations run in it",
+        [BuiltinCommand_Env]      = "Commands for creating and managing VCloud env. variables",
+        [BuiltinCommand_Completions] = "Prints the completion script for bash, zsh or fish",
+        [BuiltinCommand_Batch]    = "Runs the commands listed in a file (or - for stdin) in one process",
+    },
+    .functions = {
+        [BuiltinCommand_Plugins]  = PluginsCommand,
+        [BuiltinCommand_Resource] = ResourceCommand,
+        [BuiltinCommand_Serve]    = ServeCommand,
+        [BuiltinCommand_Completions] = CompletionsCommand,
+        [BuiltinCommand_Batch]    = BatchCommand,
+    },
+    .contextFunctions = {
+        [BuiltinCommand_Env]      = envCommand,
+    },
+    .plugins = { [0 ... BuiltinCommandCount-1] = -1 },
+    .count = BuiltinCommandCount,
+};
+
+static const char *formatOptions[] = {
+    [VolFormat_Table]  = "table",
+    [VolFormat_Json]   = "json",
+    [VolFormat_Ndjson] = "ndjson",
+    [VolFormat_Tsv]    = "tsv",
+};
+
+struct CLIFlag flags[256] = {
+    [BuiltinFlag_Help] = {
+        CLIFlagKind_Bool, "help", "h",
+        .ptr.b = &FlagHelp,
+        .help = "Prints help information",
+        .commandId = GlobalCommandId
+    },
+    [BuiltinFlag_Version] = {
+        CLIFlagKind_Bool, "version",
+        .ptr.b = &FlagVersion,
+        .help = "Prints version information",
+        .commandId = GlobalCommandId
+    },
+    [BuiltinFlag_Verbose] = {
+        CLIFlagKind_Bool, "verbose", "v",
+        .ptr.b = &FlagVerbose,
+        .help = "Enable verbose output",
+        .commandId = GlobalCommandId
+    },
+    [BuiltinFlag_Yes] = {
+        CLIFlagKind_Bool, "yes", "y",
+        .ptr.b = &FlagYes,
+        .help = "Automatic 'yes' to all prompts",
+        .commandId = GlobalCommandId
+    },
+    [BuiltinFlag_Format] = {
+        CLIFlagKind_Enum, "format",
+        .options = formatOptions,
+        .nOptions = 4,
+        .ptr.i = &FlagFormat,
+        .help = "Output format",
+        .commandId = GlobalCommandId
+    },
+
+    [BuiltinFlag_App] = {
+        CLIFlagKind_String,
+        .name = "app",
+        .argumentName = "name",
+        .ptr.s = &envAppName,
+        .help = "The target application",
+        .commandId = BuiltinCommand_Env
+    },
+    [BuiltinFlag_All] = {
+        CLIFlagKind_Bool,
+        .name = "all",
+        .alias = "a",
+        .ptr.b = &flagAllEnvironments,
+        .help = "Set value(s) on all environments",
+        .commandId = BuiltinCommand_Env
+    },
+    [BuiltinFlag_Env] = {
+        CLIFlagKind_String,
+        .name = "env",
+        .alias = "e",
+        .argumentName = "name",
+        .ptr.s = &envName,
+        .help = "The target application",
+        .commandId = BuiltinCommand_Env
+    },
+    [BuiltinFlag_Page] = {
+        CLIFlagKind_Bool,
+        .name = "page",
+        .alias = "p",
+        .ptr.b = &flagPage,
+        .help = "Browse the configuration interactively",
+        .commandId = BuiltinCommand_Env
+    },
+    [BuiltinFlag_Promote] = {
+        CLIFlagKind_Bool,
+        .name = "promote",
+        .ptr.b = &flagPromote,
+        .help = "With `env diff a b`, copy the keys that differ from a to b",
+        .commandId = BuiltinCommand_Env
+    },
+    [BuiltinFlag_Apps] = {
+        CLIFlagKind_List,
+        .name = "apps",
+        .argumentName = "name",
+        .ptr.l = &fleetApps,
+        .help = "With `env fleet`, an application to include (repeatable)",
+        .commandId = BuiltinCommand_Env
+    },
+    [BuiltinFlag_Envs] = {
+        CLIFlagKind_List,
+        .name = "envs",
+        .argumentName = "name",
+        .ptr.l = &fleetEnvs,
+        .help = "With `env fleet`, an environment to include (repeatable)",
+        .commandId = BuiltinCommand_Env
+    },
+};
+
+u32 flagCount = BuiltinFlagCount;
+
+static i32 flagPlugins[256] = { [0 ... BuiltinFlagCount-1] = -1 };
+
+static pthread_once_t builtinIndexOnce = PTHREAD_ONCE_INIT;
+
+static int compareNameIndexEntries(const void *a, const void *b) {
+    u64 x = ((const struct NameIndexEntry *)a)->hash, y = ((const struct NameIndexEntry *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+static void sortNameIndex(const char *table, struct NameIndexEntry *entries, u32 count) {
+    qsort(entries, count, sizeof(struct NameIndexEntry), compareNameIndexEntries);
+
+    // NOTE: a builtin sharing its hash with another would never be found
+    for (u32 i = 1; i < count; i += 1) {
+        if (entries[i - 1].hash == entries[i].hash) {
+            fprintf(stderr, "ERROR: builtin %s names %u and %u have the same hash\n", table, entries[i - 1].index, entries[i].index);
+            abort();
+        }
+    }
+}
+
+// NOTE: fills builtinCommandIndex, declared in plugins.c, and builtinFlagIndex,
+// names and aliases, declared in flags.c
+static void buildBuiltinIndexes() {
+    for (u32 i = 0; i < BuiltinCommandCount; i += 1)
+        builtinCommandIndex[i] = (struct NameIndexEntry){ HashString(commands.names[i]), i };
+
+    sortNameIndex("command", &builtinCommandIndex[0], BuiltinCommandCount);
+
+    // NOTE: from the initializers, flags registered later don't go in here
+    u32 count = 0;
+    for (u32 i = 0; i < BuiltinFlagCount; i += 1) {
+        builtinFlagIndex[count++] = (struct NameIndexEntry){ HashString(flags[i].name), i };
+        if (flags[i].alias)
+            builtinFlagIndex[count++] = (struct NameIndexEntry){ HashString(flags[i].alias), i };
+    }
+
+    sortNameIndex("flag", &builtinFlagIndex[0], count);
+    builtinFlagIndexCount = count;
+}
+
+// Builds the builtin name indexes the first time any thread needs them
+void IndexBuiltins() {
+    pthread_once(&builtinIndexOnce, buildBuiltinIndexes);
+}
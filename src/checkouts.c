@@ -0,0 +1,140 @@
+// Discovery of SwiftPM checkouts for the `resource` command. Everything that
+// touches the disk happens here, up front and in parallel, so the interactive
+// part of the command never has to wait on it.
+
+#define CHECKOUTS_PATH ".build/checkouts"
+
+struct Checkout {
+    char name[256];
+    const char *packageName;
+    char version[128];
+    b32 hasViews;
+    b32 hasPublic;
+};
+
+struct CheckoutScan {
+    int dirFd;
+    struct Checkout *checkouts;
+    u32 count;
+};
+
+static b32 isDirAt(int dirFd, const char *path) {
+    struct stat st;
+    return fstatat(dirFd, path, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+static b32 addCheckoutName(struct Checkout **checkouts, u32 *count, u32 *cap, const char *name, u8 type) {
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return false;
+
+    // NOTE: only files can be skipped without a stat, symlinks and unknown
+    // entries are resolved when the checkout is classified
+    if (type == DT_REG || type == DT_FIFO || type == DT_SOCK)
+        return false;
+
+    if (strlen(name) >= sizeof((*checkouts)->name))
+        return false;
+
+    if (*count >= *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *checkouts = realloc(*checkouts, *cap * sizeof(struct Checkout));
+    }
+
+    struct Checkout *checkout = &(*checkouts)[(*count)++];
+    memset(checkout, 0, sizeof(*checkout));
+    strcpy(&checkout->name[0], name);
+    return true;
+}
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+struct linux_dirent64 {
+    u64 d_ino;
+    i64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static u32 listCheckouts(int dirFd, struct Checkout **out) {
+    struct Checkout *checkouts = NULL;
+    u32 count = 0, cap = 0;
+
+    char buffer[32*1024];
+    long read;
+
+    while ((read = syscall(SYS_getdents64, dirFd, &buffer[0], sizeof(buffer))) > 0) {
+        for (long offset = 0; offset < read;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)&buffer[offset];
+            addCheckoutName(&checkouts, &count, &cap, entry->d_name, entry->d_type);
+            offset += entry->d_reclen;
+        }
+    }
+
+    *out = checkouts;
+    return count;
+}
+#else
+static u32 listCheckouts(int dirFd, struct Checkout **out) {
+    struct Checkout *checkouts = NULL;
+    u32 count = 0, cap = 0;
+
+    // NOTE: fdopendir takes ownership of the descriptor
+    DIR *dir = fdopendir(dup(dirFd));
+    if (!dir) return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+        addCheckoutName(&checkouts, &count, &cap, entry->d_name, entry->d_type);
+
+    closedir(dir);
+
+    *out = checkouts;
+    return count;
+}
+#endif
+
+static void classifyCheckout(int dirFd, struct Checkout *checkout) {
+    int fd = openat(dirFd, &checkout->name[0], O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+
+    checkout->hasViews = isDirAt(fd, "Resources/Views");
+    checkout->hasPublic = isDirAt(fd, "Public");
+
+    if (checkout->hasViews || checkout->hasPublic) {
+        checkout->packageName = GetSwiftPackageNameAt(fd);
+        GetCheckoutVersion(fd, &checkout->version[0], sizeof(checkout->version));
+    }
+
+    close(fd);
+}
+
+static void scanCheckout(size_t index, void *data) {
+    struct CheckoutScan *scan = (struct CheckoutScan *)data;
+    classifyCheckout(scan->dirFd, &scan->checkouts[index]);
+}
+
+static int compareCheckouts(const void *a, const void *b) {
+    return strcmp(((struct Checkout *)a)->name, ((struct Checkout *)b)->name);
+}
+
+// Lists every checkout and classifies them in parallel. Returns -1 if there is
+// no checkouts directory.
+i32 ScanCheckouts(struct Checkout **out) {
+    int dirFd = open(CHECKOUTS_PATH, O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0) return -1;
+
+    struct CheckoutScan scan = {0};
+    scan.dirFd = dirFd;
+    scan.count = listCheckouts(dirFd, &scan.checkouts);
+
+    VolParallelFor(scan.count, scanCheckout, &scan);
+
+    close(dirFd);
+
+    qsort(scan.checkouts, scan.count, sizeof(struct Checkout), compareCheckouts);
+
+    *out = scan.checkouts;
+    return scan.count;
+}
@@ -0,0 +1,541 @@
+// Shell completion. The scripts `volv completions <shell>` prints call
+//
+//   volv __complete <shell> <words...>
+//
+// on every TAB, with the words typed so far, the last being the one to
+// complete. It answers without loading plugins: their commands and flags come
+// from `~/.volva/cache/complete.txt`, which is keyed on the name, size and
+// mtime of everything in the plugin directory and only rebuilt, by loading the
+// plugins once, when that changes. Apps and environments are the ones `env`
+// was last used with.
+
+#define COMPLETE_CACHE_MAGIC "volvcmp1"
+#define COMPLETE_MAX_TARGETS 32
+
+enum CompleteShell {
+    CompleteShell_Bash,
+    CompleteShell_Zsh,
+    CompleteShell_Fish
+};
+
+static const char *completeShells[] = {
+    [CompleteShell_Bash] = "bash",
+    [CompleteShell_Zsh]  = "zsh",
+    [CompleteShell_Fish] = "fish",
+};
+
+struct CompletionCommand {
+    const char *name;
+    const char *help;
+};
+
+struct CompletionFlag {
+    const char *name;
+    const char *alias;
+    const char *help;
+    enum CLIFlagKind kind;
+
+    // NOTE: `|` separated for cached flags
+    const char *options;
+
+    // NOTE: the BuiltinFlag, -1 for plugins' flags
+    i32 builtin;
+};
+
+struct Completions {
+    struct CompletionCommand *commands;
+    u32 commandCount;
+
+    struct CompletionFlag *flags;
+    u32 flagCount;
+
+    enum CompleteShell shell;
+};
+
+static void completeCachePath(char *out, size_t len, const char *name) {
+    snprintf(out, len, "%s%s", GetCacheDir() ?: "/tmp/", name);
+}
+
+// Changes whenever a plugin is added, removed or replaced. Also covers volv
+// itself, another version may load the same plugins differently.
+static u64 pluginDirSignature() {
+    u64 signature = Hash64(VERSION, strlen(VERSION), VOLV_PLUGINS_VERSION);
+
+    const char *pluginDir = GetPluginDir();
+    DIR *dir = pluginDir ? opendir(pluginDir) : NULL;
+    if (!dir) return signature;
+
+    char path[1024];
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        snprintf(&path[0], sizeof(path), "%s%s", pluginDir, entry->d_name);
+
+        struct stat st;
+        if (stat(&path[0], &st) != 0) continue;
+
+#ifdef __APPLE__
+        i64 nsec = st.st_mtimespec.tv_nsec;
+#else
+        i64 nsec = st.st_mtim.tv_nsec;
+#endif
+        u64 fields[4] = { st.st_size, st.st_mtime, nsec, st.st_ino };
+
+        // NOTE: summed so the order readdir returns entries in doesn't matter
+        signature += Hash64(&fields[0], sizeof(fields), HashString(entry->d_name));
+    }
+
+    closedir(dir);
+    return signature;
+}
+
+// NOTE: fields are tab separated and entries one per line
+static void writeCompleteField(FILE *out, const char *value) {
+    for (const char *c = value ?: ""; *c; c++)
+        fputc(*c == '\t' || *c == '\n' || *c == '\r' ? ' ' : *c, out);
+}
+
+// The cache text for the plugins that are loaded:
+//
+//   volvcmp1 <signature>
+//   c <name> <help>
+//   f <name> <alias> <kind> <options> <help>
+static char *completeCacheText(u64 signature, size_t *len) {
+    char *text = NULL;
+    FILE *out = open_memstream(&text, len);
+
+    fprintf(out, "%s %016llx\n", COMPLETE_CACHE_MAGIC, (unsigned long long)signature);
+
+    for (size_t i = BuiltinCommandCount; i < commands.count; i += 1) {
+        if (!commands.names[i]) continue;
+
+        fputs("c\t", out);
+        writeCompleteField(out, commands.names[i]);
+        fputc('\t', out);
+        writeCompleteField(out, commands.helpTexts[i]);
+        fputc('\n', out);
+    }
+
+    for (u32 i = BuiltinFlagCount; i < flagCount; i += 1) {
+        struct CLIFlag *flag = &flags[i];
+
+        fputs("f\t", out);
+        writeCompleteField(out, flag->name);
+        fputc('\t', out);
+        writeCompleteField(out, flag->alias);
+        fprintf(out, "\t%d\t", flag->kind);
+
+        for (int k = 0; flag->kind == CLIFlagKind_Enum && k < flag->nOptions; k += 1) {
+            if (k) fputc('|', out);
+            writeCompleteField(out, flag->options[k]);
+        }
+
+        fputc('\t', out);
+        writeCompleteField(out, flag->help);
+        fputc('\n', out);
+    }
+
+    fclose(out);
+    return text;
+}
+
+static char *loadCompleteCache(u64 signature) {
+    char path[1024];
+    completeCachePath(&path[0], sizeof(path), "complete.txt");
+
+    int fd = open(&path[0], O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char *text = malloc(st.st_size + 1);
+    ssize_t len = read(fd, text, st.st_size);
+    close(fd);
+
+    char header[32];
+    snprintf(&header[0], sizeof(header), "%s %016llx\n", COMPLETE_CACHE_MAGIC, (unsigned long long)signature);
+
+    if (len != st.st_size) {
+        free(text);
+        return NULL;
+    }
+
+    // NOTE: terminated first, a short file stops the comparison at its end
+    text[len] = '\0';
+
+    if (strncmp(text, &header[0], strlen(&header[0])) != 0) {
+        free(text);
+        return NULL;
+    }
+
+    return text;
+}
+
+// Loads the plugins to find out what they register and caches it
+static char *buildCompleteCache(u64 signature) {
+    LoadConfig();
+
+    // NOTE: whatever plugins print while loading would end up as completions
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    LoadPlugins();
+
+    fflush(stdout);
+    if (savedStdout >= 0) {
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+    }
+
+    size_t len;
+    char *text = completeCacheText(signature, &len);
+
+    char path[1024], tmpPath[1040];
+    completeCachePath(&path[0], sizeof(path), "complete.txt");
+    snprintf(&tmpPath[0], sizeof(tmpPath), "%s.%d.tmp", &path[0], (int)getpid());
+    makeParentDirs(&path[0]);
+
+    int fd = open(&tmpPath[0], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+        outputWriteAll(fd, text, len);
+        close(fd);
+
+        if (rename(&tmpPath[0], &path[0]) != 0)
+            unlink(&tmpPath[0]);
+    }
+
+    return text;
+}
+
+static char *nextCompleteField(char **cursor) {
+    char *field = *cursor;
+    char *end = field + strcspn(field, "\t");
+
+    *cursor = *end ? end + 1 : end;
+    *end = '\0';
+    return field;
+}
+
+static void addCompleteCache(struct Completions *completions, char *text) {
+    char *line = strchr(text, '\n');
+
+    while (line && *++line) {
+        char *next = strchr(line, '\n');
+        if (next) *next = '\0';
+
+        char *cursor = line;
+        const char *type = nextCompleteField(&cursor);
+
+        if (strcmp(type, "c") == 0) {
+            struct CompletionCommand *command = &completions->commands[completions->commandCount++];
+            command->name = nextCompleteField(&cursor);
+            command->help = nextCompleteField(&cursor);
+        } else if (strcmp(type, "f") == 0) {
+            struct CompletionFlag *flag = &completions->flags[completions->flagCount++];
+            flag->name = nextCompleteField(&cursor);
+            flag->alias = nextCompleteField(&cursor);
+            flag->kind = atoi(nextCompleteField(&cursor));
+            flag->options = nextCompleteField(&cursor);
+            flag->help = nextCompleteField(&cursor);
+            flag->builtin = -1;
+        }
+
+        line = next;
+    }
+}
+
+static void loadCompletions(struct Completions *completions) {
+    u64 signature = pluginDirSignature();
+    char *text = loadCompleteCache(signature) ?: buildCompleteCache(signature);
+
+    // NOTE: every line is at most one entry
+    size_t lines = BuiltinCommandCount + BuiltinFlagCount;
+    for (const char *c = text; *c; c++)
+        lines += *c == '\n';
+
+    completions->commands = calloc(lines, sizeof(struct CompletionCommand));
+    completions->flags = calloc(lines, sizeof(struct CompletionFlag));
+
+    for (u32 i = 0; i < BuiltinCommandCount; i += 1)
+        completions->commands[completions->commandCount++] = (struct CompletionCommand){ commands.names[i], commands.helpTexts[i] };
+
+    for (u32 i = 0; i < BuiltinFlagCount; i += 1) {
+        struct CLIFlag *flag = &flags[i];
+        struct CompletionFlag *completion = &completions->flags[completions->flagCount++];
+
+        *completion = (struct CompletionFlag){ flag->name, flag->alias ?: "", flag->help, flag->kind, "", i };
+
+        // NOTE: the builtin options are static, they only need joining
+        if (flag->kind == CLIFlagKind_Enum) {
+            char *options = NULL;
+            size_t len;
+            FILE *out = open_memstream(&options, &len);
+            for (int k = 0; k < flag->nOptions; k += 1)
+                fprintf(out, k ? "|%s" : "%s", flag->options[k]);
+            fclose(out);
+            completion->options = options;
+        }
+    }
+
+    addCompleteCache(completions, text);
+}
+
+static struct CompletionFlag *completionFlag(struct Completions *completions, const char *name, size_t len) {
+    for (u32 i = 0; i < completions->flagCount; i += 1) {
+        struct CompletionFlag *flag = &completions->flags[i];
+
+        if ((strlen(flag->name) == len && strncmp(flag->name, name, len) == 0)
+            || (strlen(flag->alias) == len && strncmp(flag->alias, name, len) == 0))
+            return flag;
+    }
+
+    return NULL;
+}
+
+static void printCompletion(struct Completions *completions, const char *prefix, const char *value, size_t valueLen, const char *help) {
+    switch (completions->shell) {
+        case CompleteShell_Bash:
+            printf("%s%.*s\n", prefix, (int)valueLen, value);
+            break;
+
+        case CompleteShell_Zsh:
+            // NOTE: _describe splits on the first unescaped colon
+            for (const char *c = prefix; *c; c++)
+                printf(*c == ':' ? "\\:" : "%c", *c);
+            for (size_t i = 0; i < valueLen; i += 1)
+                printf(value[i] == ':' ? "\\:" : "%c", value[i]);
+            printf(":%s\n", help ?: "");
+            break;
+
+        case CompleteShell_Fish:
+            printf("%s%.*s\t%s\n", prefix, (int)valueLen, value, help ?: "");
+            break;
+    }
+}
+
+// Adds the most recent target first, keeping at most COMPLETE_MAX_TARGETS
+void RememberEnvTarget(const char *app, const char *env) {
+    char path[1024], tmpPath[1040];
+    completeCachePath(&path[0], sizeof(path), "targets");
+    snprintf(&tmpPath[0], sizeof(tmpPath), "%s.%d.%lx.tmp", &path[0], (int)getpid(), (unsigned long)(uintptr_t)pthread_self());
+
+    char target[512];
+    snprintf(&target[0], sizeof(target), "%s\t%s\n", app, env);
+    if (strchr(&target[0], '\n') != &target[strlen(&target[0]) - 1]) return;
+
+    makeParentDirs(&path[0]);
+
+    FILE *out = fopen(&tmpPath[0], "w");
+    if (!out) return;
+    fputs(&target[0], out);
+
+    FILE *in = fopen(&path[0], "r");
+    if (in) {
+        char line[512];
+        for (u32 count = 1; count < COMPLETE_MAX_TARGETS && fgets(&line[0], sizeof(line), in);) {
+            if (strcmp(&line[0], &target[0]) == 0) continue;
+            fputs(&line[0], out);
+            count++;
+        }
+        fclose(in);
+    }
+
+    if (fclose(out) != 0 || rename(&tmpPath[0], &path[0]) != 0)
+        unlink(&tmpPath[0]);
+}
+
+// Apps (`field` 0) or environments (1) `env` was used with, most recent first
+static void completeTargets(struct Completions *completions, const char *prefix, const char *partial, int field) {
+    char path[1024];
+    completeCachePath(&path[0], sizeof(path), "targets");
+
+    FILE *in = fopen(&path[0], "r");
+    if (!in) return;
+
+    char seen[COMPLETE_MAX_TARGETS][256];
+    u32 seenCount = 0;
+
+    char line[512];
+    while (seenCount < COMPLETE_MAX_TARGETS && fgets(&line[0], sizeof(line), in)) {
+        char *tab = strchr(&line[0], '\t');
+        if (!tab) continue;
+
+        const char *value = field ? tab + 1 : &line[0];
+        size_t len = field ? strcspn(value, "\n") : (size_t)(tab - &line[0]);
+        if (len >= sizeof(seen[0]) || strncmp(value, partial, strlen(partial)) != 0) continue;
+
+        b32 duplicate = false;
+        for (u32 i = 0; i < seenCount && !duplicate; i += 1)
+            duplicate = strlen(&seen[i][0]) == len && strncmp(&seen[i][0], value, len) == 0;
+        if (duplicate) continue;
+
+        memcpy(&seen[seenCount][0], value, len);
+        seen[seenCount++][len] = '\0';
+
+        printCompletion(completions, prefix, value, len, field ? "environment" : "app");
+    }
+
+    fclose(in);
+}
+
+static void completeFlagValue(struct Completions *completions, struct CompletionFlag *flag, const char *prefix, const char *partial) {
+    switch (flag->builtin) {
+        case BuiltinFlag_App:
+        case BuiltinFlag_Apps:
+            completeTargets(completions, prefix, partial, 0);
+            return;
+
+        case BuiltinFlag_Env:
+        case BuiltinFlag_Envs:
+            completeTargets(completions, prefix, partial, 1);
+            return;
+    }
+
+    if (flag->kind != CLIFlagKind_Enum) return;
+
+    for (const char *option = flag->options; *option;) {
+        size_t len = strcspn(option, "|");
+        if (strncmp(option, partial, strlen(partial)) == 0 && len >= strlen(partial))
+            printCompletion(completions, prefix, option, len, NULL);
+
+        option += len;
+        if (*option) option++;
+    }
+}
+
+// `volv __complete <shell> <words...>`
+int CompleteCommand(i32 count, const char **words) {
+    struct Completions completions = {0};
+
+    if (count < 1) return 1;
+
+    for (u32 i = 0; i < sizeof(completeShells)/sizeof(completeShells[0]); i += 1) {
+        if (strcmp(words[0], completeShells[i]) == 0)
+            completions.shell = i;
+    }
+    words++;
+    count--;
+
+    const char *current = count ? words[count - 1] : "";
+
+    loadCompletions(&completions);
+
+    // NOTE: volv only takes flags before the command, what comes after is the command's
+    struct CompletionFlag *pending = NULL;
+    for (i32 i = 0; i < count - 1; i += 1) {
+        const char *word = words[i];
+
+        if (pending) {
+            pending = NULL;
+            continue;
+        }
+
+        if (word[0] != '-')
+            return 0;
+
+        const char *name = word + 1 + (word[1] == '-');
+        size_t len = strcspn(name, "=");
+
+        struct CompletionFlag *flag = completionFlag(&completions, name, len);
+        if (flag && flag->kind != CLIFlagKind_Bool && !name[len])
+            pending = flag;
+    }
+
+    if (pending) {
+        completeFlagValue(&completions, pending, "", current);
+        return 0;
+    }
+
+    if (current[0] == '-') {
+        size_t dashes = 1 + (current[1] == '-');
+        const char *name = current + dashes;
+        const char *eql = strchr(name, '=');
+
+        if (eql) {
+            struct CompletionFlag *flag = completionFlag(&completions, name, eql - name);
+            if (!flag) return 0;
+
+            // NOTE: bash treats `=` as a word break and only replaces what follows it
+            char prefix[256] = "";
+            if (completions.shell != CompleteShell_Bash)
+                snprintf(&prefix[0], sizeof(prefix), "%.*s", (int)(eql + 1 - current), current);
+
+            completeFlagValue(&completions, flag, &prefix[0], eql + 1);
+            return 0;
+        }
+
+        const char *prefix = dashes == 2 ? "--" : "-";
+        for (u32 i = 0; i < completions.flagCount; i += 1) {
+            struct CompletionFlag *flag = &completions.flags[i];
+            if (strncmp(flag->name, name, strlen(name)) == 0)
+                printCompletion(&completions, prefix, flag->name, strlen(flag->name), flag->help);
+        }
+
+        return 0;
+    }
+
+    for (u32 i = 0; i < completions.commandCount; i += 1) {
+        struct CompletionCommand *command = &completions.commands[i];
+        if (strncmp(command->name, current, strlen(current)) == 0)
+            printCompletion(&completions, "", command->name, strlen(command->name), command->help);
+    }
+
+    return 0;
+}
+
+static const char completeBashScript[] =
+    "_volv() {\n"
+    "    local line=\"${COMP_LINE:0:COMP_POINT}\" words\n"
+    "    read -ra words <<< \"$line\"\n"
+    "    [[ $line == *[[:space:]] ]] && words+=(\"\")\n"
+    "\n"
+    "    local IFS=$'\\n'\n"
+    "    COMPREPLY=($(volv __complete bash \"${words[@]:1}\" 2>/dev/null))\n"
+    "}\n"
+    "complete -o default -F _volv volv\n";
+
+static const char completeZshScript[] =
+    "#compdef volv\n"
+    "\n"
+    "_volv() {\n"
+    "    local -a completions\n"
+    "    completions=(\"${(@f)$(volv __complete zsh \"${(@)words[2,CURRENT]}\" 2>/dev/null)}\")\n"
+    "\n"
+    "    if [[ -n \"${completions[1]}\" ]]; then\n"
+    "        _describe 'volv' completions\n"
+    "    else\n"
+    "        _files\n"
+    "    fi\n"
+    "}\n"
+    "\n"
+    "compdef _volv volv\n";
+
+static const char completeFishScript[] =
+    "complete -c volv -a '(volv __complete fish (commandline -opc)[2..-1] (commandline -ct) 2>/dev/null)'\n";
+
+// `volv completions <shell>`, the script to source from the shell's startup file
+int CompletionsCommand(const char **args, size_t count) {
+    if (count == 1 && strcmp(args[0], "bash") == 0) {
+        fputs(completeBashScript, stdout);
+    } else if (count == 1 && strcmp(args[0], "zsh") == 0) {
+        fputs(completeZshScript, stdout);
+    } else if (count == 1 && strcmp(args[0], "fish") == 0) {
+        fputs(completeFishScript, stdout);
+    } else {
+        printf("ERROR: expected a shell: bash, zsh or fish\n");
+        return PLUGIN_SHOW_HELP;
+    }
+
+    return PLUGIN_OK;
+}
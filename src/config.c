@@ -1 +1,386 @@
-bool ConfigBufferedInput; 
+// Settings from `~/.volva/config`, an INI style file:
+//
+//   [flags]          defaults for any flag, the command line still wins
+//   app = my-app
+//   format = json
+//
+//   [api]
+//   url = https://api.vapor.cloud
+//   timeout = 30
+//
+// The parsed settings are cached in `~/.volva/cache/config.bin` together with
+// the mtime and size of the file they came from, later runs map the cache and
+// only parse the file again when it changes. Entries are sorted by section and
+// key so every lookup is a binary search and a section is a contiguous range.
+
+bool ConfigBufferedInput;
+
+#define CONFIG_CACHE_MAGIC "volvcfg1"
+
+struct ConfigCacheHeader {
+    char magic[8];
+    i64 mtime;
+    i64 mtimeNsec;
+    u64 size;
+    u32 count;
+    u32 stringsLen;
+};
+
+struct ConfigEntry {
+    u32 section;
+    u32 key;
+    u32 value;
+    u32 line;
+};
+
+struct Config {
+    const struct ConfigEntry *entries;
+    const char *strings;
+    u32 count;
+};
+
+static struct Config config;
+static pthread_once_t configOnce = PTHREAD_ONCE_INIT;
+
+static const char *configString(u32 offset) {
+    return config.strings + offset;
+}
+
+static int compareConfigEntries(const struct ConfigEntry *a, const struct ConfigEntry *b, const char *strings) {
+    int cmp = strcmp(strings + a->section, strings + b->section);
+    if (cmp) return cmp;
+
+    cmp = strcmp(strings + a->key, strings + b->key);
+    if (cmp) return cmp;
+
+    return a->line < b->line ? -1 : a->line > b->line;
+}
+
+static const char *configSortStrings;
+
+static int compareConfigEntriesForSort(const void *a, const void *b) {
+    return compareConfigEntries(a, b, configSortStrings);
+}
+
+static char *trimConfigText(char *start, char *end) {
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    *end = '\0';
+    return start;
+}
+
+// Parses the config text into a cache image: header, sorted entries, strings
+static char *parseConfigText(char *text, size_t len, size_t *outLen) {
+    struct ConfigEntry *entries = NULL;
+    u32 count = 0, cap = 0;
+
+    // NOTE: strings are copied out of the text as they are, so its size bounds them
+    char *strings = malloc(len + 2);
+    u32 stringsLen = 1;
+    strings[0] = '\0';
+
+    u32 section = 0;
+    u32 lineNumber = 0;
+
+    char *line = text;
+    char *textEnd = text + len;
+
+    while (line < textEnd) {
+        char *lineEnd = memchr(line, '\n', textEnd - line) ?: textEnd;
+        char *next = lineEnd + 1;
+        lineNumber++;
+
+        char *content = trimConfigText(line, lineEnd);
+        line = next;
+
+        if (!*content || *content == '#' || *content == ';')
+            continue;
+
+        if (*content == '[') {
+            char *close = strchr(content, ']');
+            if (!close) {
+                fprintf(stderr, "~/.volva/config:%u: expected ]\n", lineNumber);
+                continue;
+            }
+
+            char *name = trimConfigText(content + 1, close);
+            section = stringsLen;
+            size_t nameLen = strlen(name);
+            memcpy(strings + stringsLen, name, nameLen + 1);
+            stringsLen += nameLen + 1;
+            continue;
+        }
+
+        char *eql = strchr(content, '=');
+        if (!eql) {
+            fprintf(stderr, "~/.volva/config:%u: expected key = value\n", lineNumber);
+            continue;
+        }
+
+        char *key = trimConfigText(content, eql);
+        char *valueEnd = eql + 1 + strlen(eql + 1);
+
+        // NOTE: `#` only starts a comment after whitespace so values like URLs survive
+        for (char *c = eql + 1; *c; c++) {
+            if (*c == '#' && (c[-1] == ' ' || c[-1] == '\t')) {
+                valueEnd = c;
+                break;
+            }
+        }
+
+        char *value = trimConfigText(eql + 1, valueEnd);
+        size_t valueLen = strlen(value);
+        if (valueLen >= 2 && (value[0] == '"' || value[0] == '\'') && value[valueLen-1] == value[0]) {
+            value[valueLen-1] = '\0';
+            value++;
+            valueLen -= 2;
+        }
+
+        if (count >= cap) {
+            cap = cap ? cap * 2 : 32;
+            entries = realloc(entries, cap * sizeof(struct ConfigEntry));
+        }
+
+        struct ConfigEntry *entry = &entries[count++];
+        entry->section = section;
+        entry->line = lineNumber;
+
+        size_t keyLen = strlen(key);
+        entry->key = stringsLen;
+        memcpy(strings + stringsLen, key, keyLen + 1);
+        stringsLen += keyLen + 1;
+
+        entry->value = stringsLen;
+        memcpy(strings + stringsLen, value, valueLen + 1);
+        stringsLen += valueLen + 1;
+    }
+
+    configSortStrings = strings;
+    qsort(entries, count, sizeof(struct ConfigEntry), compareConfigEntriesForSort);
+
+    // NOTE: a key set twice keeps the value from the later line
+    u32 unique = 0;
+    for (u32 i = 0; i < count; i += 1) {
+        if (unique && strcmp(strings + entries[unique-1].section, strings + entries[i].section) == 0
+                   && strcmp(strings + entries[unique-1].key, strings + entries[i].key) == 0) {
+            entries[unique-1] = entries[i];
+        } else {
+            entries[unique++] = entries[i];
+        }
+    }
+
+    size_t imageLen = sizeof(struct ConfigCacheHeader) + unique * sizeof(struct ConfigEntry) + stringsLen;
+    char *image = calloc(1, imageLen);
+
+    struct ConfigCacheHeader *header = (struct ConfigCacheHeader *)image;
+    memcpy(&header->magic[0], CONFIG_CACHE_MAGIC, 8);
+    header->count = unique;
+    header->stringsLen = stringsLen;
+
+    memcpy(header + 1, entries, unique * sizeof(struct ConfigEntry));
+    memcpy(image + sizeof(*header) + unique * sizeof(struct ConfigEntry), strings, stringsLen);
+
+    free(entries);
+    free(strings);
+
+    *outLen = imageLen;
+    return image;
+}
+
+static b32 openConfigImage(const char *image, size_t len) {
+    const struct ConfigCacheHeader *header = (const struct ConfigCacheHeader *)image;
+
+    if (len < sizeof(*header) || memcmp(&header->magic[0], CONFIG_CACHE_MAGIC, 8) != 0)
+        return false;
+
+    size_t entriesLen = (size_t)header->count * sizeof(struct ConfigEntry);
+    if (len != sizeof(*header) + entriesLen + header->stringsLen || !header->stringsLen)
+        return false;
+
+    const struct ConfigEntry *entries = (const struct ConfigEntry *)(header + 1);
+    const char *strings = (const char *)entries + entriesLen;
+
+    // NOTE: every string has to be terminated inside the image
+    if (strings[header->stringsLen - 1] != '\0')
+        return false;
+
+    for (u32 i = 0; i < header->count; i += 1) {
+        if (entries[i].section >= header->stringsLen || entries[i].key >= header->stringsLen || entries[i].value >= header->stringsLen)
+            return false;
+    }
+
+    config.entries = entries;
+    config.strings = strings;
+    config.count = header->count;
+    return true;
+}
+
+static b32 configCacheMatches(const char *image, size_t len, struct stat *st) {
+    const struct ConfigCacheHeader *header = (const struct ConfigCacheHeader *)image;
+    if (len < sizeof(*header)) return false;
+
+#ifdef __APPLE__
+    i64 nsec = st->st_mtimespec.tv_nsec;
+#else
+    i64 nsec = st->st_mtim.tv_nsec;
+#endif
+
+    return header->mtime == (i64)st->st_mtime && header->mtimeNsec == nsec && header->size == (u64)st->st_size;
+}
+
+static void loadConfig() {
+    const char *home = getenv("HOME");
+    if (!home) return;
+
+    char path[1024], cachePath[1024], tmpPath[1040];
+    snprintf(&path[0], sizeof(path), "%s/.volva/config", home);
+    snprintf(&cachePath[0], sizeof(cachePath), "%s/.volva/cache/config.bin", home);
+
+    struct stat st;
+    if (stat(&path[0], &st) != 0) return;
+
+    int cacheFd = open(&cachePath[0], O_RDONLY);
+    if (cacheFd >= 0) {
+        struct stat cacheSt;
+        if (fstat(cacheFd, &cacheSt) == 0 && cacheSt.st_size > 0) {
+            // NOTE: stays mapped for the life of the process, values are handed out as is
+            void *image = mmap(NULL, cacheSt.st_size, PROT_READ, MAP_PRIVATE, cacheFd, 0);
+
+            if (image != MAP_FAILED) {
+                if (configCacheMatches(image, cacheSt.st_size, &st) && openConfigImage(image, cacheSt.st_size)) {
+                    close(cacheFd);
+                    return;
+                }
+                munmap(image, cacheSt.st_size);
+            }
+        }
+        close(cacheFd);
+    }
+
+    int fd = open(&path[0], O_RDONLY);
+    if (fd < 0) return;
+
+    char *text = malloc(st.st_size + 1);
+    ssize_t len = read(fd, text, st.st_size);
+    close(fd);
+
+    if (len < 0) {
+        free(text);
+        return;
+    }
+
+    size_t imageLen;
+    char *image = parseConfigText(text, len, &imageLen);
+    free(text);
+
+    struct ConfigCacheHeader *header = (struct ConfigCacheHeader *)image;
+    header->mtime = st.st_mtime;
+#ifdef __APPLE__
+    header->mtimeNsec = st.st_mtimespec.tv_nsec;
+#else
+    header->mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+    header->size = st.st_size;
+
+    if (!openConfigImage(image, imageLen)) {
+        free(image);
+        return;
+    }
+
+    snprintf(&tmpPath[0], sizeof(tmpPath), "%s.%d.tmp", &cachePath[0], (int)getpid());
+    snprintf(&path[0], sizeof(path), "%s/.volva/cache", home);
+    mkdir(&path[0], 0755);
+
+    int cacheOut = open(&tmpPath[0], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (cacheOut >= 0) {
+        b32 written = write(cacheOut, image, imageLen) == (ssize_t)imageLen;
+        close(cacheOut);
+
+        if (!written || rename(&tmpPath[0], &cachePath[0]) != 0)
+            unlink(&tmpPath[0]);
+    }
+}
+
+// Loads the settings, only the first call does any work
+void LoadConfig() {
+    pthread_once(&configOnce, loadConfig);
+}
+
+// First entry of `section` in the sorted entries, and with `upper` set the
+// first one after it
+static u32 configSearch(const char *section, const char *key, b32 upper) {
+    u32 low = 0, high = config.count;
+
+    while (low < high) {
+        u32 mid = low + (high - low) / 2;
+        const struct ConfigEntry *entry = &config.entries[mid];
+
+        int cmp = strcmp(configString(entry->section), section);
+        if (!cmp && key) cmp = strcmp(configString(entry->key), key);
+
+        if (cmp < 0 || (upper && cmp == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+// Returns the value of `key` in `section`, NULL when it isn't set. Settings
+// outside of any section are in the "" section. Values live as long as the
+// process.
+const char *VolConfigGet(const char *section, const char *key) {
+    if (!key) return NULL;
+    LoadConfig();
+
+    u32 index = configSearch(section ?: "", key, false);
+    if (index >= config.count) return NULL;
+
+    const struct ConfigEntry *entry = &config.entries[index];
+    if (strcmp(configString(entry->section), section ?: "") != 0 || strcmp(configString(entry->key), key) != 0)
+        return NULL;
+
+    return configString(entry->value);
+}
+
+i64 ConfigInt(const char *section, const char *key, i64 fallback) {
+    const char *value = VolConfigGet(section, key);
+    if (!value) return fallback;
+
+    char *end;
+    i64 result = strtoll(value, &end, 10);
+    if (end == value || *end) {
+        fprintf(stderr, "~/.volva/config: expected a number for %s.%s\n", section, key);
+        return fallback;
+    }
+
+    return result;
+}
+
+b32 ConfigParseBool(const char *value, b32 fallback) {
+    if (!value) return fallback;
+
+    if (!strcmp(value, "true") || !strcmp(value, "yes") || !strcmp(value, "on") || !strcmp(value, "1"))
+        return true;
+    if (!strcmp(value, "false") || !strcmp(value, "no") || !strcmp(value, "off") || !strcmp(value, "0"))
+        return false;
+
+    return fallback;
+}
+
+b32 ConfigBool(const char *section, const char *key, b32 fallback) {
+    return ConfigParseBool(VolConfigGet(section, key), fallback);
+}
+
+// Calls `func` with every key and value in `section`
+void ConfigForEach(const char *section, void (*func)(const char *key, const char *value)) {
+    LoadConfig();
+
+    u32 first = configSearch(section, NULL, false);
+    u32 last = configSearch(section, NULL, true);
+
+    for (u32 i = first; i < last; i += 1)
+        func(configString(config.entries[i].key), configString(config.entries[i].value));
+}
@@ -0,0 +1,178 @@
+// Contexts, the state of one invocation of a command (see VolContext in
+// plugins.h). A context's flags start out as the values the flag variables
+// hold when it's created, the defaults, and its command line is parsed into it
+// rather than into them. Commands that take a context never touch the globals,
+// the others get the context's values copied into them before they run.
+
+struct ContextBlock {
+    struct ContextBlock *next;
+    size_t used;
+    size_t cap;
+    _Alignas(16) char data[];
+};
+
+struct VolContext {
+    const char *commandName;
+    // NOTE: indexed like `flags`
+    union FlagValue values[256];
+
+    int fd;
+    // NOTE: allocated on the first write
+    struct Output *out;
+
+    // NOTE: runs alongside other commands, there is no terminal to ask or
+    // draw on and confirmations take their default
+    b32 background;
+
+    struct ContextBlock *arena;
+};
+
+// A context writing its output to `fd`. No flags may be registered or removed
+// until it's freed.
+VolContext *ContextCreate(int fd) {
+    VolContext *ctx = calloc(1, sizeof(VolContext));
+    saveFlagValues(&ctx->values[0]);
+    ctx->fd = fd;
+    return ctx;
+}
+
+// Writes out what's left of the context's output and frees it
+void ContextFree(VolContext *ctx) {
+    if (!ctx) return;
+
+    if (ctx->out) {
+        OutputFlush(ctx->out);
+        free(ctx->out);
+    }
+
+    for (u32 i = 0; i < flagCount; i += 1) {
+        if (flags[i].kind == CLIFlagKind_List)
+            free(ctx->values[i].l.values);
+    }
+
+    struct ContextBlock *block = ctx->arena;
+    while (block) {
+        struct ContextBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(ctx);
+}
+
+// Parses the flags at the start of the command line into the context, leaving
+// the command and its arguments in `pargc` and `pargv`. A quiet parse doesn't
+// report unknown or invalid flags.
+void ParseContextFlags(VolContext *ctx, int *pargc, const char ***pargv, b32 quiet) {
+    parseFlags(pargc, pargv, quiet ? ParseFlags_Quiet : ParseFlags_Context, &ctx->values[0]);
+    ctx->commandName = *pargc >= 1 ? (*pargv)[0] : NULL;
+}
+
+// For commands that still read the flag variables, ResetFlags undoes it
+void ContextApplyFlags(VolContext *ctx) {
+    restoreFlagValues(&ctx->values[0]);
+    CommandName = ctx->commandName;
+}
+
+// The context's buffered output, flushed when it's freed
+struct Output *ContextOutput(VolContext *ctx) {
+    if (!ctx->out) {
+        ctx->out = malloc(sizeof(struct Output));
+        OutputInit(ctx->out, ctx->fd);
+    }
+
+    return ctx->out;
+}
+
+// NOTE: defined in plugins.c
+void GetTermDim(int *width, int *height);
+
+// Renders `table` to the context's output, after what was written before it
+void ContextTable(VolContext *ctx, struct Table *table) {
+    if (ctx->out)
+        OutputFlush(ctx->out);
+
+    i32 termWidth;
+    GetTermDim(&termWidth, NULL);
+
+    TableRender(table, termWidth, ctx->fd);
+}
+
+const char *VolCommandName(VolContext *ctx) {
+    return ctx->commandName;
+}
+
+static union FlagValue *contextFlag(VolContext *ctx, const char *name, enum CLIFlagKind kind) {
+    struct CLIFlag *flag = FlagForName(name);
+    if (!flag || flag->kind != kind) return NULL;
+
+    return &ctx->values[flag - flags];
+}
+
+bool VolFlagBool(VolContext *ctx, const char *name) {
+    union FlagValue *value = contextFlag(ctx, name, CLIFlagKind_Bool);
+    return value ? value->b : false;
+}
+
+int VolFlagEnum(VolContext *ctx, const char *name) {
+    union FlagValue *value = contextFlag(ctx, name, CLIFlagKind_Enum);
+    return value ? value->i : 0;
+}
+
+const char *VolFlagString(VolContext *ctx, const char *name) {
+    union FlagValue *value = contextFlag(ctx, name, CLIFlagKind_String);
+    return value ? value->s : NULL;
+}
+
+struct CLIFlagList VolFlagList(VolContext *ctx, const char *name) {
+    union FlagValue *value = contextFlag(ctx, name, CLIFlagKind_List);
+    return value ? value->l : (struct CLIFlagList){0};
+}
+
+void *VolAlloc(VolContext *ctx, size_t size) {
+    // NOTE: every allocation is aligned for any type
+    size = (size + 15) & ~(size_t)15;
+
+    struct ContextBlock *block = ctx->arena;
+
+    if (!block || block->cap - block->used < size) {
+        size_t cap = size > 16*1024 ? size : 16*1024;
+        block = malloc(sizeof(struct ContextBlock) + cap);
+        block->next = ctx->arena;
+        block->used = 0;
+        block->cap = cap;
+        ctx->arena = block;
+    }
+
+    void *ptr = &block->data[block->used];
+    block->used += size;
+    return ptr;
+}
+
+void VolWrite(VolContext *ctx, const char *data, size_t len) {
+    OutputWrite(ContextOutput(ctx), data, len);
+}
+
+void VolPrintf(VolContext *ctx, const char *fmt, ...) {
+    char buffer[1024];
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(&buffer[0], sizeof(buffer), fmt, args);
+    va_end(args);
+
+    if (len < 0) return;
+
+    if (len < sizeof(buffer)) {
+        VolWrite(ctx, &buffer[0], len);
+        return;
+    }
+
+    char *large = malloc(len + 1);
+    va_start(args, fmt);
+    vsnprintf(large, len + 1, fmt, args);
+    va_end(args);
+
+    VolWrite(ctx, large, len);
+    free(large);
+}
@@ -0,0 +1,82 @@
+// Differences between two environments. Both indexes are sorted by key so the
+// diff is a single merge over them, linear in the number of keys.
+
+enum EnvChangeKind {
+    EnvChange_Added,
+    EnvChange_Removed,
+    EnvChange_Changed
+};
+
+static const char *envChangeNames[] = {
+    [EnvChange_Added] = "added",
+    [EnvChange_Removed] = "removed",
+    [EnvChange_Changed] = "changed"
+};
+
+#define ENV_NO_ENTRY UINT32_MAX
+
+struct EnvChange {
+    enum EnvChangeKind kind;
+
+    // NOTE: indexes into each side, ENV_NO_ENTRY when the key is missing there
+    u32 from;
+    u32 to;
+};
+
+struct EnvDiff {
+    struct EnvChange *changes;
+    u32 count;
+
+    u32 added;
+    u32 removed;
+    u32 changed;
+};
+
+static void addEnvChange(struct EnvDiff *diff, enum EnvChangeKind kind, u32 from, u32 to) {
+    diff->changes[diff->count++] = (struct EnvChange){ kind, from, to };
+
+    switch (kind) {
+        case EnvChange_Added:   diff->added++; break;
+        case EnvChange_Removed: diff->removed++; break;
+        case EnvChange_Changed: diff->changed++; break;
+    }
+}
+
+// Keys only in `to` are added, keys only in `from` are removed. Changes come
+// out sorted by key.
+void DiffEnvIndexes(struct EnvIndex *from, struct EnvIndex *to, struct EnvDiff *diff) {
+    memset(diff, 0, sizeof(*diff));
+    diff->changes = malloc(((size_t)from->count + to->count + 1) * sizeof(struct EnvChange));
+
+    u32 i = 0, j = 0;
+
+    while (i < from->count && j < to->count) {
+        int cmp = strcmp(EnvIndexKey(from, i), EnvIndexKey(to, j));
+
+        if (cmp < 0) {
+            addEnvChange(diff, EnvChange_Removed, i++, ENV_NO_ENTRY);
+        } else if (cmp > 0) {
+            addEnvChange(diff, EnvChange_Added, ENV_NO_ENTRY, j++);
+        } else {
+            struct EnvIndexEntry a = from->entries[i];
+            struct EnvIndexEntry b = to->entries[j];
+
+            if (a.valueLen != b.valueLen || memcmp(EnvIndexValue(from, i), EnvIndexValue(to, j), a.valueLen) != 0)
+                addEnvChange(diff, EnvChange_Changed, i, j);
+
+            i++;
+            j++;
+        }
+    }
+
+    for (; i < from->count; i += 1)
+        addEnvChange(diff, EnvChange_Removed, i, ENV_NO_ENTRY);
+
+    for (; j < to->count; j += 1)
+        addEnvChange(diff, EnvChange_Added, ENV_NO_ENTRY, j);
+}
+
+void FreeEnvDiff(struct EnvDiff *diff) {
+    free(diff->changes);
+    memset(diff, 0, sizeof(*diff));
+}
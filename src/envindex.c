@@ -0,0 +1,336 @@
+// Sorted key index over an environment's configuration. The index is a single
+// flat block, the header, an entry table sorted by key and the strings, so the
+// same layout is used in memory and as the snapshot in
+// `~/.volva/cache/env/`, which is mapped as is instead of being parsed.
+
+#include <fnmatch.h>
+#include <regex.h>
+#include <time.h>
+
+// NOTE: bumped when what the strings hold changes, older snapshots are refetched
+#define ENV_INDEX_MAGIC "volvenv2"
+
+// NOTE: snapshots older than this are refetched
+#define ENV_INDEX_TTL 60
+
+struct EnvIndexHeader {
+    char magic[8];
+    u32 count;
+    u32 stringsLen;
+};
+
+struct EnvIndexEntry {
+    u32 key;
+    u32 keyLen;
+    u32 value;
+    u32 valueLen;
+};
+
+struct EnvIndex {
+    const struct EnvIndexEntry *entries;
+    const char *strings;
+    u32 count;
+
+    void *data;
+    size_t len;
+    b32 mapped;
+};
+
+static int compareKeyValues(const void *a, const void *b) {
+    return strcmp(((struct KeyValue *)a)->key, ((struct KeyValue *)b)->key);
+}
+
+static b32 envIndexOpen(struct EnvIndex *index, void *data, size_t len, b32 mapped) {
+    struct EnvIndexHeader *header = (struct EnvIndexHeader *)data;
+
+    if (len < sizeof(*header) || memcmp(&header->magic[0], ENV_INDEX_MAGIC, 8) != 0)
+        return false;
+
+    size_t entriesLen = (size_t)header->count * sizeof(struct EnvIndexEntry);
+    if (len != sizeof(*header) + entriesLen + header->stringsLen)
+        return false;
+
+    index->entries = (struct EnvIndexEntry *)(header + 1);
+    index->strings = (const char *)index->entries + entriesLen;
+    index->count = header->count;
+    index->data = data;
+    index->len = len;
+    index->mapped = mapped;
+
+    // NOTE: a corrupt snapshot must not send lookups outside the mapping
+    for (u32 i = 0; i < index->count; i += 1) {
+        struct EnvIndexEntry entry = index->entries[i];
+        if ((u64)entry.key + entry.keyLen >= header->stringsLen || (u64)entry.value + entry.valueLen >= header->stringsLen)
+            return false;
+
+        if (index->strings[entry.key + entry.keyLen] != '\0' || index->strings[entry.value + entry.valueLen] != '\0')
+            return false;
+    }
+
+    return true;
+}
+
+// Builds an index over `configs`, sorting them by key in the process
+void BuildEnvIndex(struct EnvIndex *index, struct KeyValue *configs, u32 count) {
+    qsort(configs, count, sizeof(struct KeyValue), compareKeyValues);
+
+    u32 stringsLen = 0;
+    for (u32 i = 0; i < count; i += 1)
+        stringsLen += strlen(configs[i].key) + strlen(configs[i].value ?: "") + 2;
+
+    size_t entriesLen = (size_t)count * sizeof(struct EnvIndexEntry);
+    size_t len = sizeof(struct EnvIndexHeader) + entriesLen + stringsLen;
+    char *data = malloc(len);
+
+    struct EnvIndexHeader *header = (struct EnvIndexHeader *)data;
+    memcpy(&header->magic[0], ENV_INDEX_MAGIC, 8);
+    header->count = count;
+    header->stringsLen = stringsLen;
+
+    struct EnvIndexEntry *entries = (struct EnvIndexEntry *)(header + 1);
+    char *strings = (char *)entries + entriesLen;
+    u32 offset = 0;
+
+    for (u32 i = 0; i < count; i += 1) {
+        const char *value = configs[i].value ?: "";
+        u32 keyLen = strlen(configs[i].key);
+        u32 valueLen = strlen(value);
+
+        entries[i] = (struct EnvIndexEntry){ offset, keyLen, offset + keyLen + 1, valueLen };
+
+        memcpy(strings + offset, configs[i].key, keyLen + 1);
+        memcpy(strings + offset + keyLen + 1, value, valueLen + 1);
+        offset += keyLen + valueLen + 2;
+    }
+
+    envIndexOpen(index, data, len, false);
+}
+
+void FreeEnvIndex(struct EnvIndex *index) {
+    if (index->mapped) {
+        munmap(index->data, index->len);
+    } else {
+        free(index->data);
+    }
+
+    memset(index, 0, sizeof(*index));
+}
+
+static b32 envIndexPath(const char *app, const char *env, char *out, size_t len) {
+    const char *cacheDir = GetCacheDir();
+    if (!cacheDir) return false;
+
+    int written = snprintf(out, len, "%senv/%s-%s.index", cacheDir, app, env);
+    if (written < 0 || (size_t)written >= len) return false;
+
+    // NOTE: names come from the command line, keep them inside the cache
+    for (char *c = out + strlen(cacheDir) + 4; *c; c++) {
+        if (*c == '/') *c = '_';
+    }
+
+    return true;
+}
+
+b32 SaveEnvIndex(struct EnvIndex *index, const char *app, const char *env) {
+    char path[1024], tmpPath[1040];
+    if (!envIndexPath(app, env, &path[0], sizeof(path))) return false;
+
+    makeParentDirs(&path[0]);
+    // NOTE: the thread too, contexts can save the same environment at once
+    snprintf(&tmpPath[0], sizeof(tmpPath), "%s.%d.%lx.tmp", &path[0], (int)getpid(), (unsigned long)(uintptr_t)pthread_self());
+
+    int fd = open(&tmpPath[0], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+
+    outputWriteAll(fd, index->data, index->len);
+    close(fd);
+
+    if (rename(&tmpPath[0], &path[0]) != 0) {
+        unlink(&tmpPath[0]);
+        return false;
+    }
+
+    return true;
+}
+
+// Maps the snapshot for `app`/`env` if there is one younger than `maxAge` seconds
+b32 LoadEnvIndex(VolContext *ctx, struct EnvIndex *index, const char *app, const char *env, i64 maxAge) {
+    char path[1024];
+    if (!envIndexPath(app, env, &path[0], sizeof(path))) return false;
+
+    int fd = open(&path[0], O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || time(NULL) - st.st_mtime > maxAge) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    if (!envIndexOpen(index, data, st.st_size, true)) {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    if (ctx->values[BuiltinFlag_Verbose].b)
+        VolPrintf(ctx, "Using cached configuration: %s\n", &path[0]);
+
+    return true;
+}
+
+// Drops the snapshot so the next lookup goes to the server
+void InvalidateEnvIndex(const char *app, const char *env) {
+    char path[1024];
+    if (envIndexPath(app, env, &path[0], sizeof(path)))
+        unlink(&path[0]);
+}
+
+const char *EnvIndexKey(struct EnvIndex *index, u32 i) {
+    return index->strings + index->entries[i].key;
+}
+
+const char *EnvIndexValue(struct EnvIndex *index, u32 i) {
+    return index->strings + index->entries[i].value;
+}
+
+// First entry whose key doesn't sort before the first `len` bytes of `prefix`,
+// or with `upper` set the first one that sorts after them
+static u32 envIndexSearch(struct EnvIndex *index, const char *prefix, size_t len, b32 upper) {
+    u32 low = 0, high = index->count;
+
+    while (low < high) {
+        u32 mid = low + (high - low) / 2;
+        int cmp = strncmp(EnvIndexKey(index, mid), prefix, len);
+
+        if (cmp < 0 || (upper && cmp == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+struct EnvMatcher {
+    enum { EnvMatch_Exact, EnvMatch_Glob, EnvMatch_Regex } kind;
+    const char *pattern;
+
+    // NOTE: every match starts with this, it narrows the binary search
+    char prefix[256];
+    size_t prefixLen;
+
+    regex_t regex;
+};
+
+static b32 hasTopLevelAlternation(const char *source) {
+    i32 depth = 0;
+    b32 inClass = false;
+
+    for (const char *c = source; *c; c++) {
+        if (*c == '\\' && c[1]) {
+            c++;
+        } else if (inClass) {
+            if (*c == ']') inClass = false;
+        } else if (*c == '[') {
+            inClass = true;
+            if (c[1] == ']') c++;
+        } else if (*c == '(') {
+            depth++;
+        } else if (*c == ')') {
+            depth--;
+        } else if (*c == '|' && depth == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Patterns are a key, a glob such as `DATABASE_*` or an extended regex between
+// slashes such as `/^DB_.*(HOST|PORT)$/`
+static b32 compileEnvMatcher(struct EnvMatcher *matcher, const char *pattern) {
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->pattern = pattern;
+
+    size_t len = strlen(pattern);
+
+    if (len >= 2 && pattern[0] == '/' && pattern[len-1] == '/') {
+        matcher->kind = EnvMatch_Regex;
+
+        char *source = strndup(pattern + 1, len - 2);
+        int err = regcomp(&matcher->regex, source, REG_EXTENDED | REG_NOSUB);
+        if (err) {
+            char message[256];
+            regerror(err, &matcher->regex, &message[0], sizeof(message));
+            fprintf(stderr, "ERROR: Invalid pattern %s: %s\n", pattern, &message[0]);
+            free(source);
+            return false;
+        }
+
+        // NOTE: only an anchored regex without alternatives has a usable literal prefix
+        if (source[0] == '^' && !hasTopLevelAlternation(source)) {
+            const char *c = source + 1;
+            while (*c && !strchr(".[]()*+?{}|^$\\", *c) && matcher->prefixLen < sizeof(matcher->prefix) - 1)
+                matcher->prefix[matcher->prefixLen++] = *c++;
+
+            // NOTE: a quantifier applies to the character before it
+            if (matcher->prefixLen && (*c == '*' || *c == '?' || *c == '{'))
+                matcher->prefixLen--;
+        }
+
+        free(source);
+        return true;
+    }
+
+    size_t literal = strcspn(pattern, "*?[\\");
+    matcher->kind = pattern[literal] ? EnvMatch_Glob : EnvMatch_Exact;
+
+    matcher->prefixLen = literal < sizeof(matcher->prefix) ? literal : sizeof(matcher->prefix) - 1;
+    memcpy(&matcher->prefix[0], pattern, matcher->prefixLen);
+
+    return true;
+}
+
+static void freeEnvMatcher(struct EnvMatcher *matcher) {
+    if (matcher->kind == EnvMatch_Regex)
+        regfree(&matcher->regex);
+}
+
+// Finds the entries matching `matcher`. The candidates are the range sharing the
+// pattern's literal prefix, so lookups are O(log n + k). Returns the number of
+// matches written to `out`, which needs room for `index->count` entries.
+static u32 queryEnvIndex(struct EnvIndex *index, struct EnvMatcher *matcher, u32 *out) {
+    const char *prefix = &matcher->prefix[0];
+    u32 first = envIndexSearch(index, prefix, matcher->prefixLen, false);
+    u32 count = 0;
+
+    if (matcher->kind == EnvMatch_Exact) {
+        // NOTE: including the terminator makes it an exact match
+        size_t len = strlen(matcher->pattern) + 1;
+        first = envIndexSearch(index, matcher->pattern, len, false);
+        u32 last = envIndexSearch(index, matcher->pattern, len, true);
+        for (u32 i = first; i < last; i += 1)
+            out[count++] = i;
+        return count;
+    }
+
+    u32 last = envIndexSearch(index, prefix, matcher->prefixLen, true);
+
+    for (u32 i = first; i < last; i += 1) {
+        const char *key = EnvIndexKey(index, i);
+
+        b32 match = matcher->kind == EnvMatch_Glob
+            ? fnmatch(matcher->pattern, key, 0) == 0
+            : regexec(&matcher->regex, key, 0, NULL, 0) == 0;
+
+        if (match)
+            out[count++] = i;
+    }
+
+    return count;
+}
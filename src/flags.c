@@ -3,15 +3,61 @@ bool FlagVerbose;
 bool FlagVersion;
 bool FlagYes;
 
+int FlagFormat;
+
+// NOTE: in the order `-help` lists them
+enum BuiltinFlag {
+    BuiltinFlag_Help,
+    BuiltinFlag_Version,
+    BuiltinFlag_Verbose,
+    BuiltinFlag_Yes,
+    BuiltinFlag_Format,
+
+    BuiltinFlag_App,
+    BuiltinFlag_All,
+    BuiltinFlag_Env,
+    BuiltinFlag_Page,
+    BuiltinFlag_Promote,
+    BuiltinFlag_Apps,
+    BuiltinFlag_Envs,
+
+    BuiltinFlagCount
+};
+
+// NOTE: these start out holding the builtin flags, defined in builtins.c.
+// Registered flags are appended.
 const char *CommandName;
 struct CLIFlag flags[256];
 u32 flagCount;
 
+// NOTE: which plugin registered each flag, -1 for the host
+static i32 flagPlugins[256];
+
+// NOTE: HashString of the name and alias of each registered flag, the builtin
+// ones are found through builtinFlagIndex instead
+static u64 flagHashes[256];
+static u64 flagAliasHashes[256];
+
+static struct NameIndexEntry builtinFlagIndex[BuiltinFlagCount * 2];
+static u32 builtinFlagIndexCount;
+void IndexBuiltins();
+
 #define GlobalCommandId (-1)
 
+// NOTE: registrations past the 256th, they are left out
+u32 DroppedFlagCount;
+
 void RegisterFlag(CommandId id, struct CLIFlag flag) {
-    if (flagCount >= 256) return;
+    if (flagCount >= 256) {
+        if (!DroppedFlagCount++)
+            fprintf(stderr, "ERROR: Too many flags, '%s' and the ones registered after it are left out\n", flag.name);
+        return;
+    }
+
     flag.commandId = id;
+    flagPlugins[flagCount] = loadingPlugin;
+    flagHashes[flagCount] = HashString(flag.name);
+    flagAliasHashes[flagCount] = flag.alias ? HashString(flag.alias) : 0;
     flags[flagCount++] = flag;
 
     if (FlagVerbose) {
@@ -19,30 +65,219 @@ void RegisterFlag(CommandId id, struct CLIFlag flag) {
     }
 }
 
-void RegisterGlobalFlag(struct CLIFlag flag) {
-    RegisterFlag(GlobalCommandId, flag);
+static b32 flagNamed(struct CLIFlag *flag, const char *name) {
+    return strcmp(flag->name, name) == 0 || (flag->alias && strcmp(flag->alias, name) == 0);
 }
 
-void InitBuiltinFlags() {
-    RegisterGlobalFlag((struct CLIFlag){ CLIFlagKind_Bool, "help", "h", .ptr.b = &FlagHelp, .help = "Prints help information"});
-    RegisterGlobalFlag((struct CLIFlag){ CLIFlagKind_Bool, "version", .ptr.b = &FlagVersion, .help = "Prints version information"});
+struct CLIFlag *FlagForName(const char *name) {
+    u64 hash = HashString(name);
 
-    RegisterGlobalFlag((struct CLIFlag){ CLIFlagKind_Bool, "verbose", "v", .ptr.b = &FlagVerbose, .help = "Enable verbose output"});
-    RegisterGlobalFlag((struct CLIFlag){ CLIFlagKind_Bool, "yes", "y", .ptr.b = &FlagYes, .help = "Automatic 'yes' to all prompts"});
-}
+    IndexBuiltins();
+    i32 builtin = FindNameIndex(&builtinFlagIndex[0], builtinFlagIndexCount, hash);
+    if (builtin >= 0 && flagNamed(&flags[builtin], name))
+        return &flags[builtin];
 
-struct CLIFlag *FlagForName(const char *name) {
-    for (size_t i = 0; i < flagCount; i += 1) {
-        if (strcmp(flags[i].name, name) == 0)
-            return &flags[i];
-        else if (flags[i].alias && strcmp(flags[i].alias, name) == 0)
+    for (size_t i = BuiltinFlagCount; i < flagCount; i += 1) {
+        if ((flagHashes[i] == hash || flagAliasHashes[i] == hash) && flagNamed(&flags[i], name))
             return &flags[i];
     }
 
     return NULL;
 }
 
-void parseFlags(int *pargc, const char ***pargv, b32 internalPass) {
+static b32 setFlagOption(struct CLIFlag *flag, int *out, const char *option) {
+    for (size_t k = 0; k < flag->nOptions; k += 1) {
+        if (strcmp(flag->options[k], option) == 0) {
+            *out = k;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Sets `flag` as if `value` had been passed on the command line
+b32 SetFlagValue(struct CLIFlag *flag, const char *value) {
+    switch (flag->kind) {
+        case CLIFlagKind_Bool:
+            *flag->ptr.b = ConfigParseBool(value, *flag->ptr.b);
+            return true;
+
+        case CLIFlagKind_String:
+            *flag->ptr.s = value;
+            return true;
+
+        case CLIFlagKind_Enum:
+            return setFlagOption(flag, flag->ptr.i, value);
+
+        case CLIFlagKind_List: {
+            struct CLIFlagList *list = flag->ptr.l;
+            list->values = realloc(list->values, (list->count + 1) * sizeof(const char *));
+            list->values[list->count++] = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// NOTE: only flags of this plugin take config values when set
+static i32 configFlagsPlugin;
+static b32 configFlagsFiltered;
+
+static void applyConfigFlag(const char *name, const char *value) {
+    struct CLIFlag *flag = FlagForName(name);
+    if (configFlagsFiltered && (!flag || flagPlugins[flag - flags] != configFlagsPlugin))
+        return;
+
+    if (!flag) {
+        fprintf(stderr, "~/.volva/config: unknown flag %s\n", name);
+        return;
+    }
+
+    if (!SetFlagValue(flag, value))
+        fprintf(stderr, "~/.volva/config: invalid value %s for %s\n", value, name);
+}
+
+// Uses the `[flags]` section of the config as defaults. Has to run once every
+// flag is registered and before the command line is parsed.
+void ApplyConfigFlags() {
+    ConfigForEach("flags", applyConfigFlag);
+}
+
+// ApplyConfigFlags for the flags of a plugin that was just loaded again
+void ApplyPluginConfigFlags(i32 plugin) {
+    configFlagsPlugin = plugin;
+    configFlagsFiltered = true;
+    ConfigForEach("flags", applyConfigFlag);
+    configFlagsFiltered = false;
+}
+
+union FlagValue {
+    int i;
+    bool b;
+    const char *s;
+    struct CLIFlagList l;
+};
+
+static union FlagValue flagDefaults[256];
+
+static void saveFlagValues(union FlagValue *values) {
+    for (u32 i = 0; i < flagCount; i += 1) {
+        struct CLIFlag *flag = &flags[i];
+        union FlagValue *value = &values[i];
+
+        switch (flag->kind) {
+            case CLIFlagKind_Bool:   value->b = *flag->ptr.b; break;
+            case CLIFlagKind_String: value->s = *flag->ptr.s; break;
+            case CLIFlagKind_Enum:   value->i = *flag->ptr.i; break;
+            case CLIFlagKind_List: {
+                // NOTE: parsing reallocs the live list, the defaults need their own copy
+                struct CLIFlagList *list = flag->ptr.l;
+                free(value->l.values);
+                value->l.count = list->count;
+                value->l.values = list->count ? malloc(list->count * sizeof(const char *)) : NULL;
+                if (list->count) memcpy(value->l.values, list->values, list->count * sizeof(const char *));
+            } break;
+        }
+    }
+}
+
+static void restoreFlagValues(union FlagValue *values) {
+    for (u32 i = 0; i < flagCount; i += 1) {
+        struct CLIFlag *flag = &flags[i];
+        union FlagValue *value = &values[i];
+
+        switch (flag->kind) {
+            case CLIFlagKind_Bool:   *flag->ptr.b = value->b; break;
+            case CLIFlagKind_String: *flag->ptr.s = value->s; break;
+            case CLIFlagKind_Enum:   *flag->ptr.i = value->i; break;
+            case CLIFlagKind_List: {
+                struct CLIFlagList *list = flag->ptr.l;
+                free(list->values);
+                list->count = value->l.count;
+                list->values = list->count ? malloc(list->count * sizeof(const char *)) : NULL;
+                if (list->count) memcpy(list->values, value->l.values, list->count * sizeof(const char *));
+            } break;
+        }
+    }
+}
+
+// Remembers the current value of every flag, ResetFlags goes back to them
+void SaveFlagDefaults() {
+    saveFlagValues(&flagDefaults[0]);
+}
+
+// Undoes what parsing a command line did, for running more than one command in
+// a process
+void ResetFlags() {
+    restoreFlagValues(&flagDefaults[0]);
+    CommandName = NULL;
+}
+
+// A copy of the current flag values, for a command that runs others with its
+// own flags as their defaults. No flags may be registered or removed until
+// it's freed.
+union FlagValue *SaveFlagValues() {
+    union FlagValue *values = calloc(256, sizeof(union FlagValue));
+    saveFlagValues(values);
+    return values;
+}
+
+void RestoreFlagValues(union FlagValue *values) {
+    restoreFlagValues(values);
+}
+
+void FreeFlagValues(union FlagValue *values) {
+    for (u32 i = 0; i < flagCount; i += 1) {
+        if (flags[i].kind == CLIFlagKind_List)
+            free(values[i].l.values);
+    }
+
+    free(values);
+}
+
+// Drops the flags `plugin` registered, before it is unloaded
+void RemovePluginFlags(i32 plugin) {
+    u32 count = 0;
+
+    for (u32 i = 0; i < flagCount; i += 1) {
+        if (flagPlugins[i] == plugin) {
+            if (flags[i].kind == CLIFlagKind_List)
+                free(flagDefaults[i].l.values);
+            continue;
+        }
+
+        flags[count] = flags[i];
+        flagPlugins[count] = flagPlugins[i];
+        flagHashes[count] = flagHashes[i];
+        flagAliasHashes[count] = flagAliasHashes[i];
+        flagDefaults[count] = flagDefaults[i];
+        count++;
+    }
+
+    memset(&flagDefaults[count], 0, (flagCount - count) * sizeof(union FlagValue));
+    flagCount = count;
+}
+
+// NOTE: parsing writes into `values` when it's given, into the flags' own
+// variables otherwise
+#define flagTarget(values, flag, member, ptrMember) \
+    ((values) ? &(values)[(flag) - flags].member : (flag)->ptr.ptrMember)
+
+enum ParseFlagsMode {
+    ParseFlags_Context,
+    // NOTE: the builtin pass runs before the plugins register their flags, it
+    // leaves the arguments alone and reports nothing
+    ParseFlags_Internal,
+    // NOTE: a context pass that reports nothing, for a second look at a line
+    ParseFlags_Quiet,
+};
+
+void parseFlags(int *pargc, const char ***pargv, enum ParseFlagsMode mode, union FlagValue *values) {
+    b32 internalPass = mode == ParseFlags_Internal;
+    b32 report = mode == ParseFlags_Context;
+
     int argc = *pargc;
     const char **argv = *pargv;
 
@@ -74,51 +309,64 @@ void parseFlags(int *pargc, const char ***pargv, b32 internalPass) {
 
             struct CLIFlag *flag = FlagForName(name);
             if (!flag || (inverse && flag->kind != CLIFlagKind_Bool)) {
-                if (!internalPass)
+                if (report)
                     printf("Unknown flag %s\n", arg);
                 continue;
             }
 
             switch (flag->kind) {
                 case CLIFlagKind_Bool:
-                    *flag->ptr.b = inverse ? false : true;
+                    *flagTarget(values, flag, b, b) = inverse ? false : true;
                     break;
 
                 case CLIFlagKind_String:
                     if (eqlIndex) {
-                        *flag->ptr.s = eqlIndex+1;
+                        *flagTarget(values, flag, s, s) = eqlIndex+1;
                     } else if (i + 1 < argc) {
                         i++;
-                        *flag->ptr.s = argv[i];
-                    } else {
+                        *flagTarget(values, flag, s, s) = argv[i];
+                    } else if (report) {
                         printf("No value argument after -%s\n", arg);
                     }
                     break;
 
+                case CLIFlagKind_List: {
+                    const char *value = NULL;
+                    if (eqlIndex) {
+                        value = eqlIndex+1;
+                    } else if (i + 1 < argc) {
+                        i++;
+                        value = argv[i];
+                    } else {
+                        if (report) printf("No value argument after -%s\n", arg);
+                        break;
+                    }
+
+                    // NOTE: the builtin pass sees global flags too, only collect them once
+                    if (internalPass) break;
+
+                    struct CLIFlagList *list = flagTarget(values, flag, l, l);
+                    list->values = realloc(list->values, (list->count + 1) * sizeof(const char *));
+                    list->values[list->count++] = value;
+                } break;
+
                 case CLIFlagKind_Enum: {
                     const char *option;
-                    if (i + 1 < argc) {
+                    if (eqlIndex) {
+                        option = eqlIndex+1;
+                    } else if (i + 1 < argc) {
                         i++;
                         option = argv[i];
                     } else {
-                        printf("No value argument after -%s\n", arg);
+                        if (report) printf("No value argument after -%s\n", arg);
                         break;
                     }
 
-                    b32 found = false;
-                    for (size_t k = 0; k < flag->nOptions; k += 1) {
-                        if (strcmp(flag->options[k], option) == 0) {
-                            *flag->ptr.i = k;
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) {
+                    if (!setFlagOption(flag, flagTarget(values, flag, i, i), option) && report) {
                         printf("Invalid value %s for %s. Expected (", option, arg);
-                        for (size_t k = 0; i < flag->nOptions; k += 1) {
+                        for (size_t k = 0; k < flag->nOptions; k += 1) {
+                            if (k) printf("|");
                             printf("%s", flag->options[k]);
-                            printf("|");
                         }
                         printf(")\n");
                         break;
@@ -134,19 +382,11 @@ void parseFlags(int *pargc, const char ***pargv, b32 internalPass) {
     if (!internalPass) {
         *pargc = argc - i;
         *pargv = argv + i;
-
-        if (argc - i >= 1) {
-            CommandName = argv[i];
-        }
     }
 }
 
-void ParseFlags(int *pargc, const char ***pargv) {
-    parseFlags(pargc, pargv, false);
-}
-
 void ParseBuiltinFlags(int *pargc, const char ***pargv) {
-    parseFlags(pargc, pargv, true);
+    parseFlags(pargc, pargv, ParseFlags_Internal, NULL);
 }
 
 void PrintFlags(CommandId commandId) {
@@ -168,6 +408,10 @@ void PrintFlags(CommandId commandId) {
                 k += snprintf(invokation+k, sizeof(invokation)-k, " <%s>", flag.argumentName);
                 break;
 
+            case CLIFlagKind_List:
+                k += snprintf(invokation+k, sizeof(invokation)-k, " <%s>...", flag.argumentName);
+                break;
+
             case CLIFlagKind_Enum:
                 k += snprintf(invokation+k, sizeof(invokation) - k, " <");
                 k += snprintf(invokation+k, sizeof(invokation)-k, "%s", flag.options[0]);
@@ -195,6 +439,7 @@ void PrintUsage(const char *programName) {
         printf("\nCommands:\n");
 
         for (size_t i = 0; i < commands.count; i += 1) {
+            if (!commands.names[i]) continue;
             printf("  %-20s %s\n", commands.names[i], commands.helpTexts[i]);
         }
     }
@@ -0,0 +1,341 @@
+// `env fleet`, fetching the configuration of many (app, env) pairs at once. All
+// requests go through one bounded curl multi pipeline and the results are
+// reported as they arrive, either as one summary table or as a stream of rows.
+
+// NOTE: requests in flight at once, they share a handful of connections
+#define FLEET_CONCURRENCY 32
+
+struct FleetTarget {
+    const char *app;
+    const char *env;
+    char url[CONFIG_URL_SIZE];
+    struct HttpRequest req;
+
+    enum NetError err;
+    i32 keys;
+};
+
+struct Fleet {
+    struct FleetTarget *targets;
+    u32 count;
+    u32 cap;
+
+    // NOTE: the names read from files, targets point into these
+    char **names;
+    u32 nameCount;
+    u32 nameCap;
+
+    struct Output *out;
+    int format;
+    b32 progress;
+    u32 finished;
+    u32 failed;
+    u64 keys;
+};
+
+static void addFleetTarget(struct Fleet *fleet, const char *app, const char *env) {
+    if (fleet->count >= fleet->cap) {
+        fleet->cap = fleet->cap ? fleet->cap * 2 : 64;
+        fleet->targets = realloc(fleet->targets, fleet->cap * sizeof(struct FleetTarget));
+    }
+
+    struct FleetTarget *target = &fleet->targets[fleet->count++];
+    memset(target, 0, sizeof(*target));
+    target->app = app;
+    target->env = env;
+}
+
+static const char *fleetName(struct Fleet *fleet, const char *name) {
+    if (fleet->nameCount >= fleet->nameCap) {
+        fleet->nameCap = fleet->nameCap ? fleet->nameCap * 2 : 64;
+        fleet->names = realloc(fleet->names, fleet->nameCap * sizeof(char *));
+    }
+
+    return fleet->names[fleet->nameCount++] = strdup(name);
+}
+
+static void freeFleet(struct Fleet *fleet) {
+    for (u32 i = 0; i < fleet->nameCount; i += 1)
+        free(fleet->names[i]);
+
+    free(fleet->names);
+    free(fleet->targets);
+}
+
+// Reads `app [env...]` lines, `#` starts a comment. Apps without environments
+// get every one in `envs`.
+static b32 loadFleetFile(struct Fleet *fleet, const char *path, struct CLIFlagList *envs) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to read %s\n", path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t lineCap = 0;
+
+    while (getline(&line, &lineCap, file) > 0) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *save;
+        char *word = strtok_r(line, " \t\r\n,", &save);
+        if (!word) continue;
+
+        const char *app = fleetName(fleet, word);
+
+        b32 hasEnv = false;
+        char *env;
+        while ((env = strtok_r(NULL, " \t\r\n,", &save))) {
+            addFleetTarget(fleet, app, fleetName(fleet, env));
+            hasEnv = true;
+        }
+
+        for (int i = 0; !hasEnv && i < envs->count; i += 1)
+            addFleetTarget(fleet, app, envs->values[i]);
+    }
+
+    free(line);
+    if (file != stdin) fclose(file);
+
+    return true;
+}
+
+static const char *fleetError(struct FleetTarget *target) {
+    switch (target->err) {
+        case NetError_None:           return target->keys < 0 ? "malformed response" : NULL;
+        case NetError_VaporCloudAuth: return "unauthorized";
+        case NetError_CurlInit:       return "network unavailable";
+        default:                      break;
+    }
+
+    static __thread char buffer[32];
+    if (target->req.status) {
+        snprintf(&buffer[0], sizeof(buffer), "HTTP %ld", target->req.status);
+        return &buffer[0];
+    }
+
+    return "request failed";
+}
+
+static void fleetRenderEntries(struct Fleet *fleet, struct FleetTarget *target, struct KeyValue *configs) {
+    struct Output *out = fleet->out;
+    const char *error = fleetError(target);
+
+    switch (fleet->format) {
+        case VolFormat_Json:
+            OutputString(out, fleet->finished ? ",\n{\"app\":" : "[\n{\"app\":");
+            OutputJsonString(out, target->app, strlen(target->app));
+            OutputString(out, ",\"env\":");
+            OutputJsonString(out, target->env, strlen(target->env));
+
+            if (error) {
+                OutputString(out, ",\"error\":");
+                OutputJsonString(out, error, strlen(error));
+                OutputChar(out, '}');
+                break;
+            }
+
+            OutputString(out, ",\"config\":{");
+            for (i32 i = 0; i < target->keys; i += 1) {
+                if (i) OutputChar(out, ',');
+                OutputJsonString(out, configs[i].key, strlen(configs[i].key));
+                OutputChar(out, ':');
+                OutputJsonString(out, configs[i].value ?: "", configs[i].value ? strlen(configs[i].value) : 0);
+            }
+            OutputString(out, "}}");
+            break;
+
+        case VolFormat_Ndjson:
+            if (error) {
+                OutputString(out, "{\"app\":");
+                OutputJsonString(out, target->app, strlen(target->app));
+                OutputString(out, ",\"env\":");
+                OutputJsonString(out, target->env, strlen(target->env));
+                OutputString(out, ",\"error\":");
+                OutputJsonString(out, error, strlen(error));
+                OutputWrite(out, "}\n", 2);
+                break;
+            }
+
+            for (i32 i = 0; i < target->keys; i += 1) {
+                OutputString(out, "{\"app\":");
+                OutputJsonString(out, target->app, strlen(target->app));
+                OutputString(out, ",\"env\":");
+                OutputJsonString(out, target->env, strlen(target->env));
+                OutputString(out, ",\"key\":");
+                OutputJsonString(out, configs[i].key, strlen(configs[i].key));
+                OutputString(out, ",\"value\":");
+                OutputJsonString(out, configs[i].value ?: "", configs[i].value ? strlen(configs[i].value) : 0);
+                OutputWrite(out, "}\n", 2);
+            }
+            break;
+
+        case VolFormat_Tsv:
+            // NOTE: failures only go to stderr, every TSV row is a key
+            if (error) {
+                fprintf(stderr, "%s/%s: %s\n", target->app, target->env, error);
+                break;
+            }
+
+            for (i32 i = 0; i < target->keys; i += 1) {
+                OutputTsvString(out, target->app, strlen(target->app));
+                OutputChar(out, '\t');
+                OutputTsvString(out, target->env, strlen(target->env));
+                OutputChar(out, '\t');
+                OutputTsvString(out, configs[i].key, strlen(configs[i].key));
+                OutputChar(out, '\t');
+                OutputTsvString(out, configs[i].value ?: "", configs[i].value ? strlen(configs[i].value) : 0);
+                OutputChar(out, '\n');
+            }
+            break;
+    }
+
+    // NOTE: stream results as they come in instead of when the buffer fills up
+    OutputFlush(out);
+}
+
+static void fleetDone(struct HttpRequest *req, enum NetError err, void *userData) {
+    struct Fleet *fleet = (struct Fleet *)userData;
+    struct FleetTarget *target = (struct FleetTarget *)((char *)req - offsetof(struct FleetTarget, req));
+
+    target->err = err;
+
+    struct KeyValue *configs = NULL;
+    if (!err && req->response) {
+        target->keys = parseConfigs(&configs, req->response, req->len);
+    } else if (!err) {
+        target->keys = 0;
+    }
+
+    if (target->keys > 0) {
+        // NOTE: every sweep refreshes the snapshots `env get` reads from
+        struct EnvIndex index;
+        BuildEnvIndex(&index, configs, target->keys);
+        SaveEnvIndex(&index, target->app, target->env);
+        FreeEnvIndex(&index);
+
+        fleet->keys += target->keys;
+    }
+
+    if (fleetError(target))
+        fleet->failed++;
+
+    if (fleet->format != VolFormat_Table)
+        fleetRenderEntries(fleet, target, configs);
+
+    fleet->finished++;
+
+    free(req->response);
+    req->response = NULL;
+
+    for (i32 i = 0; i < target->keys; i += 1) {
+        free((char *)configs[i].key);
+        free((char *)configs[i].value);
+    }
+    free(configs);
+
+    if (fleet->progress)
+        fprintf(stderr, "\r%u/%u", fleet->finished, fleet->count);
+}
+
+static int compareFleetTargets(const void *a, const void *b) {
+    const struct FleetTarget *x = (const struct FleetTarget *)a;
+    const struct FleetTarget *y = (const struct FleetTarget *)b;
+
+    int cmp = strcmp(x->app, y->app);
+    return cmp ? cmp : strcmp(x->env, y->env);
+}
+
+static void fleetReport(VolContext *ctx, struct Fleet *fleet, double seconds) {
+    qsort(fleet->targets, fleet->count, sizeof(struct FleetTarget), compareFleetTargets);
+
+    struct Table table;
+    TableInit(&table, 4);
+    TableAddRow(&table, (const char *[]){ "app", "env", "keys", "status" });
+
+    char *counts = malloc(fleet->count * 16);
+
+    for (u32 i = 0; i < fleet->count; i += 1) {
+        struct FleetTarget *target = &fleet->targets[i];
+        const char *error = fleetError(target);
+
+        char *count = &counts[i * 16];
+        snprintf(count, 16, "%d", target->keys > 0 ? target->keys : 0);
+
+        TableAddRow(&table, (const char *[]){ target->app, target->env, error ? "" : count, error ?: "ok" });
+    }
+
+    if (fleet->progress)
+        fprintf(stderr, "\r\x1b[K");
+
+    ContextTable(ctx, &table);
+    TableFree(&table);
+    free(counts);
+
+    VolPrintf(ctx,
+        "%u environments, %llu keys, %u failed in %.2fs\n",
+        fleet->count, (unsigned long long)fleet->keys, fleet->failed, seconds
+    );
+}
+
+// `env fleet [file...]`. Targets are read from the files and built from every
+// `-apps` crossed with every `-envs`, which defaults to `-env`.
+i32 FleetCommand(VolContext *ctx, const char **args, size_t count, struct CLIFlagList *apps, struct CLIFlagList *envs) {
+    struct Fleet fleet = { .format = ctx->values[BuiltinFlag_Format].i };
+    fleet.progress = fleet.format == VolFormat_Table && !ctx->background && isatty(STDERR_FILENO);
+
+    for (size_t i = 0; i < count; i += 1) {
+        if (!loadFleetFile(&fleet, args[i], envs)) {
+            freeFleet(&fleet);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < apps->count; i += 1) {
+        for (int j = 0; j < envs->count; j += 1)
+            addFleetTarget(&fleet, apps->values[i], envs->values[j]);
+    }
+
+    if (!fleet.count) {
+        VolPrintf(ctx, "ERROR: expected apps with -apps <name> or a file listing them\n");
+        freeFleet(&fleet);
+        return PLUGIN_SHOW_HELP;
+    }
+
+    struct HttpRequest **reqs = malloc(fleet.count * sizeof(struct HttpRequest *));
+
+    for (u32 i = 0; i < fleet.count; i += 1) {
+        struct FleetTarget *target = &fleet.targets[i];
+        target->req.method = HTTPMethodDescriptions[Method_Get];
+        target->req.url = vaporCloudConfigUrl(&target->url[0], target->app, target->env);
+        target->req.flags = VOL_HTTP_VAPOR_AUTH;
+        target->req.verbose = ctx->values[BuiltinFlag_Verbose].b;
+        reqs[i] = &target->req;
+    }
+
+    fleet.out = ContextOutput(ctx);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    i64 concurrency = ConfigInt("fleet", "concurrency", FLEET_CONCURRENCY);
+    HttpPerformMany(reqs, fleet.count, concurrency > 0 ? concurrency : FLEET_CONCURRENCY, fleetDone, &fleet);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (fleet.format == VolFormat_Json) {
+        OutputString(fleet.out, fleet.finished ? "\n]\n" : "[]\n");
+        OutputFlush(fleet.out);
+    } else if (fleet.format == VolFormat_Table) {
+        fleetReport(ctx, &fleet, seconds);
+    }
+
+    i32 status = fleet.failed ? 1 : PLUGIN_OK;
+
+    free(reqs);
+    freeFleet(&fleet);
+
+    return status;
+}
@@ -0,0 +1,152 @@
+// NOTE: this is XXH64 (https://github.com/Cyan4973/xxHash), it is fast enough
+// that hashing a file is bound by reading it and stable across platforms so
+// hashes can be written to disk.
+
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline u64 hashRotl64(u64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 hashRead64(const u8 *p) {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 hashRead32(const u8 *p) {
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u64 hashRound(u64 acc, u64 input) {
+    acc += input * HASH_PRIME64_2;
+    acc  = hashRotl64(acc, 31);
+    acc *= HASH_PRIME64_1;
+    return acc;
+}
+
+static inline u64 hashMergeRound(u64 acc, u64 val) {
+    val  = hashRound(0, val);
+    acc ^= val;
+    acc  = acc * HASH_PRIME64_1 + HASH_PRIME64_4;
+    return acc;
+}
+
+u64 Hash64(const void *data, size_t len, u64 seed) {
+    const u8 *p = (const u8 *)data;
+    const u8 *end = p + len;
+    u64 h;
+
+    if (len >= 32) {
+        const u8 *limit = end - 32;
+        u64 v1 = seed + HASH_PRIME64_1 + HASH_PRIME64_2;
+        u64 v2 = seed + HASH_PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - HASH_PRIME64_1;
+
+        do {
+            v1 = hashRound(v1, hashRead64(p)); p += 8;
+            v2 = hashRound(v2, hashRead64(p)); p += 8;
+            v3 = hashRound(v3, hashRead64(p)); p += 8;
+            v4 = hashRound(v4, hashRead64(p)); p += 8;
+        } while (p <= limit);
+
+        h = hashRotl64(v1, 1) + hashRotl64(v2, 7) + hashRotl64(v3, 12) + hashRotl64(v4, 18);
+        h = hashMergeRound(h, v1);
+        h = hashMergeRound(h, v2);
+        h = hashMergeRound(h, v3);
+        h = hashMergeRound(h, v4);
+    } else {
+        h = seed + HASH_PRIME64_5;
+    }
+
+    h += (u64)len;
+
+    while (p + 8 <= end) {
+        h ^= hashRound(0, hashRead64(p));
+        h  = hashRotl64(h, 27) * HASH_PRIME64_1 + HASH_PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= (u64)hashRead32(p) * HASH_PRIME64_1;
+        h  = hashRotl64(h, 23) * HASH_PRIME64_2 + HASH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p) * HASH_PRIME64_5;
+        h  = hashRotl64(h, 11) * HASH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= HASH_PRIME64_2;
+    h ^= h >> 29;
+    h *= HASH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+u64 HashString(const char *str) {
+    return Hash64(str, strlen(str), 0);
+}
+
+// A name's hash and what it names, tables of these are sorted by hash
+struct NameIndexEntry {
+    u64 hash;
+    u32 index;
+};
+
+// Binary search for `hash` in a sorted name index. Returns the entry's index
+// or -1, names that share a hash with a different one still need comparing.
+i32 FindNameIndex(const struct NameIndexEntry *entries, u32 count, u64 hash) {
+    u32 low = 0, high = count;
+
+    while (low < high) {
+        u32 mid = low + (high - low) / 2;
+
+        if (entries[mid].hash < hash) {
+            low = mid + 1;
+        } else if (entries[mid].hash > hash) {
+            high = mid;
+        } else {
+            return entries[mid].index;
+        }
+    }
+
+    return -1;
+}
+
+// Hashes the contents of the file at `path`. Returns true on success.
+b32 HashFile(const char *path, u64 *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        *out = Hash64(NULL, 0, 0);
+        return true;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    *out = Hash64(data, st.st_size, 0);
+    munmap(data, st.st_size);
+    return true;
+}
@@ -0,0 +1,259 @@
+// Worker pool shared by the host and every plugin. Each worker owns a deque, it
+// pushes and pops its own jobs from the bottom and steals from the top of the
+// others when it runs dry. Threads that wait on a job help run jobs meanwhile so
+// nested waits never deadlock and never leave a core idle.
+
+struct VolJob {
+    VolJobFunc *func;
+    void *data;
+    i32 done;
+};
+
+struct JobDeque {
+    pthread_mutex_t mutex;
+    VolJob **jobs;
+    u32 cap;
+    u32 top;
+    u32 bottom;
+};
+
+struct JobPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+
+    struct JobDeque *deques;
+    pthread_t *threads;
+    u32 workerCount;
+
+    i32 pending;
+    u32 nextDeque;
+};
+
+static struct JobPool jobPool;
+static pthread_once_t jobPoolOnce = PTHREAD_ONCE_INIT;
+static __thread i32 jobWorkerIndex = -1;
+
+// NOTE: 0 sizes the pool to the number of cores
+u32 JobWorkerLimit;
+
+// NOTE: anything above is a typo in the config, not a machine with that many cores
+#define MAX_JOB_WORKERS 256
+
+static void dequePush(struct JobDeque *deque, VolJob *job) {
+    pthread_mutex_lock(&deque->mutex);
+
+    if (deque->bottom - deque->top >= deque->cap) {
+        u32 newCap = deque->cap ? deque->cap * 2 : 64;
+        VolJob **jobs = malloc(newCap * sizeof(VolJob *));
+
+        for (u32 i = deque->top; i != deque->bottom; i += 1)
+            jobs[i & (newCap-1)] = deque->jobs[i & (deque->cap-1)];
+
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->cap = newCap;
+    }
+
+    deque->jobs[deque->bottom++ & (deque->cap-1)] = job;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+static VolJob *dequePop(struct JobDeque *deque) {
+    VolJob *job = NULL;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->bottom != deque->top)
+        job = deque->jobs[--deque->bottom & (deque->cap-1)];
+    pthread_mutex_unlock(&deque->mutex);
+
+    return job;
+}
+
+static VolJob *dequeSteal(struct JobDeque *deque) {
+    VolJob *job = NULL;
+
+    // NOTE: don't contend with the owner, there is always another deque to try
+    if (pthread_mutex_trylock(&deque->mutex) != 0)
+        return NULL;
+
+    if (deque->bottom != deque->top)
+        job = deque->jobs[deque->top++ & (deque->cap-1)];
+    pthread_mutex_unlock(&deque->mutex);
+
+    return job;
+}
+
+static VolJob *takeJob() {
+    VolJob *job = NULL;
+    u32 count = jobPool.workerCount;
+    u32 start = jobWorkerIndex >= 0 ? jobWorkerIndex : 0;
+
+    if (jobWorkerIndex >= 0)
+        job = dequePop(&jobPool.deques[jobWorkerIndex]);
+
+    for (u32 i = 0; !job && i < count; i += 1) {
+        u32 victim = (start + 1 + i) % count;
+        job = dequeSteal(&jobPool.deques[victim]);
+    }
+
+    if (job)
+        __atomic_fetch_sub(&jobPool.pending, 1, __ATOMIC_ACQ_REL);
+
+    return job;
+}
+
+static void runJob(VolJob *job) {
+    job->func(job->data);
+
+    pthread_mutex_lock(&jobPool.mutex);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&jobPool.doneCond);
+    pthread_mutex_unlock(&jobPool.mutex);
+}
+
+static void *jobWorker(void *data) {
+    jobWorkerIndex = (i32)(intptr_t)data;
+
+    for (;;) {
+        VolJob *job = takeJob();
+        if (job) {
+            runJob(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&jobPool.mutex);
+        while (__atomic_load_n(&jobPool.pending, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_wait(&jobPool.workCond, &jobPool.mutex);
+        pthread_mutex_unlock(&jobPool.mutex);
+    }
+
+    return NULL;
+}
+
+// NOTE: only the forking thread exists in the child, it starts a pool of its own
+static void jobPoolAfterFork() {
+    static const pthread_once_t once = PTHREAD_ONCE_INIT;
+    memset(&jobPool, 0, sizeof(jobPool));
+    jobPoolOnce = once;
+}
+
+static void initJobPool() {
+    pthread_atfork(NULL, NULL, jobPoolAfterFork);
+
+    i64 count = JobWorkerLimit ?: ConfigInt("jobs", "workers", 0);
+    if (count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        // NOTE: the waiting thread runs jobs too
+        count = cpus > 1 ? cpus - 1 : 1;
+    }
+
+    if (count > MAX_JOB_WORKERS)
+        count = MAX_JOB_WORKERS;
+
+    pthread_mutex_init(&jobPool.mutex, NULL);
+    pthread_cond_init(&jobPool.workCond, NULL);
+    pthread_cond_init(&jobPool.doneCond, NULL);
+
+    jobPool.deques = calloc(count, sizeof(struct JobDeque));
+    jobPool.threads = calloc(count, sizeof(pthread_t));
+
+    for (i64 i = 0; i < count; i += 1)
+        pthread_mutex_init(&jobPool.deques[i].mutex, NULL);
+
+    jobPool.workerCount = count;
+
+    for (i64 i = 0; i < count; i += 1) {
+        pthread_create(&jobPool.threads[i], NULL, jobWorker, (void *)(intptr_t)i);
+        pthread_detach(jobPool.threads[i]);
+    }
+
+    if (FlagVerbose)
+        printf("Started %u worker threads\n", jobPool.workerCount);
+}
+
+int VolWorkerCount() {
+    pthread_once(&jobPoolOnce, initJobPool);
+    return jobPool.workerCount;
+}
+
+VolJob *VolSubmit(VolJobFunc *func, void *data) {
+    pthread_once(&jobPoolOnce, initJobPool);
+
+    VolJob *job = malloc(sizeof(VolJob));
+    job->func = func;
+    job->data = data;
+    job->done = 0;
+
+    u32 target = jobWorkerIndex >= 0
+        ? (u32)jobWorkerIndex
+        : __atomic_fetch_add(&jobPool.nextDeque, 1, __ATOMIC_RELAXED) % jobPool.workerCount;
+
+    __atomic_fetch_add(&jobPool.pending, 1, __ATOMIC_ACQ_REL);
+    dequePush(&jobPool.deques[target], job);
+
+    pthread_mutex_lock(&jobPool.mutex);
+    pthread_cond_signal(&jobPool.workCond);
+    pthread_mutex_unlock(&jobPool.mutex);
+
+    return job;
+}
+
+void VolWait(VolJob *job) {
+    if (!job) return;
+
+    while (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+        VolJob *other = takeJob();
+        if (other) {
+            runJob(other);
+            continue;
+        }
+
+        pthread_mutex_lock(&jobPool.mutex);
+        if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) && __atomic_load_n(&jobPool.pending, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_wait(&jobPool.doneCond, &jobPool.mutex);
+        pthread_mutex_unlock(&jobPool.mutex);
+    }
+
+    free(job);
+}
+
+struct ParallelFor {
+    VolParallelForFunc *func;
+    void *data;
+    size_t count;
+    size_t next;
+};
+
+static void parallelForWorker(void *data) {
+    struct ParallelFor *loop = (struct ParallelFor *)data;
+
+    for (;;) {
+        size_t index = __atomic_fetch_add(&loop->next, 1, __ATOMIC_RELAXED);
+        if (index >= loop->count) break;
+
+        loop->func(index, loop->data);
+    }
+}
+
+// Calls `func` once for every index in [0, count) spread over the pool and
+// returns once all of them are done.
+void VolParallelFor(size_t count, VolParallelForFunc *func, void *data) {
+    if (!count) return;
+
+    struct ParallelFor loop = { func, data, count, 0 };
+
+    u32 helpers = VolWorkerCount();
+    if (helpers > count - 1) helpers = count - 1;
+
+    VolJob *jobs[256];
+    if (helpers > 256) helpers = 256;
+
+    for (u32 i = 0; i < helpers; i += 1)
+        jobs[i] = VolSubmit(parallelForWorker, &loop);
+
+    parallelForWorker(&loop);
+
+    for (u32 i = 0; i < helpers; i += 1)
+        VolWait(jobs[i]);
+}
@@ -0,0 +1,321 @@
+// JSON documents for plugins, built on top of jsmn. A document is the token
+// array plus a precomputed subtree end for every token so walking siblings is
+// O(1). Strings are handed out as views into the source and only unescaped when
+// asked for, into an arena that lives as long as the document.
+
+struct JsonArenaBlock {
+    struct JsonArenaBlock *next;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+struct VolJson {
+    const char *json;
+    size_t len;
+
+    jsmntok_t *tokens;
+    int *ends;
+    int count;
+
+    const char **unescaped;
+    size_t *unescapedLens;
+    struct JsonArenaBlock *arena;
+};
+
+static char *jsonArenaAlloc(VolJson *doc, size_t size) {
+    struct JsonArenaBlock *block = doc->arena;
+
+    if (!block || block->cap - block->used < size) {
+        size_t cap = size > 16*1024 ? size : 16*1024;
+        block = malloc(sizeof(struct JsonArenaBlock) + cap);
+        block->next = doc->arena;
+        block->used = 0;
+        block->cap = cap;
+        doc->arena = block;
+    }
+
+    char *ptr = &block->data[block->used];
+    block->used += size;
+    return ptr;
+}
+
+// Tokens come in pre-order, so going backwards every child's end is known
+// before its parent's. No recursion: nesting depth is up to the document.
+static void jsonFillEnds(VolJson *doc) {
+    for (int index = doc->count - 1; index >= 0; index -= 1) {
+        jsmntok_t *token = &doc->tokens[index];
+
+        // NOTE: jsmn gives keys a size of 1, their value is skipped by the parent
+        int children = 0;
+        if (token->type == JSMN_OBJECT) children = token->size * 2;
+        if (token->type == JSMN_ARRAY) children = token->size;
+
+        int next = index + 1;
+        for (int i = 0; i < children && next < doc->count; i += 1)
+            next = doc->ends[next];
+
+        doc->ends[index] = next;
+    }
+}
+
+VolJson *VolJsonParse(const char *json, size_t len) {
+    jsmn_parser parser;
+    jsmn_init(&parser);
+
+    // NOTE: jsmn can resume after running out of tokens so start with a guess
+    // and grow instead of doing a separate counting pass
+    u32 cap = len / 8 + 16;
+    jsmntok_t *tokens = malloc(cap * sizeof(jsmntok_t));
+
+    int count;
+    while ((count = jsmn_parse(&parser, json, len, tokens, cap)) == JSMN_ERROR_NOMEM) {
+        cap *= 2;
+        tokens = realloc(tokens, cap * sizeof(jsmntok_t));
+    }
+
+    // NOTE: callers report it, this can run for any context on any thread
+    if (count < 1) {
+        free(tokens);
+        return NULL;
+    }
+
+    VolJson *doc = calloc(1, sizeof(VolJson));
+    doc->json = json;
+    doc->len = len;
+    doc->tokens = tokens;
+    doc->count = count;
+    doc->ends = malloc(count * sizeof(int));
+    jsonFillEnds(doc);
+
+    return doc;
+}
+
+void VolJsonFree(VolJson *doc) {
+    if (!doc) return;
+
+    struct JsonArenaBlock *block = doc->arena;
+    while (block) {
+        struct JsonArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(doc->unescaped);
+    free(doc->unescapedLens);
+    free(doc->ends);
+    free(doc->tokens);
+    free(doc);
+}
+
+int VolJsonType(VolJson *doc, int token) {
+    if (token < 0 || token >= doc->count) return VolJson_Undefined;
+    return doc->tokens[token].type;
+}
+
+int VolJsonSize(VolJson *doc, int token) {
+    if (token < 0 || token >= doc->count) return 0;
+    jsmntok_t t = doc->tokens[token];
+    return t.type == JSMN_OBJECT || t.type == JSMN_ARRAY ? t.size : 0;
+}
+
+struct VolJsonString VolJsonRaw(VolJson *doc, int token) {
+    if (token < 0 || token >= doc->count) return (struct VolJsonString){ "", 0 };
+
+    jsmntok_t t = doc->tokens[token];
+    return (struct VolJsonString){ doc->json + t.start, t.end - t.start };
+}
+
+static b32 jsonRawEquals(VolJson *doc, int token, const char *str, size_t len) {
+    jsmntok_t t = doc->tokens[token];
+    return t.type == JSMN_STRING && (size_t)(t.end - t.start) == len && memcmp(doc->json + t.start, str, len) == 0;
+}
+
+// The token following `token`'s subtree, i.e. its next sibling in an array
+int VolJsonNext(VolJson *doc, int token) {
+    if (token < 0 || token >= doc->count) return -1;
+    return doc->ends[token];
+}
+
+int VolJsonGet(VolJson *doc, int object, const char *key) {
+    if (VolJsonType(doc, object) != JSMN_OBJECT) return -1;
+
+    size_t keyLen = strlen(key);
+    int child = object + 1;
+
+    for (int i = 0; i < doc->tokens[object].size; i += 1) {
+        if (jsonRawEquals(doc, child, key, keyLen))
+            return child + 1;
+
+        child = doc->ends[child + 1];
+    }
+
+    return -1;
+}
+
+int VolJsonIndex(VolJson *doc, int array, int index) {
+    if (VolJsonType(doc, array) != JSMN_ARRAY) return -1;
+    if (index < 0 || index >= doc->tokens[array].size) return -1;
+
+    int child = array + 1;
+    for (int i = 0; i < index; i += 1)
+        child = doc->ends[child];
+
+    return child;
+}
+
+// Decodes the JSON escapes in `src` into `dest`. Returns the decoded length.
+static size_t jsonUnescape(const char *src, size_t len, char *dest) {
+    size_t out = 0;
+
+    for (size_t i = 0; i < len; i += 1) {
+        char c = src[i];
+        if (c != '\\' || i + 1 >= len) {
+            dest[out++] = c;
+            continue;
+        }
+
+        c = src[++i];
+        switch (c) {
+            case 'b': dest[out++] = '\b'; break;
+            case 'f': dest[out++] = '\f'; break;
+            case 'n': dest[out++] = '\n'; break;
+            case 'r': dest[out++] = '\r'; break;
+            case 't': dest[out++] = '\t'; break;
+
+            case 'u': {
+                if (i + 4 >= len) break;
+
+                u32 cp = strtoul((char[5]){ src[i+1], src[i+2], src[i+3], src[i+4], 0 }, NULL, 16);
+                i += 4;
+
+                // NOTE: surrogate pair
+                if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 < len && src[i+1] == '\\' && src[i+2] == 'u') {
+                    u32 low = strtoul((char[5]){ src[i+3], src[i+4], src[i+5], src[i+6], 0 }, NULL, 16);
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+
+                if (cp < 0x80) {
+                    dest[out++] = cp;
+                } else if (cp < 0x800) {
+                    dest[out++] = 0xC0 | (cp >> 6);
+                    dest[out++] = 0x80 | (cp & 0x3F);
+                } else if (cp < 0x10000) {
+                    dest[out++] = 0xE0 | (cp >> 12);
+                    dest[out++] = 0x80 | ((cp >> 6) & 0x3F);
+                    dest[out++] = 0x80 | (cp & 0x3F);
+                } else {
+                    dest[out++] = 0xF0 | (cp >> 18);
+                    dest[out++] = 0x80 | ((cp >> 12) & 0x3F);
+                    dest[out++] = 0x80 | ((cp >> 6) & 0x3F);
+                    dest[out++] = 0x80 | (cp & 0x3F);
+                }
+            } break;
+
+            default:
+                dest[out++] = c;
+        }
+    }
+
+    return out;
+}
+
+// Returns the unescaped string. It points straight into the source when there
+// is nothing to unescape, so it isn't NUL terminated.
+struct VolJsonString VolJsonStr(VolJson *doc, int token) {
+    struct VolJsonString raw = VolJsonRaw(doc, token);
+    if (VolJsonType(doc, token) != JSMN_STRING || !memchr(raw.data, '\\', raw.len))
+        return raw;
+
+    if (!doc->unescaped) {
+        doc->unescaped = calloc(doc->count, sizeof(const char *));
+        doc->unescapedLens = calloc(doc->count, sizeof(size_t));
+    }
+
+    if (!doc->unescaped[token]) {
+        char *dest = jsonArenaAlloc(doc, raw.len + 1);
+        size_t len = jsonUnescape(raw.data, raw.len, dest);
+        dest[len] = '\0';
+
+        doc->unescaped[token] = dest;
+        doc->unescapedLens[token] = len;
+    }
+
+    return (struct VolJsonString){ doc->unescaped[token], doc->unescapedLens[token] };
+}
+
+// Same as VolJsonStr but always NUL terminated. Valid until the document is freed.
+const char *VolJsonCStr(VolJson *doc, int token) {
+    if (token < 0 || token >= doc->count) return NULL;
+
+    struct VolJsonString str = VolJsonStr(doc, token);
+    if (doc->unescaped && doc->unescaped[token])
+        return str.data;
+
+    char *dest = jsonArenaAlloc(doc, str.len + 1);
+    memcpy(dest, str.data, str.len);
+    dest[str.len] = '\0';
+    return dest;
+}
+
+static int jsonQuery(VolJson *doc, int token, const char *path, int *out, int count, int max) {
+    if (token < 0 || count >= max) return count;
+
+    while (*path == '.' && (path[1] == '.' || path[1] == '[' || path[1] == '\0'))
+        path++;
+
+    if (*path == '\0') {
+        out[count++] = token;
+        return count;
+    }
+
+    if (*path == '[') {
+        const char *close = strchr(path, ']');
+        if (!close || VolJsonType(doc, token) != JSMN_ARRAY) return count;
+
+        const char *rest = close + 1;
+        int child = token + 1;
+
+        if (path[1] == '*') {
+            for (int i = 0; i < doc->tokens[token].size && count < max; i += 1) {
+                count = jsonQuery(doc, child, rest, out, count, max);
+                child = doc->ends[child];
+            }
+            return count;
+        }
+
+        return jsonQuery(doc, VolJsonIndex(doc, token, atoi(path+1)), rest, out, count, max);
+    }
+
+    if (*path == '.') path++;
+
+    size_t keyLen = strcspn(path, ".[");
+    const char *rest = path + keyLen;
+
+    if (VolJsonType(doc, token) != JSMN_OBJECT) return count;
+
+    b32 wildcard = keyLen == 1 && path[0] == '*';
+    int child = token + 1;
+
+    for (int i = 0; i < doc->tokens[token].size && count < max; i += 1) {
+        if (wildcard || jsonRawEquals(doc, child, path, keyLen)) {
+            count = jsonQuery(doc, child + 1, rest, out, count, max);
+            if (!wildcard) break;
+        }
+
+        child = doc->ends[child + 1];
+    }
+
+    return count;
+}
+
+// Finds every token matching `path` starting at `token`. Paths are made of
+// `.key`, `[index]` and the wildcards `.*` and `[*]`, e.g. `[*].key`. Returns
+// the number of matches written to `out`.
+int VolJsonQuery(VolJson *doc, int token, const char *path, int *out, int max) {
+    if (!doc || !path) return 0;
+    return jsonQuery(doc, token, path, out, 0, max);
+}
@@ -7,45 +7,121 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <stdarg.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h>
+#include <pthread.h>
 
 #define VERSION "0.0.0 (prerelease)"
 
 typedef uint8_t  u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef int32_t i32;
+typedef int64_t i64;
 
 typedef i32 b32;
 
 #include "plugins.h"
 
+// NOTE: the builtin commands are static data in builtins.c, they take the first
+// ids and plugins' commands come after them
+enum BuiltinCommand {
+    BuiltinCommand_Plugins,
+    BuiltinCommand_Resource,
+    BuiltinCommand_Serve,
+    BuiltinCommand_Env,
+    BuiltinCommand_Completions,
+    BuiltinCommand_Batch,
+
+    BuiltinCommandCount
+};
+
 #define MAX_COMMAND_COUNT 1024
 struct Commands {
     const char *names[MAX_COMMAND_COUNT];
     const char *helpTexts[MAX_COMMAND_COUNT];
     PluginRunFunc *functions[MAX_COMMAND_COUNT];
+    // NOTE: set instead of `functions` for commands that take a context
+    PluginContextRunFunc *contextFunctions[MAX_COMMAND_COUNT];
     PluginHelperFunc *helpers[MAX_COMMAND_COUNT];
+    // NOTE: the plugin that registered the command, -1 for builtins
+    i32 plugins[MAX_COMMAND_COUNT];
+    // NOTE: HashString of the name, compared before the name itself
+    u64 hashes[MAX_COMMAND_COUNT];
     size_t count;
 };
 
 static struct Commands commands;
 
+// NOTE: the plugin whose PluginInit is running, what it registers belongs to it
+static i32 loadingPlugin = -1;
+
 #include "strings.c"
+#include "hash.c"
 #include "json.c"
+#include "jsonquery.c"
+#include "output.c"
+#include "table.c"
+#include "swift.c"
 
 #include "config.c"
 #include "flags.c"
+#include "context.c"
+#include "jobs.c"
+#include "process.c"
+#include "sandbox.c"
 #include "plugins.c"
+#include "sync.c"
+#include "checkouts.c"
+#include "build.c"
+
+static struct termios oldt;
+static b32 changedTerminalState;
+
+static void setTerminalFlags(tcflag_t cleared) {
+    // NOTE: only the state from before the first change is worth restoring
+    if (!changedTerminalState)
+        tcgetattr(STDIN_FILENO, &oldt);
+
+    struct termios t = oldt;
+    t.c_lflag &= ~cleared;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &t);
+    changedTerminalState = true;
+}
+
+void disableBufferedInput() {
+    setTerminalFlags(ICANON);
+}
+
+// Unbuffered input without echo or signals, for full screen interfaces that
+// handle every key themselves
+void enableRawInput() {
+    setTerminalFlags(ICANON | ECHO | ISIG);
+}
+
+void restoreTerminalState() {
+    if (!changedTerminalState) return;
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    changedTerminalState = false;
+}
+
+#include "pager.c"
+#include "complete.c"
 
 // TODO(Brett): conditional build
 #include "nodes.c"
 
 int PluginsCommand(const char **vargs, size_t count) {
     const char *pluginDir = GetPluginDir();
-    char stackBuffer[1024];
 
     if (!count) {
         return System("open", pluginDir);
@@ -53,41 +129,16 @@ int PluginsCommand(const char **vargs, size_t count) {
 
     if (strcmp(vargs[0], "build") == 0) {
         if (count == 1) {
-            fprintf(stderr, "ERROR: The command `plugins build <plugin>` expects a plugin name (without a file extension)\n");
+            fprintf(stderr, "ERROR: The command `plugins build <plugin>...` expects plugin names (without a file extension)\n");
             return 1;
         }
 
-        int count = snprintf(
-            &stackBuffer[0], sizeof(stackBuffer),
-            "%s.c",
-            vargs[1]
-        );
-
-        const char *input = &stackBuffer[0];
-        char *output = &stackBuffer[count += 2];
-
-        snprintf(
-            output, sizeof(stackBuffer)-count,
-            "%s.so",
-            vargs[1]
-        );
-
-        i32 status = SystemV(
-            GetCCompiler(),
-            "-Wl,-export_dynamic", "-Wl,-undefined,dynamic_lookup", "-fPIC", "-Werror",
-            "-o", output,
-            input,
-            NULL
-        );
-
-        if (status) return status;
-
-        return SystemV("cp", output, pluginDir, NULL);
+        return BuildPlugins(vargs+1, count-1);
     }
 
     int argOffset = 0;
 
-    if (strcmp(vargs[0], "install") == 0 && count == 1) {
+    if (strcmp(vargs[0], "install") == 0) {
         argOffset++;
 
         if (count == 1) {
@@ -96,188 +147,101 @@ int PluginsCommand(const char **vargs, size_t count) {
         }
     }
 
-    return SystemV("cp", vargs[argOffset], pluginDir, NULL);
-}
-
-const char *skipWhitespace(const char *buffer) {
-    while (*buffer == ' ' || *buffer == '\n')
-        buffer++;
+    const char *source = vargs[argOffset];
+    const char *name = strrchr(source, '/');
+    name = name ? name + 1 : source;
 
-    return buffer;
-}
-
-const char *getSwiftPackageName(FILE *file, char *buffer, int bufferLen) {
-    int count = fread(buffer, 1, bufferLen, file);
-    buffer[count] = '\0';
+    char path[1024], tmpPath[1024];
+    snprintf(&path[0], sizeof(path), "%s%s", pluginDir, name);
+    snprintf(&tmpPath[0], sizeof(tmpPath), "%s.%s.tmp", pluginDir, name);
 
-    const char *nameStart = NULL;
+    // NOTE: copied next to it and renamed over it, a running `volv serve` never maps a half written plugin
+    i32 status = SystemV("cp", source, &tmpPath[0], NULL);
+    if (status) return status;
 
-    for (int i = 0; i < count; i += 1) {
-        if (buffer[i] == 'n') {
-            if (strncmp(buffer+i, "name", 4) == 0) {
-                nameStart = buffer+i+4;
-                break;
-            }
-        }
+    if (rename(&tmpPath[0], &path[0]) != 0) {
+        fprintf(stderr, "ERROR: Unable to install %s: %s\n", name, strerror(errno));
+        unlink(&tmpPath[0]);
+        return 1;
     }
 
-    if (!nameStart) return NULL;
-
-    nameStart = skipWhitespace(nameStart);
-    if (*(nameStart++) != ':') return NULL;
-    nameStart = skipWhitespace(nameStart);
-    if (*(nameStart++) != '\"') return NULL;
-
-    int nameLen = 0;
-    while (nameStart[nameLen] != '\"')
-        nameLen += 1;
-
-    const char *name = strndup(nameStart, nameLen);
-    return name;
+    return 0;
 }
 
 int ResourceCommand(const char **args, size_t count) {
-    DIR *dir = opendir(".build/checkouts");
-    if (!dir) {
+    struct Checkout *checkouts;
+    i32 checkoutCount = ScanCheckouts(&checkouts);
+    if (checkoutCount < 0) {
         printf("No .build/checkouts directory found\n");
         return PLUGIN_OK;
     }
 
     char dirBuffer[1024];
-    char manifestBuffer[1024];
-    struct dirent *entry;
-    char *heapBuffer = malloc(1024*1024);
-
-    DIR *subdir;
-
-    while ((entry = readdir(dir)) != NULL) {
-        snprintf(&dirBuffer[0], sizeof(dirBuffer), ".build/checkouts/%s/Resources/Views/", entry->d_name);
-        if ((subdir = opendir(dirBuffer)) != NULL) {
-            closedir(subdir);
-
-            snprintf(
-                &manifestBuffer[0],
-                sizeof(manifestBuffer),
-                ".build/checkouts/%s/Package.swift",
-                entry->d_name
-            );
 
-            FILE *swift = fopen(&manifestBuffer[0], "r");
-            if (!swift) continue;
+    struct ResourceManifest manifest;
+    // NOTE: a command without a context has its flags in the flag variables
+    LoadResourceManifest(&manifest, FlagVerbose);
 
-            const char *packageName = getSwiftPackageName(swift, heapBuffer, 1024*1024);
-            fclose(swift);
+    for (i32 i = 0; i < checkoutCount; i += 1) {
+        struct Checkout *checkout = &checkouts[i];
+        if (!checkout->packageName) continue;
 
-            if (!packageName) continue;
-
-            if (!UserConfirmationV("Would you like to install resources for '%s'", packageName)) {
+        if (checkout->hasViews) {
+            if (UserConfirmationV("Would you like to install resources for '%s'", checkout->packageName)) {
+                snprintf(&dirBuffer[0], sizeof(dirBuffer), CHECKOUTS_PATH "/%s/Resources/Views/", checkout->name);
+                SyncResources(&manifest, &dirBuffer[0], "Resources/Views/", checkout->version);
+            } else {
                 printf("  Skipped\n");
-                goto packages;
             }
-
-            //snprintf(heapBuffer, 1024, "Resources/Views/%s", packageName);
-            const char *location = "Resources/Views/";
-            SystemV("mkdir", "-p", location, NULL);
-            SystemV("cp", "-r", &dirBuffer[0], location, NULL);
-            //SystemV("chmod", "-R", "644", location, NULL);
         }
 
-packages:
-        snprintf(&dirBuffer[0], sizeof(dirBuffer), ".build/checkouts/%s/Public/", entry->d_name);
-        if ((subdir = opendir(dirBuffer)) != NULL) {
-            closedir(subdir);
-
-            snprintf(
-                &manifestBuffer[0],
-                sizeof(manifestBuffer),
-                ".build/checkouts/%s/Package.swift",
-                entry->d_name
-            );
-
-            FILE *swift = fopen(&manifestBuffer[0], "r");
-            if (!swift) continue;
-
-            const char *packageName = getSwiftPackageName(swift, heapBuffer, 1024*1024);
-            fclose(swift);
-
-            if (!packageName) continue;
-
-            if (!UserConfirmationV("Would you like to install assets '%s'", packageName)) {
+        if (checkout->hasPublic) {
+            if (UserConfirmationV("Would you like to install assets '%s'", checkout->packageName)) {
+                snprintf(&dirBuffer[0], sizeof(dirBuffer), CHECKOUTS_PATH "/%s/Public/", checkout->name);
+                SyncResources(&manifest, &dirBuffer[0], "Public/", checkout->version);
+            } else {
                 printf("  Skipped\n");
-                continue;
             }
-
-            //snprintf(heapBuffer, 1024, "Public/%s", packageName);
-            const char *location = "Public/";
-            SystemV("mkdir", "-p", location, NULL);
-            SystemV("cp", "-r", &dirBuffer[0], location, NULL);
-            //SystemV("chmod", "-R", "644", location, NULL);
         }
-
     }
 
-    return 0;
-}
-
-void InitBuiltinCommands() {
-    RegisterCommand("plugins", "Commands for creating and managing plugins", PluginsCommand);
-    RegisterCommand("resource", "Copy over Vapor Resources and Views", ResourceCommand);
-    RegisterNodesCommands();
-}
-
-static struct termios oldt;
-static b32 changedTerminalState;
+    SaveResourceManifest(&manifest);
+    free(checkouts);
 
-void disableBufferedInput() {
-    struct termios t;
-    tcgetattr( STDIN_FILENO, &oldt);
-    t = oldt;
-
-    t.c_lflag &= ~(ICANON);
-    tcsetattr(STDIN_FILENO, TCSANOW, &t);
-    changedTerminalState = true;
-}
-
-void restoreTerminalState() {
-    if (!changedTerminalState) return;
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    return 0;
 }
 
-int main(i32 argc, const char **argv) {
+// Parses the command line into `ctx` and runs the command it names. The host
+// has to be set up already: flags and commands registered and plugins loaded.
+i32 RunContextCommand(VolContext *ctx, i32 argc, const char **argv) {
     const char *programName = argv[0];
 
-    InitBuiltinFlags();
-    ParseBuiltinFlags(&argc, &argv);
-
-    InitBuiltinCommands();
-
-    LoadPlugins();
-    ParseFlags(&argc, &argv);
+    ParseContextFlags(ctx, &argc, &argv, false);
 
-    if (FlagVersion) {
+    if (ctx->values[BuiltinFlag_Version].b) {
         printf("%s\n", VERSION);
         return 0;
     }
 
     if (argc < 1) {
         PrintUsage(programName);
-        exit(!FlagHelp);
-    }
-
-    i32 commandIndex = -1;
-    for (size_t i = 0; i < commands.count; i += 1) {
-        if (strcmp(commands.names[i], CommandName) == 0) {
-            commandIndex = i;
-            break;
-        }
+        return !ctx->values[BuiltinFlag_Help].b;
     }
 
+    i32 commandIndex = CommandForName(ctx->commandName);
     if (commandIndex == -1) {
-        printf("Unknown command %s\n", CommandName);
+        printf("Unknown command %s\n", ctx->commandName);
         return 1;
     }
 
-    if (FlagHelp) {
+    PluginContextRunFunc *contextFunc = commands.contextFunctions[commandIndex];
+
+    // NOTE: helpers and commands without a context read the flag variables
+    b32 help = ctx->values[BuiltinFlag_Help].b;
+    if (help || !contextFunc)
+        ContextApplyFlags(ctx);
+
+    if (help) {
         printf("%s: %s\n\n", commands.names[commandIndex], commands.helpTexts[commandIndex]);
         PrintFlags(commandIndex);
 
@@ -288,13 +252,54 @@ int main(i32 argc, const char **argv) {
         return 0;
     }
 
-    if (commands.functions[commandIndex]) {
-        if (!ConfigBufferedInput)
+    if (contextFunc || commands.functions[commandIndex]) {
+        // NOTE: the terminal belongs to the commands in the foreground
+        b32 terminal = !ctx->background;
+        if (terminal && !ConfigBufferedInput)
             disableBufferedInput();
-        b32 status = commands.functions[commandIndex](argv+1, argc-1);
-        restoreTerminalState();
+        b32 status = contextFunc ? contextFunc(ctx, argv+1, argc-1) : commands.functions[commandIndex](argv+1, argc-1);
+        if (terminal)
+            restoreTerminalState();
         return status;
     }
 
     return 0;
 }
+
+// RunContextCommand with a context of its own, writing to stdout
+i32 RunCommand(i32 argc, const char **argv) {
+    VolContext *ctx = ContextCreate(STDOUT_FILENO);
+    i32 status = RunContextCommand(ctx, argc, argv);
+    ContextFree(ctx);
+    return status;
+}
+
+#include "serve.c"
+#include "batch.c"
+#include "builtins.c"
+
+// NOTE: the benchmarks build the whole program around their own entry point
+#ifndef VOLV_NO_MAIN
+int main(i32 argc, const char **argv) {
+    // NOTE: runs on every TAB, it answers from caches without plugins or a server
+    if (argc > 1 && strcmp(argv[1], "__complete") == 0)
+        return CompleteCommand(argc - 2, argv + 2);
+
+    i32 status;
+    if (ForwardToServer(argc, argv, &status))
+        return status;
+
+    ParseBuiltinFlags(&argc, &argv);
+
+    LoadConfig();
+    ConfigBufferedInput = ConfigBool("terminal", "buffered-input", ConfigBufferedInput);
+
+    LoadPlugins();
+    ApplyConfigFlags();
+
+    // NOTE: `serve` goes back to these after every command it runs
+    SaveFlagDefaults();
+
+    return RunCommand(argc, argv);
+}
+#endif
@@ -21,7 +21,12 @@ enum NetError InitCurl() {
     return NetError_None;
 }
 
-#define RESPONSE_BUFFER_MAX_SIZE (1024*1024)
+#define VAPOR_CLOUD_API "https://api.vapor.cloud"
+
+// NOTE: `[api] url` in the config points volv at another deployment
+static const char *vaporCloudApi() {
+    return VolConfigGet("api", "url") ?: VAPOR_CLOUD_API;
+}
 
 enum HTTPMethod {
     Method_Get,
@@ -39,45 +44,72 @@ const char *HTTPMethodDescriptions[_METHOD_COUNT] = {
     [Method_Delete] = "DELETE"
 };
 
-char urlScratchBuffer[1024];
+struct HttpRequest {
+    const char *method;
+    const char *url;
+    int flags;
 
-struct CurlRequest {
-    CURL *handle;
+    // NOTE: overrides the Vapor Cloud token when set
+    const char *bearer;
 
-    const char *url;
-    enum HTTPMethod method;
-    const char *request;
-    u32 requestLenLeft;
+    const char *body;
+    size_t bodyLen;
+    size_t bodySent;
 
     char *response;
-    u32 len;
+    size_t len;
+    size_t cap;
+    long status;
+
+    VolHttpCallback *callback;
+    void *userData;
+
+    // NOTE: called as the response arrives and with a length of 0 whenever an
+    // attempt starts over. Returning false cancels the request.
+    b32 (*progress)(struct HttpRequest *req);
+    b32 cancelled;
+
+    // NOTE: the `-v` of the command making the request, curl traces it to stdout
+    b32 verbose;
 };
 
 static size_t writeFunc(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realSize = size * nmemb;
-    struct CurlRequest *req = (struct CurlRequest *)userp;
+    struct HttpRequest *req = (struct HttpRequest *)userp;
 
-    if (req->len + realSize >= RESPONSE_BUFFER_MAX_SIZE) {
-        return 0;
+    if (req->len + realSize + 1 > req->cap) {
+        size_t cap = req->cap ? req->cap : 16*1024;
+        while (req->len + realSize + 1 > cap)
+            cap *= 2;
+
+        char *response = realloc(req->response, cap);
+        if (!response) return 0;
+
+        req->response = response;
+        req->cap = cap;
     }
 
     memcpy(&req->response[req->len], contents, realSize);
     req->len += realSize;
     req->response[req->len] = '\0';
 
+    if (req->progress && !req->progress(req)) {
+        req->cancelled = true;
+        return 0;
+    }
+
     return realSize;
 }
 
 static size_t readFunc(void *dest, size_t size, size_t nmemb, void *userp) {
     size_t bufferSize = size * nmemb;
-    struct CurlRequest *req = (struct CurlRequest *)userp;
+    struct HttpRequest *req = (struct HttpRequest *)userp;
 
-    size_t count = req->requestLenLeft;
+    size_t count = req->bodyLen - req->bodySent;
     if (count) {
         count = count < bufferSize ? count : bufferSize;
-        memcpy(dest, req->request, count);
-        req->request += count;
-        req->requestLenLeft -= count;
+        memcpy(dest, req->body + req->bodySent, count);
+        req->bodySent += count;
     }
 
     return count;
@@ -99,8 +131,9 @@ b32 extractString(
             return 0;
     }
 
-    const char *new = strndup(json+child->start, child->end-child->start);
-    new = Unescape(new);
+    size_t len = child->end - child->start;
+    char *new = malloc(len + 1);
+    new[jsonUnescape(json+child->start, len, new)] = '\0';
 
     *out = new;
     return 1;
@@ -196,6 +229,35 @@ struct KeyValue {
     const char *value;
 };
 
+#define PARALLEL_EXTRACT_THRESHOLD 512
+
+struct ConfigExtraction {
+    const char *json;
+    jsmntok_t *tokens;
+    int *offsets;
+    struct KeyValue *configs;
+};
+
+static void extractConfig(size_t index, void *data) {
+    struct ConfigExtraction *extraction = (struct ConfigExtraction *)data;
+    struct KeyValue *config = &extraction->configs[index];
+    jsmntok_t *tokens = extraction->tokens;
+
+    int offset = extraction->offsets[index];
+    int fields = tokens[offset++].size;
+
+    for (size_t i = 0; i < fields; i += 1) {
+        jsmntok_t field = tokens[offset++];
+
+        extractString("key", field, &tokens[offset], extraction->json, &config->key);
+        extractString("value", field, &tokens[offset], extraction->json, &config->value);
+
+        skipTokens(tokens, &offset);
+    }
+}
+
+// Returns the number of entries in `*out`, or -1 for a malformed response.
+// Nothing is printed, callers report the failure where their output goes.
 b32 parseConfigs(struct KeyValue **out, const char *json, size_t length) {
     jsmn_parser parser;
     jsmn_init(&parser);
@@ -203,7 +265,6 @@ b32 parseConfigs(struct KeyValue **out, const char *json, size_t length) {
     int tokenCount;
     tokenCount = jsmn_parse(&parser, json, length, NULL, 0);
     if (tokenCount < 1) {
-        printf("Failed to parse json: %d\n", tokenCount);
         return -1;
     }
 
@@ -214,47 +275,53 @@ b32 parseConfigs(struct KeyValue **out, const char *json, size_t length) {
 
     jsmn_init(&parser);
     tokenCount = jsmn_parse(&parser, json, length, tokens, tokenCount);
-    if (tokenCount < 1) {
-        printf("Failed to load tokens: %d\n", tokenCount);
-        return -1;
-    }
-
-    if (tokens[0].type != JSMN_ARRAY) {
-        printf("Malformed json response\n");
+    if (tokenCount < 1 || tokens[0].type != JSMN_ARRAY) {
+        free(tokens);
         return -1;
     }
 
     int configsCount = tokens[0].size;
     struct KeyValue *configs = calloc(configsCount, sizeof(struct KeyValue));
+    int *offsets = malloc(configsCount * sizeof(int));
 
+    // NOTE: finding where each object starts is cheap, copying and
+    // unescaping the strings isn't so that part is done on the job pool
     int offset = 1;
     for (size_t configIndex = 0; configIndex < configsCount; configIndex += 1) {
-        struct KeyValue *config = &configs[configIndex];
-        jsmntok_t obj = tokens[offset++];
-        if (obj.type != JSMN_OBJECT) {
+        if (tokens[offset].type != JSMN_OBJECT) {
+            free(offsets);
+            free(configs);
+            free(tokens);
             return -1;
         }
 
-        int fields = obj.size;
-        for (size_t i = 0; i < fields; i += 1) {
-            jsmntok_t field = tokens[offset++];
+        offsets[configIndex] = offset;
+        skipTokens(tokens, &offset);
+    }
 
-            extractString("key", field, &tokens[offset], json, &config->key);
-            extractString("value", field, &tokens[offset], json, &config->value);
+    struct ConfigExtraction extraction = { json, tokens, offsets, configs };
 
-            skipTokens(tokens, &offset);
-        }
+    if (configsCount >= PARALLEL_EXTRACT_THRESHOLD) {
+        VolParallelFor(configsCount, extractConfig, &extraction);
+    } else {
+        for (size_t configIndex = 0; configIndex < configsCount; configIndex += 1)
+            extractConfig(configIndex, &extraction);
     }
 
-    *out = configs;
-    return configsCount;
-}
+    free(offsets);
+    free(tokens);
 
-void refreshTokenUrl(CURL *handle) {
-    curl_easy_setopt(
-        handle, CURLOPT_URL,
-        "https://api.vapor.cloud/admin/refresh"
-    );
+    // NOTE: entries without a key can't be looked up or shown, drop them
+    int kept = 0;
+    for (int configIndex = 0; configIndex < configsCount; configIndex += 1) {
+        if (configs[configIndex].key)
+            configs[kept++] = configs[configIndex];
+        else
+            free((void *)configs[configIndex].value);
+    }
+
+    *out = configs;
+    return kept;
 }
 
 void cacheTokens(const char *refresh, const char *access) {
@@ -277,35 +344,194 @@ void cacheTokens(const char *refresh, const char *access) {
     fclose(file);
 }
 
-b32 refreshToken(const char *refreshToken, const char **accessOut) {
-    CURL *handle = curl_easy_init();
-    refreshTokenUrl(handle);
+// Every request goes through one set of curl handles that share their
+// connection, TLS session and DNS caches, so repeated calls to the API reuse a
+// warm connection no matter which thread or plugin makes them.
+
+#define HTTP_MAX_IDLE_HANDLES 32
+
+struct HttpPool {
+    pthread_mutex_t mutex;
+    pthread_mutex_t shareLocks[8];
+    CURLSH *share;
+
+    CURL *idle[HTTP_MAX_IDLE_HANDLES];
+    u32 idleCount;
+};
+
+static struct HttpPool httpPool = { PTHREAD_MUTEX_INITIALIZER };
+static pthread_once_t httpPoolOnce = PTHREAD_ONCE_INIT;
+
+static void httpShareLock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp) {
+    pthread_mutex_lock(&httpPool.shareLocks[data & 7]);
+}
+
+static void httpShareUnlock(CURL *handle, curl_lock_data data, void *userp) {
+    pthread_mutex_unlock(&httpPool.shareLocks[data & 7]);
+}
+
+// NOTE: the child must not touch connections the parent is still using, it
+// forgets them without closing and starts over
+static void httpPoolAfterFork() {
+    static const pthread_once_t once = PTHREAD_ONCE_INIT;
+    memset(&httpPool, 0, sizeof(httpPool));
+    pthread_mutex_init(&httpPool.mutex, NULL);
+    httpPoolOnce = once;
+}
+
+static void initHttpPool() {
+    InitCurl();
+    pthread_atfork(NULL, NULL, httpPoolAfterFork);
+
+    for (u32 i = 0; i < 8; i += 1)
+        pthread_mutex_init(&httpPool.shareLocks[i], NULL);
+
+    httpPool.share = curl_share_init();
+    curl_share_setopt(httpPool.share, CURLSHOPT_LOCKFUNC, httpShareLock);
+    curl_share_setopt(httpPool.share, CURLSHOPT_UNLOCKFUNC, httpShareUnlock);
+    curl_share_setopt(httpPool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(httpPool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(httpPool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+}
+
+static CURL *acquireHandle() {
+    pthread_once(&httpPoolOnce, initHttpPool);
+
+    CURL *handle = NULL;
+
+    pthread_mutex_lock(&httpPool.mutex);
+    if (httpPool.idleCount)
+        handle = httpPool.idle[--httpPool.idleCount];
+    pthread_mutex_unlock(&httpPool.mutex);
+
+    if (handle) {
+        curl_easy_reset(handle);
+    } else {
+        handle = curl_easy_init();
+    }
+
+    curl_easy_setopt(handle, CURLOPT_SHARE, httpPool.share);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    return handle;
+}
+
+static void releaseHandle(CURL *handle) {
+    pthread_mutex_lock(&httpPool.mutex);
+    if (httpPool.idleCount < HTTP_MAX_IDLE_HANDLES) {
+        httpPool.idle[httpPool.idleCount++] = handle;
+        handle = NULL;
+    }
+    pthread_mutex_unlock(&httpPool.mutex);
+
+    if (handle)
+        curl_easy_cleanup(handle);
+}
+
+// Configures `handle` for `req`. The returned headers have to stay alive until
+// the transfer is done.
+static struct curl_slist *httpSetup(CURL *handle, struct HttpRequest *req, const char *token) {
+    char urlBuffer[1024];
+    const char *url = req->url;
+    if (url[0] == '/') {
+        snprintf(&urlBuffer[0], sizeof(urlBuffer), "%s%s", vaporCloudApi(), url);
+        url = &urlBuffer[0];
+    }
+
+    // NOTE: both are in seconds, 0 keeps curl's defaults
+    i64 timeout = ConfigInt("api", "timeout", 0);
+    i64 connectTimeout = ConfigInt("api", "connect-timeout", 0);
+    if (timeout > 0) curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, (long)(timeout * 1000));
+    if (connectTimeout > 0) curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, (long)(connectTimeout * 1000));
+
+    curl_easy_setopt(handle, CURLOPT_URL, url);
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeFunc);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, req);
     curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
-    if (FlagVerbose)
+    if (req->verbose) {
         curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
+        curl_easy_setopt(handle, CURLOPT_STDERR, stdout);
+    }
 
-    char authBuffer[1024];
-    snprintf(authBuffer, sizeof(authBuffer), "Authorization: Bearer %s", refreshToken);
+    if (strcmp(req->method, "GET") == 0) {
+        curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+    } else if (strcmp(req->method, "POST") == 0) {
+        curl_easy_setopt(handle, CURLOPT_POST, 1L);
+    } else {
+        curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, req->method);
+    }
 
     struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, &authBuffer[0]);
+
+    char authBuffer[1024];
+    if (token) {
+        snprintf(authBuffer, sizeof(authBuffer), "Authorization: Bearer %s", token);
+        headers = curl_slist_append(headers, &authBuffer[0]);
+    }
+
+    if (req->body && req->bodyLen) {
+        req->bodySent = 0;
+        curl_easy_setopt(handle, CURLOPT_UPLOAD, 1L);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long)req->bodyLen);
+        curl_easy_setopt(handle, CURLOPT_READFUNCTION, readFunc);
+        curl_easy_setopt(handle, CURLOPT_READDATA, req);
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+    }
+
     curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
 
-    struct CurlRequest req = {
-        .response = malloc(1024*1024),
-        .len = 0
-    };
+    req->len = 0;
+    req->status = 0;
+    req->cancelled = false;
+
+    if (req->progress)
+        req->progress(req);
+
+    return headers;
+}
 
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)&req);
+static enum NetError httpResult(CURL *handle, struct HttpRequest *req, CURLcode code) {
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &req->status);
 
-    CURLcode code;
-    code = curl_easy_perform(handle);
     if (code != CURLE_OK) {
+        if (req->cancelled) return NetError_Generic;
+
+        printf("failed: %s\n", curl_easy_strerror(code));
         return NetError_Generic;
     }
 
+    if (req->status == 401) return NetError_VaporCloudAuth;
+    if (req->status >= 400) return NetError_Generic;
+
+    return NetError_None;
+}
+
+enum NetError httpPerformOnce(struct HttpRequest *req, const char *token) {
+    CURL *handle = acquireHandle();
+    struct curl_slist *headers = httpSetup(handle, req, token);
+
+    CURLcode code = curl_easy_perform(handle);
+    enum NetError err = httpResult(handle, req, code);
+
+    curl_slist_free_all(headers);
+    releaseHandle(handle);
+
+    return err;
+}
+
+b32 refreshToken(const char *refreshToken, b32 verbose, const char **accessOut) {
+    struct HttpRequest req = {
+        .method = HTTPMethodDescriptions[Method_Get],
+        .url = "/admin/refresh",
+        .verbose = verbose,
+    };
+
+    enum NetError err = httpPerformOnce(&req, refreshToken);
+    if (err != NetError_None) {
+        free(req.response);
+        return err;
+    }
+
     const char *json = req.response;
     u32 jsonLen = req.len;
 
@@ -315,7 +541,7 @@ b32 refreshToken(const char *refreshToken, const char **accessOut) {
     int tokenCount;
     tokenCount = jsmn_parse(&parser, json, jsonLen, NULL, 0);
     if (tokenCount < 1) {
-        printf("Failed to parse json: %d\n", tokenCount);
+        fprintf(stderr, "Failed to parse json: %d\n", tokenCount);
         return NetError_Generic;
     }
 
@@ -327,7 +553,7 @@ b32 refreshToken(const char *refreshToken, const char **accessOut) {
     jsmn_init(&parser);
     tokenCount = jsmn_parse(&parser, json, jsonLen, tokens, tokenCount);
     if (tokenCount < 1) {
-        printf("Failed to load tokens: %d\n", tokenCount);
+        fprintf(stderr, "Failed to load tokens: %d\n", tokenCount);
         return NetError_Generic;
     }
 
@@ -348,133 +574,297 @@ b32 refreshToken(const char *refreshToken, const char **accessOut) {
         skipTokens(tokens, &offset);
     }
 
+    free(tokens);
+    free(req.response);
+
     cacheTokens(refreshToken, access);
 
     *accessOut = access ?: "";
     return NetError_None;
 }
 
-const char *vaporCloudConfigUrl(const char *app, const char *env) {
-    snprintf(
-        &urlScratchBuffer[0],
-        sizeof(urlScratchBuffer),
-        "https://api.vapor.cloud/application/applications/%s/hosting/environments/%s/configurations",
-        app, env
-    );
-    return &urlScratchBuffer[0];
-}
+// Owns the Vapor Cloud tokens for the whole process. Refreshing is single
+// flight: when several requests get a 401 at once only the first refreshes and
+// the rest wait for its result.
+struct TokenManager {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
 
-enum NetError vaporCloudReq(struct CurlRequest *req) {
-    CURL *handle = curl_easy_init();
-    req->handle = handle;
+    b32 loaded;
+    b32 refreshing;
+    u32 generation;
 
-    curl_easy_setopt(handle, CURLOPT_URL, req->url);
+    const char *refresh;
+    const char *access;
+};
 
-    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeFunc);
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA, req);
+static struct TokenManager tokenManager = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
 
-    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
-    if (FlagVerbose) {
-        curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
-        curl_easy_setopt(handle, CURLOPT_STDERR, stdout);
-    }
+static b32 currentAccessToken(const char **access, u32 *generation) {
+    pthread_mutex_lock(&tokenManager.mutex);
 
-    switch (req->method) {
-        case Method_Get:
-            curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
-            break;
-        case Method_Post:
-            curl_easy_setopt(handle, CURLOPT_POST, 1L);
-            break;
-        default:
-            curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, HTTPMethodDescriptions[req->method]);
+    if (!tokenManager.loaded) {
+        if (GetVaporCloudKeys(&tokenManager.refresh, &tokenManager.access) == 0)
+            tokenManager.loaded = true;
     }
 
-    const char *refresh, *access;
-    if (GetVaporCloudKeys(&refresh, &access)) {
-        fprintf(stderr, "Unable to locate Vapor Cloud key. Please refresh your token or login\n");
-        return NetError_VaporCloudAuth;
+    *access = tokenManager.access;
+    *generation = tokenManager.generation;
+    b32 loaded = tokenManager.loaded;
+
+    pthread_mutex_unlock(&tokenManager.mutex);
+    return loaded;
+}
+
+// NOTE: `seenGeneration` is the generation of the token that was rejected. If
+// it has already been replaced the newer one is returned without refreshing
+static b32 refreshAccessToken(u32 seenGeneration, b32 verbose, const char **access, u32 *generation) {
+    pthread_mutex_lock(&tokenManager.mutex);
+
+    while (tokenManager.refreshing)
+        pthread_cond_wait(&tokenManager.cond, &tokenManager.mutex);
+
+    if (tokenManager.generation != seenGeneration) {
+        *access = tokenManager.access;
+        *generation = tokenManager.generation;
+        pthread_mutex_unlock(&tokenManager.mutex);
+        return true;
     }
 
-    char authBuffer[1024];
-    snprintf(authBuffer, sizeof(authBuffer), "Authorization: Bearer %s", access);
+    tokenManager.refreshing = true;
+    const char *refresh = tokenManager.refresh;
+    pthread_mutex_unlock(&tokenManager.mutex);
 
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, &authBuffer[0]);
+    // NOTE: this can run on any thread in the middle of machine readable output
+    if (verbose)
+        fprintf(stderr, "Refreshing Vapor Cloud token...\n");
 
-    if (req->request && req->requestLenLeft) {
-        curl_easy_setopt(handle, CURLOPT_UPLOAD, 1L);
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long)req->requestLenLeft);
-        curl_easy_setopt(handle, CURLOPT_READFUNCTION, readFunc);
-        curl_easy_setopt(handle, CURLOPT_READDATA,req);
-        headers = curl_slist_append(headers, "Content-Type: application/json");
+    const char *newAccess = NULL;
+    b32 err = refreshToken(refresh, verbose, &newAccess);
+
+    pthread_mutex_lock(&tokenManager.mutex);
+    if (!err) {
+        tokenManager.access = newAccess;
+        tokenManager.generation++;
     }
 
-    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    tokenManager.refreshing = false;
+    pthread_cond_broadcast(&tokenManager.cond);
 
-    req->len = 0;
-    
-    CURLcode code;
-    code = curl_easy_perform(handle);
-    if (code != CURLE_OK) {
-        int status;
-        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
-        if (status == 401) {
+    *access = tokenManager.access;
+    *generation = tokenManager.generation;
+    pthread_mutex_unlock(&tokenManager.mutex);
+
+    return !err;
+}
+
+enum NetError HttpPerform(struct HttpRequest *req) {
+    const char *token = req->bearer;
+    u32 generation = 0;
+
+    if (!token && (req->flags & VOL_HTTP_VAPOR_AUTH)) {
+        if (!currentAccessToken(&token, &generation)) {
+            fprintf(stderr, "Unable to locate Vapor Cloud key. Please refresh your token or login\n");
             return NetError_VaporCloudAuth;
         }
-        printf("failed: %s\n", curl_easy_strerror(code));
+    }
 
-        return NetError_Generic;
+    enum NetError err = httpPerformOnce(req, token);
+
+    if (err == NetError_VaporCloudAuth && !req->bearer && (req->flags & VOL_HTTP_VAPOR_AUTH)) {
+        if (refreshAccessToken(generation, req->verbose, &token, &generation))
+            err = httpPerformOnce(req, token);
     }
 
-    return NetError_None;
+    return err;
+}
+
+static void httpRequestJob(void *data) {
+    struct HttpRequest *req = (struct HttpRequest *)data;
+
+    enum NetError err = HttpPerform(req);
+
+    struct VolHttpResponse response = {
+        .status = req->status,
+        .error = err,
+        .body = req->response ?: "",
+        .len = req->len
+    };
+
+    if (req->callback)
+        req->callback(&response, req->userData);
+
+    free(req->response);
+    free((char *)req->url);
+    free((char *)req->body);
+    free((char *)req->method);
+    free(req);
+}
+
+VolJob *VolHttpRequest(
+    const char *method,
+    const char *url,
+    const char *body,
+    size_t bodyLen,
+    int flags,
+    VolHttpCallback *callback,
+    void *userData
+) {
+    struct HttpRequest *req = calloc(1, sizeof(struct HttpRequest));
+    req->method = strdup(method ?: "GET");
+    req->url = strdup(url);
+    req->flags = flags;
+    req->callback = callback;
+    req->userData = userData;
+    req->verbose = (flags & VOL_HTTP_VERBOSE) != 0;
+
+    if (body && bodyLen) {
+        char *copy = malloc(bodyLen);
+        memcpy(copy, body, bodyLen);
+        req->body = copy;
+        req->bodyLen = bodyLen;
+    }
+
+    return VolSubmit(httpRequestJob, req);
 }
 
-struct CurlRequest netGet(const char *url) {
-    struct CurlRequest req = {0};
-    req.url = url;
-    req.method = Method_Get;
-    req.response = malloc(1024*1024);
-    return req;
+typedef void HttpDoneFunc(struct HttpRequest *req, enum NetError err, void *userData);
+
+struct HttpTransfer {
+    struct HttpRequest *req;
+    CURL *handle;
+    struct curl_slist *headers;
+    u32 generation;
+    b32 retried;
+};
+
+static b32 httpStartTransfer(CURLM *multi, struct HttpTransfer *transfer) {
+    const char *token = transfer->req->bearer;
+
+    if (!token && (transfer->req->flags & VOL_HTTP_VAPOR_AUTH)) {
+        if (!currentAccessToken(&token, &transfer->generation))
+            return false;
+    }
+
+    transfer->handle = acquireHandle();
+    transfer->headers = httpSetup(transfer->handle, transfer->req, token);
+    curl_easy_setopt(transfer->handle, CURLOPT_PRIVATE, transfer);
+    curl_multi_add_handle(multi, transfer->handle);
+    return true;
+}
+
+// Performs every request from a single thread with at most `limit` of them in
+// flight. Transfers to the same host share connections, multiplexed over
+// HTTP/2 when the server supports it. `done` is called on this thread as each
+// request finishes, in completion order.
+void HttpPerformMany(struct HttpRequest **reqs, u32 count, u32 limit, HttpDoneFunc *done, void *userData) {
+    pthread_once(&httpPoolOnce, initHttpPool);
+
+    if (!limit) limit = 1;
+
+    CURLM *multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)limit);
+
+    struct HttpTransfer *transfers = calloc(count, sizeof(struct HttpTransfer));
+    u32 next = 0;
+    u32 running = 0;
+    b32 reportedAuth = false;
+
+    while (next < count || running) {
+        while (next < count && running < limit) {
+            struct HttpTransfer *transfer = &transfers[next];
+            transfer->req = reqs[next++];
+
+            if (httpStartTransfer(multi, transfer)) {
+                running++;
+            } else {
+                if (!reportedAuth)
+                    fprintf(stderr, "Unable to locate Vapor Cloud key. Please refresh your token or login\n");
+                reportedAuth = true;
+                done(transfer->req, NetError_VaporCloudAuth, userData);
+            }
+        }
+
+        int active;
+        curl_multi_perform(multi, &active);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            struct HttpTransfer *transfer;
+            CURL *handle = msg->easy_handle;
+            CURLcode code = msg->data.result;
+            curl_easy_getinfo(handle, CURLINFO_PRIVATE, &transfer);
+
+            curl_multi_remove_handle(multi, handle);
+            enum NetError err = httpResult(handle, transfer->req, code);
+
+            curl_slist_free_all(transfer->headers);
+            releaseHandle(handle);
+            transfer->handle = NULL;
+
+            struct HttpRequest *req = transfer->req;
+            if (err == NetError_VaporCloudAuth && !transfer->retried && !req->bearer && (req->flags & VOL_HTTP_VAPOR_AUTH)) {
+                // NOTE: single flight, the first transfer to fail refreshes for all of them
+                const char *token;
+                transfer->retried = true;
+                if (refreshAccessToken(transfer->generation, req->verbose, &token, &transfer->generation) && httpStartTransfer(multi, transfer))
+                    continue;
+            }
+
+            running--;
+            done(req, err, userData);
+        }
+
+        if (running)
+            curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+
+    curl_multi_cleanup(multi);
+    free(transfers);
 }
 
-struct CurlRequest netPatch(const char *url, const char *data, u32 len) {
-    struct CurlRequest req = {0};
-    req.url = url;
-    req.method = Method_Patch;
-    req.response = malloc(1024*1024);
-    req.request = data;
-    req.requestLenLeft = len;
-    return req;
+#define CONFIG_URL_SIZE 1024
+
+// NOTE: callers provide the buffer so requests can be built on any thread
+const char *vaporCloudConfigUrl(char *out, const char *app, const char *env) {
+    snprintf(
+        out, CONFIG_URL_SIZE,
+        "%s/application/applications/%s/hosting/environments/%s/configurations",
+        vaporCloudApi(), app, env
+    );
+    return out;
 }
 
 i32 configToJson(struct KeyValue *configs, u32 count, char **out) {
-    char *json = malloc(1024*1024);
+    size_t cap = 2;
+    for (size_t i = 0; i < count; i += 1)
+        cap += (strlen(configs[i].key) + strlen(configs[i].value ?: "")) * 6 + 6;
+
+    char *json = malloc(cap);
+    size_t len = 0;
 
-    json[0] = '{';
-    i32 offset = 1;
+    json[len++] = '{';
 
     for (size_t i = 0; i < count; i += 1) {
-        offset += snprintf(
-            json+offset,(1024*1024)-offset,
-            "\"%s\": \"%s\",",
-            configs[i].key, configs[i].value
-        );
-
-        if (offset >= 1024*1024) {
-            free(json);
-            return -1;
-        }
+        const char *value = configs[i].value ?: "";
+
+        if (i) json[len++] = ',';
+        len += JsonQuote(json + len, configs[i].key, strlen(configs[i].key));
+        json[len++] = ':';
+        len += JsonQuote(json + len, value, strlen(value));
     }
 
-    // NOTE: replaces the final `,` with `}`
-    json[offset-1] = '}';
+    json[len++] = '}';
     *out = json;
-    return offset;
+    return len;
 }
 
 enum NetError SetVaporCloudConfig(
+    VolContext *ctx,
     const char *app,
     const char *env,
     struct KeyValue **configs,
@@ -483,20 +873,25 @@ enum NetError SetVaporCloudConfig(
     char *json;
     u32 len = configToJson(*configs, *count, &json);
 
-    struct CurlRequest req = netPatch(
-        vaporCloudConfigUrl(app, env),
-        json,
-        len
-    );
+    char url[CONFIG_URL_SIZE];
+    struct HttpRequest req = {
+        .method = HTTPMethodDescriptions[Method_Patch],
+        .url = vaporCloudConfigUrl(&url[0], app, env),
+        .flags = VOL_HTTP_VAPOR_AUTH,
+        .body = json,
+        .bodyLen = len,
+        .verbose = ctx->values[BuiltinFlag_Verbose].b
+    };
 
-    enum NetError err = vaporCloudReq(&req);
+    enum NetError err = HttpPerform(&req);
+    free(json);
     if (err)
         return err;
 
     struct KeyValue *newConfigs;
     int newCount = parseConfigs(&newConfigs, req.response, req.len);
     if (newCount < 0) {
-        printf("Something went wrong: %d\n", newCount);
+        VolPrintf(ctx, "Malformed json response\n");
         return NetError_Generic;
     }
 
@@ -506,76 +901,183 @@ enum NetError SetVaporCloudConfig(
     return NetError_None;
 }
 
-enum NetError GetVaporCloudConfig(const char *app, const char *env, struct KeyValue **out, u32 *outCount) {
-    const char *refresh, *access;
+// Fetches the configuration response as is, for callers that render straight
+// from the JSON. `*out` is owned by the caller.
+enum NetError GetVaporCloudConfigJson(VolContext *ctx, const char *app, const char *env, char **out, size_t *outLen) {
+    char url[CONFIG_URL_SIZE];
+    struct HttpRequest req = {
+        .method = HTTPMethodDescriptions[Method_Get],
+        .url = vaporCloudConfigUrl(&url[0], app, env),
+        .flags = VOL_HTTP_VAPOR_AUTH,
+        .verbose = ctx->values[BuiltinFlag_Verbose].b
+    };
 
-    b32 error;
-    error = GetVaporCloudKeys(&refresh, &access);
-    if (error) {
-        fprintf(stderr, "Unable to locate Vapor Cloud key. Please refresh your token or login\n");
-        return NetError_VaporCloudAuth;
+    enum NetError err = HttpPerform(&req);
+    if (err) {
+        free(req.response);
+        return err;
     }
 
-    char *buffer = malloc(1024*1024);
-    struct CurlRequest req = {
-        .url = vaporCloudConfigUrl(app, env),
-        .method = Method_Get,
-        .response = buffer,
-        .len = 0
-    };
+    *out = req.response ?: strdup("");
+    *outLen = req.len;
+    return NetError_None;
+}
 
-    CURL *handle = curl_easy_init();
-    b32 hasTried = false;
+enum NetError GetVaporCloudConfig(VolContext *ctx, const char *app, const char *env, struct KeyValue **out, u32 *outCount) {
+    char *json;
+    size_t jsonLen;
 
-tryAgain:
-    curl_easy_setopt(handle, CURLOPT_URL, req.url);
-    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeFunc);
-    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
-    if (FlagVerbose) {
-        curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
-        curl_easy_setopt(handle, CURLOPT_STDERR, stdout);
+    enum NetError err = GetVaporCloudConfigJson(ctx, app, env, &json, &jsonLen);
+    if (err)
+        return err;
+
+    struct KeyValue *configs;
+    int count = parseConfigs(&configs, json, jsonLen);
+    free(json);
+    if (count < 0) {
+        VolPrintf(ctx, "Malformed json response\n");
+        return NetError_Generic;
     }
 
-    char authBuffer[1024];
-    snprintf(authBuffer, sizeof(authBuffer), "Authorization: Bearer %s", access);
+    *out = configs;
+    *outCount = count;
 
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, &authBuffer[0]);
+    return NetError_None;
+}
 
-    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+typedef b32 ConfigStreamFunc(struct KeyValue config, void *userData);
 
-    req.len = 0;
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)&req);
-    
-    CURLcode code;
-    code = curl_easy_perform(handle);
-    if (code != CURLE_OK) {
-        int status;
-        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
-        if (status == 401) {
-            if (!hasTried) {
-                printf("Refreshing Vapor Cloud token...\n");
-                hasTried = true;
-                b32 err = refreshToken(refresh, &access);
-                curl_easy_reset(handle);
-                goto tryAgain;
+struct ConfigStream {
+    // NOTE: must be first, the progress callback only gets the request
+    struct HttpRequest req;
+
+    ConfigStreamFunc *func;
+    void *userData;
+
+    size_t scanned;
+    size_t objectStart;
+    i32 depth;
+    b32 inString;
+    b32 escaped;
+    b32 rejected;
+};
+
+static b32 streamConfigObject(struct ConfigStream *stream, const char *json, size_t len) {
+    jsmn_parser parser;
+    jsmn_init(&parser);
+
+    int tokenCount = jsmn_parse(&parser, json, len, NULL, 0);
+    if (tokenCount < 1) return true;
+
+    jsmntok_t *tokens = malloc(tokenCount * sizeof(jsmntok_t));
+    jsmn_init(&parser);
+    tokenCount = jsmn_parse(&parser, json, len, tokens, tokenCount);
+
+    b32 keepGoing = true;
+
+    if (tokenCount > 0 && tokens[0].type == JSMN_OBJECT) {
+        struct KeyValue config = {0};
+        int offset = 0;
+
+        struct ConfigExtraction extraction = { json, tokens, &offset, &config };
+        extractConfig(0, &extraction);
+
+        if (config.key)
+            keepGoing = stream->func(config, stream->userData);
+    }
+
+    free(tokens);
+    return keepGoing;
+}
+
+// Picks complete objects out of the configuration array as it downloads. Only
+// the structure is tracked here, each object is parsed once it's closed.
+static b32 configStreamProgress(struct HttpRequest *req) {
+    struct ConfigStream *stream = (struct ConfigStream *)req;
+
+    if (!req->len) {
+        stream->scanned = 0;
+        stream->depth = 0;
+        stream->inString = false;
+        stream->escaped = false;
+        stream->rejected = false;
+        return true;
+    }
+
+    const char *json = req->response;
+
+    for (size_t i = stream->scanned; i < req->len && !stream->rejected; i += 1) {
+        char c = json[i];
+
+        if (stream->inString) {
+            if (stream->escaped) {
+                stream->escaped = false;
+            } else if (c == '\\') {
+                stream->escaped = true;
+            } else if (c == '"') {
+                stream->inString = false;
             }
-            return NetError_VaporCloudAuth;
+            continue;
         }
 
-        return NetError_Generic;
-    }
+        if (stream->depth == 0) {
+            // NOTE: anything but an array is an error response, leave it to the caller
+            if (c == '[') {
+                stream->depth++;
+            } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                stream->rejected = true;
+            }
+            continue;
+        }
 
-    struct KeyValue *configs;
-    int count = parseConfigs(&configs, req.response, req.len);
-    if (count < 0) {
-        printf("Something went wrong: %d\n", count);
-        return NetError_Generic;
+        switch (c) {
+            case '"':
+                stream->inString = true;
+                break;
+
+            case '{':
+            case '[':
+                if (stream->depth == 1)
+                    stream->objectStart = i;
+                stream->depth++;
+                break;
+
+            case '}':
+            case ']':
+                stream->depth--;
+                if (stream->depth == 1 && c == '}') {
+                    if (!streamConfigObject(stream, json + stream->objectStart, i + 1 - stream->objectStart)) {
+                        stream->scanned = i + 1;
+                        return false;
+                    }
+                }
+                break;
+        }
     }
 
-    *out = configs;
-    *outCount = count;
+    stream->scanned = req->len;
+    return true;
+}
 
-    return NetError_None;
-} 
+// Fetches the configuration like GetVaporCloudConfig but hands every entry to
+// `func` as soon as it has arrived. Returning false from `func` stops the
+// download early.
+enum NetError StreamVaporCloudConfig(VolContext *ctx, const char *app, const char *env, ConfigStreamFunc *func, void *userData) {
+    char url[CONFIG_URL_SIZE];
+    struct ConfigStream stream = {0};
+    stream.req.method = HTTPMethodDescriptions[Method_Get];
+    stream.req.url = vaporCloudConfigUrl(&url[0], app, env);
+    stream.req.flags = VOL_HTTP_VAPOR_AUTH;
+    stream.req.progress = configStreamProgress;
+    stream.req.verbose = ctx->values[BuiltinFlag_Verbose].b;
+    stream.func = func;
+    stream.userData = userData;
+
+    enum NetError err = HttpPerform(&stream.req);
+    free(stream.req.response);
+
+    if (stream.req.cancelled)
+        return NetError_None;
+
+    return err;
+}
@@ -1,89 +1,592 @@
 #include "net.c"
+#include "envindex.c"
+#include "envdiff.c"
+#include "fleet.c"
 
+// NOTE: the defaults of the `env` flags, an invocation reads the values it was
+// given from its context
 static const char *envAppName;
 static const char *envName = "staging";
 static bool flagAllEnvironments;
+static bool flagPage;
+static bool flagPromote;
+static struct CLIFlagList fleetApps;
+static struct CLIFlagList fleetEnvs;
 
-static CommandId envId;
+static const char *envApp(VolContext *ctx) {
+    return ctx->values[BuiltinFlag_App].s;
+}
 
-static const struct CLIFlag appFlag = {
-    CLIFlagKind_String,
-    .name = "app",
-    .argumentName = "name",
-    .ptr.s = &envAppName,
-    .help = "The target application"
-};
+static const char *envEnv(VolContext *ctx) {
+    return ctx->values[BuiltinFlag_Env].s;
+}
 
-static const struct CLIFlag envFlag = {
-    CLIFlagKind_String,
-    .name = "env",
-    .alias = "e",
-    .argumentName = "name",
-    .ptr.s = &envName,
-    .help = "The target application"
-};
+static int envFormat(VolContext *ctx) {
+    return ctx->values[BuiltinFlag_Format].i;
+}
+
+static void dumpConfig(VolContext *ctx, struct KeyValue *configs, u32 count) {
+    VolPrintf(ctx, "app: %s\n", envApp(ctx));
+    VolPrintf(ctx, "env: %s\n", envEnv(ctx));
+    VolPrintf(ctx, "\n");
+
+    if (!count) {
+        VolPrintf(ctx, "Environment does not have any configurations set\n");
+        return;
+    }
+
+    struct Table table;
+    TableInit(&table, 2);
+
+    for (size_t i = 0; i < count; i += 1)
+        TableAddRow(&table, (const char *[]){ configs[i].key, configs[i].value });
+
+    ContextTable(ctx, &table);
+    TableFree(&table);
+}
+
+// Writes a value token as JSON: strings with their quotes, primitives, objects
+// and arrays verbatim and a missing value as null
+static void outputJsonToken(struct Output *out, VolJson *doc, int token) {
+    struct VolJsonString raw = VolJsonRaw(doc, token);
+
+    if (token < 0) {
+        OutputString(out, "null");
+    } else if (VolJsonType(doc, token) == VolJson_String) {
+        OutputChar(out, '"');
+        OutputWrite(out, raw.data, raw.len);
+        OutputChar(out, '"');
+    } else {
+        OutputWrite(out, raw.data, raw.len);
+    }
+}
+
+// Renders a configuration response in one of the machine readable formats.
+// Keys and values are written straight from the JSON tokens, they are already
+// escaped for JSON and only need minor rewriting for TSV. Entries without a
+// string `key` are skipped.
+static i32 renderConfigJson(VolContext *ctx, const char *app, const char *env, const char *json, size_t len) {
+    VolJson *doc = VolJsonParse(json, len);
+    if (!doc || VolJsonType(doc, 0) != VolJson_Array) {
+        VolPrintf(ctx, "Malformed json response\n");
+        VolJsonFree(doc);
+        return NetError_Generic;
+    }
+
+    struct Output *out = ContextOutput(ctx);
+
+    if (envFormat(ctx) == VolFormat_Json)
+        OutputChar(out, '{');
+
+    int count = VolJsonSize(doc, 0);
+    int item = 1;
+    b32 first = true;
+
+    for (int i = 0; i < count; i += 1, item = VolJsonNext(doc, item)) {
+        int keyToken = VolJsonGet(doc, item, "key");
+        if (VolJsonType(doc, keyToken) != VolJson_String) continue;
+
+        int valueToken = VolJsonGet(doc, item, "value");
+        struct VolJsonString key = VolJsonRaw(doc, keyToken);
+
+        switch (envFormat(ctx)) {
+            case VolFormat_Json:
+                if (!first) OutputChar(out, ',');
+                OutputChar(out, '"');
+                OutputWrite(out, key.data, key.len);
+                OutputWrite(out, "\":", 2);
+                outputJsonToken(out, doc, valueToken);
+                break;
+
+            case VolFormat_Ndjson:
+                OutputString(out, "{\"app\":");
+                OutputJsonString(out, app, strlen(app));
+                OutputString(out, ",\"env\":");
+                OutputJsonString(out, env, strlen(env));
+                OutputString(out, ",\"key\":\"");
+                OutputWrite(out, key.data, key.len);
+                OutputString(out, "\",\"value\":");
+                outputJsonToken(out, doc, valueToken);
+                OutputWrite(out, "}\n", 2);
+                break;
+
+            case VolFormat_Tsv: {
+                // NOTE: null and a missing value are both an empty column
+                struct VolJsonString value = VolJsonRaw(doc, valueToken);
+                if (VolJsonType(doc, valueToken) == VolJson_Primitive && value.len == 4 && memcmp(value.data, "null", 4) == 0)
+                    value.len = 0;
+
+                OutputTsvFromJson(out, key.data, key.len);
+                OutputChar(out, '\t');
+                OutputTsvFromJson(out, value.data, value.len);
+                OutputChar(out, '\n');
+            } break;
+        }
 
-static const struct CLIFlag allFlag = {
-    CLIFlagKind_Bool,
-    .name = "all",
-    .alias = "a",
-    .ptr.b = &flagAllEnvironments,
-    .help = "Set value(s) on all environments"
+        first = false;
+    }
+
+    if (envFormat(ctx) == VolFormat_Json)
+        OutputWrite(out, "}\n", 2);
+
+    OutputFlush(out);
+    VolJsonFree(doc);
+
+    return PLUGIN_OK;
+}
+
+struct EnvPage {
+    VolContext *ctx;
+    struct Pager *pager;
+    const char *app;
+    const char *env;
+    b32 closed;
 };
 
-static void dumpConfig(const char *app, const char *env, struct KeyValue *configs, u32 count) {
-    printf("app: %s\n", app);
-    printf("env: %s\n", env);
-    printf("\n");
+static b32 pageConfig(struct KeyValue config, void *userData) {
+    struct EnvPage *page = (struct EnvPage *)userData;
+    PagerAdd(page->pager, (char *)config.key, (char *)(config.value ?: strdup("")));
+    return !__atomic_load_n(&page->closed, __ATOMIC_ACQUIRE);
+}
+
+static void fetchPagedConfig(void *data) {
+    struct EnvPage *page = (struct EnvPage *)data;
+    enum NetError err = StreamVaporCloudConfig(page->ctx, page->app, page->env, pageConfig, page);
+    PagerFinish(page->pager, err ? "Failed to load the configuration" : NULL);
+}
+
+// Opens the pager right away and fills it in as the configuration downloads
+static i32 pageEnv(VolContext *ctx) {
+    char title[512];
+    snprintf(&title[0], sizeof(title), "%s/%s", envApp(ctx), envEnv(ctx));
+
+    struct EnvPage page = { ctx, PagerCreate(&title[0]), envApp(ctx), envEnv(ctx) };
+    VolJob *fetch = VolSubmit(fetchPagedConfig, &page);
+
+    i32 status = PagerRun(page.pager);
+
+    // NOTE: stops the download if it's still going
+    __atomic_store_n(&page.closed, true, __ATOMIC_RELEASE);
+    VolWait(fetch);
+
+    PagerFree(page.pager);
+    return status;
+}
+
+// Loads the snapshot of the current environment, fetching and saving a new one
+// when it's missing or stale
+static enum NetError loadEnvIndex(VolContext *ctx, struct EnvIndex *index) {
+    if (LoadEnvIndex(ctx, index, envApp(ctx), envEnv(ctx), ConfigInt("cache", "env-ttl", ENV_INDEX_TTL)))
+        return NetError_None;
+
+    u32 count;
+    struct KeyValue *configs;
+
+    enum NetError err = GetVaporCloudConfig(ctx, envApp(ctx), envEnv(ctx), &configs, &count);
+    if (err != NetError_None)
+        return err;
+
+    BuildEnvIndex(index, configs, count);
+    SaveEnvIndex(index, envApp(ctx), envEnv(ctx));
+    return NetError_None;
+}
+
+static void renderEnvMatches(VolContext *ctx, struct EnvIndex *index, u32 *matches, u32 count) {
+    if (envFormat(ctx) == VolFormat_Table) {
+        struct Table table;
+        TableInit(&table, 2);
 
-    i32 valueWidth = 48;
-    i32 termWidth;
-    GetTermDim(&termWidth, NULL);
+        for (u32 i = 0; i < count; i += 1)
+            TableAddRow(&table, (const char *[]){ EnvIndexKey(index, matches[i]), EnvIndexValue(index, matches[i]) });
 
-    if (termWidth > 80) {
-        // TODO(Brett): dyamic width dump
-        // valueWidth += (termWidth - 80);
+        ContextTable(ctx, &table);
+        TableFree(&table);
+        return;
     }
 
-    if (count) {
-        printf("┌───────────────────────────┬──────────────────────────────────────────────────┐\n");
+    struct Output *out = ContextOutput(ctx);
+
+    if (envFormat(ctx) == VolFormat_Json)
+        OutputChar(out, '{');
+
+    for (u32 i = 0; i < count; i += 1) {
+        struct EnvIndexEntry entry = index->entries[matches[i]];
+        const char *key = EnvIndexKey(index, matches[i]);
+        const char *value = EnvIndexValue(index, matches[i]);
+
+        switch (envFormat(ctx)) {
+            case VolFormat_Json:
+                if (i) OutputChar(out, ',');
+                OutputJsonString(out, key, entry.keyLen);
+                OutputChar(out, ':');
+                OutputJsonString(out, value, entry.valueLen);
+                break;
+
+            case VolFormat_Ndjson:
+                OutputString(out, "{\"app\":");
+                OutputJsonString(out, envApp(ctx), strlen(envApp(ctx)));
+                OutputString(out, ",\"env\":");
+                OutputJsonString(out, envEnv(ctx), strlen(envEnv(ctx)));
+                OutputString(out, ",\"key\":");
+                OutputJsonString(out, key, entry.keyLen);
+                OutputString(out, ",\"value\":");
+                OutputJsonString(out, value, entry.valueLen);
+                OutputWrite(out, "}\n", 2);
+                break;
+
+            case VolFormat_Tsv:
+                OutputTsvString(out, key, entry.keyLen);
+                OutputChar(out, '\t');
+                OutputTsvString(out, value, entry.valueLen);
+                OutputChar(out, '\n');
+                break;
+        }
+    }
+
+    if (envFormat(ctx) == VolFormat_Json)
+        OutputWrite(out, "}\n", 2);
+
+    OutputFlush(out);
+}
+
+// `env get <pattern>...`, see compileEnvMatcher for the pattern syntax
+static i32 getEnvKeys(VolContext *ctx, const char **patterns, size_t count) {
+    if (!count) {
+        VolPrintf(ctx, "ERROR: expected a key or pattern\n");
+        return PLUGIN_SHOW_HELP;
+    }
+
+    struct EnvMatcher *matchers = calloc(count, sizeof(struct EnvMatcher));
+    for (size_t i = 0; i < count; i += 1) {
+        if (!compileEnvMatcher(&matchers[i], patterns[i])) {
+            for (size_t j = 0; j < i; j += 1)
+                freeEnvMatcher(&matchers[j]);
+            free(matchers);
+            return 1;
+        }
+    }
+
+    struct EnvIndex index;
+    enum NetError err = loadEnvIndex(ctx, &index);
+    if (err != NetError_None) {
+        for (size_t i = 0; i < count; i += 1)
+            freeEnvMatcher(&matchers[i]);
+        free(matchers);
+        return err;
+    }
+
+    u32 *matches = malloc((index.count + 1) * sizeof(u32));
+    u32 matchCount = 0;
+
+    if (count == 1) {
+        matchCount = queryEnvIndex(&index, &matchers[0], matches);
+    } else {
+        // NOTE: several patterns can match the same key, mark them so the
+        // output stays sorted and free of duplicates
+        u32 *scratch = malloc((index.count + 1) * sizeof(u32));
+        u8 *seen = calloc(index.count + 1, 1);
 
         for (size_t i = 0; i < count; i += 1) {
-            struct KeyValue config = configs[i];
-            printf("│ %-25.25s │ %-*.*s │\n", config.key, valueWidth, valueWidth, config.value);
-            if (strlen(config.value) > valueWidth) {
-                printf("│                           │ %-*.*s │\n", valueWidth, valueWidth, config.value+48);
-            }
+            u32 found = queryEnvIndex(&index, &matchers[i], scratch);
+            for (u32 j = 0; j < found; j += 1)
+                seen[scratch[j]] = 1;
+        }
 
-            if (i +1 != count)
-                printf("├───────────────────────────┼──────────────────────────────────────────────────┤\n");
+        for (u32 i = 0; i < index.count; i += 1) {
+            if (seen[i]) matches[matchCount++] = i;
         }
 
-        printf("└───────────────────────────┴──────────────────────────────────────────────────┘\n");
+        free(seen);
+        free(scratch);
+    }
+
+    i32 status = PLUGIN_OK;
+
+    if (matchCount) {
+        renderEnvMatches(ctx, &index, matches, matchCount);
     } else {
-        printf("Environment does not have any configurations set\n");
+        fprintf(stderr, "No keys in %s/%s match\n", envApp(ctx), envEnv(ctx));
+        status = 1;
+    }
+
+    free(matches);
+    FreeEnvIndex(&index);
+
+    for (size_t i = 0; i < count; i += 1)
+        freeEnvMatcher(&matchers[i]);
+    free(matchers);
+
+    return status;
+}
+
+struct EnvFetch {
+    VolContext *ctx;
+    const char *app;
+    const char *env;
+    struct EnvIndex index;
+    enum NetError err;
+};
+
+static void fetchEnvIndex(void *data) {
+    struct EnvFetch *fetch = (struct EnvFetch *)data;
+
+    u32 count;
+    struct KeyValue *configs;
+
+    fetch->err = GetVaporCloudConfig(fetch->ctx, fetch->app, fetch->env, &configs, &count);
+    if (fetch->err != NetError_None)
+        return;
+
+    BuildEnvIndex(&fetch->index, configs, count);
+    SaveEnvIndex(&fetch->index, fetch->app, fetch->env);
+}
+
+static void renderEnvDiff(VolContext *ctx, struct EnvDiff *diff, struct EnvFetch *from, struct EnvFetch *to) {
+    if (envFormat(ctx) == VolFormat_Table) {
+        if (!diff->count) {
+            VolPrintf(ctx, "%s and %s are identical\n", from->env, to->env);
+            return;
+        }
+
+        static const char *markers[] = {
+            [EnvChange_Added] = "+",
+            [EnvChange_Removed] = "-",
+            [EnvChange_Changed] = "~"
+        };
+
+        struct Table table;
+        TableInit(&table, 4);
+        TableAddRow(&table, (const char *[]){ "", "key", from->env, to->env });
+
+        for (u32 i = 0; i < diff->count; i += 1) {
+            struct EnvChange change = diff->changes[i];
+            b32 inFrom = change.from != ENV_NO_ENTRY;
+
+            TableAddRow(&table, (const char *[]){
+                markers[change.kind],
+                inFrom ? EnvIndexKey(&from->index, change.from) : EnvIndexKey(&to->index, change.to),
+                inFrom ? EnvIndexValue(&from->index, change.from) : "",
+                change.to != ENV_NO_ENTRY ? EnvIndexValue(&to->index, change.to) : ""
+            });
+        }
+
+        ContextTable(ctx, &table);
+        TableFree(&table);
+
+        VolPrintf(ctx, "%u added, %u removed, %u changed\n", diff->added, diff->removed, diff->changed);
+        return;
+    }
+
+    struct Output *out = ContextOutput(ctx);
+
+    // NOTE: JSON groups the changes by kind, the line based formats keep them in key order
+    if (envFormat(ctx) == VolFormat_Json) {
+        for (u32 kind = EnvChange_Added; kind <= EnvChange_Changed; kind += 1) {
+            OutputString(out, kind == EnvChange_Added ? "{\"" : ",\"");
+            OutputString(out, envChangeNames[kind]);
+            OutputString(out, "\":{");
+
+            b32 first = true;
+            for (u32 i = 0; i < diff->count; i += 1) {
+                struct EnvChange change = diff->changes[i];
+                if (change.kind != kind) continue;
+
+                if (!first) OutputChar(out, ',');
+                first = false;
+
+                struct EnvIndex *side = change.from != ENV_NO_ENTRY ? &from->index : &to->index;
+                u32 entry = change.from != ENV_NO_ENTRY ? change.from : change.to;
+                const char *key = EnvIndexKey(side, entry);
+
+                OutputJsonString(out, key, strlen(key));
+                OutputChar(out, ':');
+
+                if (kind == EnvChange_Changed) {
+                    OutputString(out, "{\"from\":");
+                    OutputJsonString(out, EnvIndexValue(&from->index, change.from), from->index.entries[change.from].valueLen);
+                    OutputString(out, ",\"to\":");
+                    OutputJsonString(out, EnvIndexValue(&to->index, change.to), to->index.entries[change.to].valueLen);
+                    OutputChar(out, '}');
+                } else {
+                    OutputJsonString(out, EnvIndexValue(side, entry), side->entries[entry].valueLen);
+                }
+            }
+
+            OutputChar(out, '}');
+        }
+
+        OutputWrite(out, "}\n", 2);
+    }
+
+    for (u32 i = 0; envFormat(ctx) != VolFormat_Json && i < diff->count; i += 1) {
+        struct EnvChange change = diff->changes[i];
+        const char *kind = envChangeNames[change.kind];
+        const char *key = change.from != ENV_NO_ENTRY ? EnvIndexKey(&from->index, change.from) : EnvIndexKey(&to->index, change.to);
+        const char *fromValue = change.from != ENV_NO_ENTRY ? EnvIndexValue(&from->index, change.from) : NULL;
+        const char *toValue = change.to != ENV_NO_ENTRY ? EnvIndexValue(&to->index, change.to) : NULL;
+
+        if (envFormat(ctx) == VolFormat_Ndjson) {
+            OutputString(out, "{\"app\":");
+            OutputJsonString(out, from->app, strlen(from->app));
+            OutputString(out, ",\"change\":\"");
+            OutputString(out, kind);
+            OutputString(out, "\",\"key\":");
+            OutputJsonString(out, key, strlen(key));
+
+            OutputString(out, ",\"from\":");
+            if (fromValue) {
+                OutputJsonString(out, fromValue, strlen(fromValue));
+            } else {
+                OutputString(out, "null");
+            }
+
+            OutputString(out, ",\"to\":");
+            if (toValue) {
+                OutputJsonString(out, toValue, strlen(toValue));
+            } else {
+                OutputString(out, "null");
+            }
+
+            OutputWrite(out, "}\n", 2);
+        } else {
+            OutputString(out, kind);
+            OutputChar(out, '\t');
+            OutputTsvString(out, key, strlen(key));
+            OutputChar(out, '\t');
+            OutputTsvString(out, fromValue ?: "", fromValue ? strlen(fromValue) : 0);
+            OutputChar(out, '\t');
+            OutputTsvString(out, toValue ?: "", toValue ? strlen(toValue) : 0);
+            OutputChar(out, '\n');
+        }
+    }
+
+    OutputFlush(out);
+}
+
+// Sets the keys that are missing or different in `to` to their values in
+// `from`. Keys that only exist in `to` are left alone.
+static i32 promoteEnvDiff(VolContext *ctx, struct EnvDiff *diff, struct EnvFetch *from, struct EnvFetch *to) {
+    u32 count = diff->removed + diff->changed;
+    if (!count) {
+        VolPrintf(ctx, "Nothing to promote to %s\n", to->env);
+        return PLUGIN_OK;
+    }
+
+    struct KeyValue *configs = malloc(count * sizeof(struct KeyValue));
+    u32 configCount = 0;
+
+    for (u32 i = 0; i < diff->count; i += 1) {
+        struct EnvChange change = diff->changes[i];
+        if (change.kind == EnvChange_Added) continue;
+
+        configs[configCount++] = (struct KeyValue){
+            EnvIndexKey(&from->index, change.from),
+            EnvIndexValue(&from->index, change.from)
+        };
+    }
+
+    char question[512];
+    snprintf(&question[0], sizeof(question), "Set %u key(s) on %s to their values from %s?", configCount, to->env, from->env);
+
+    if (!VolConfirm(ctx, &question[0])) {
+        VolPrintf(ctx, "Aborted\n");
+        free(configs);
+        return PLUGIN_OK;
+    }
+
+    InvalidateEnvIndex(to->app, to->env);
+
+    struct KeyValue *updated = configs;
+    enum NetError err = SetVaporCloudConfig(ctx, to->app, to->env, &updated, &configCount);
+    free(configs);
+
+    if (err != NetError_None)
+        return err;
+
+    struct EnvIndex index;
+    BuildEnvIndex(&index, updated, configCount);
+    SaveEnvIndex(&index, to->app, to->env);
+    FreeEnvIndex(&index);
+
+    VolPrintf(ctx, "Promoted %u key(s) to %s\n", count, to->env);
+    return PLUGIN_OK;
+}
+
+// `env diff <from> <to>`, fetching both environments at the same time
+static i32 diffEnv(VolContext *ctx, const char **args, size_t count) {
+    if (count != 2) {
+        VolPrintf(ctx, "ERROR: expected two environment names\n");
+        return PLUGIN_SHOW_HELP;
     }
+
+    struct EnvFetch from = { ctx, envApp(ctx), args[0] };
+    struct EnvFetch to = { ctx, envApp(ctx), args[1] };
+
+    VolJob *job = VolSubmit(fetchEnvIndex, &from);
+    fetchEnvIndex(&to);
+    VolWait(job);
+
+    i32 status = from.err ?: to.err;
+
+    if (!status) {
+        struct EnvDiff diff;
+        DiffEnvIndexes(&from.index, &to.index, &diff);
+        renderEnvDiff(ctx, &diff, &from, &to);
+
+        if (ctx->values[BuiltinFlag_Promote].b)
+            status = promoteEnvDiff(ctx, &diff, &from, &to);
+
+        FreeEnvDiff(&diff);
+    }
+
+    if (!from.err) FreeEnvIndex(&from.index);
+    if (!to.err) FreeEnvIndex(&to.index);
+
+    return status;
 }
 
-static i32 getEnv() {
+static i32 getEnv(VolContext *ctx) {
     enum NetError err;
 
+    if (ctx->values[BuiltinFlag_Page].b && envFormat(ctx) == VolFormat_Table && !ctx->background && isatty(STDIN_FILENO) && isatty(ctx->fd))
+        return pageEnv(ctx);
+
+    if (envFormat(ctx) != VolFormat_Table) {
+        char *json;
+        size_t len;
+
+        err = GetVaporCloudConfigJson(ctx, envApp(ctx), envEnv(ctx), &json, &len);
+        if (err != NetError_None) {
+            return err;
+        }
+
+        i32 status = renderConfigJson(ctx, envApp(ctx), envEnv(ctx), json, len);
+        free(json);
+        return status;
+    }
+
     u32 count;
     struct KeyValue *configs;
 
-    err = GetVaporCloudConfig(envAppName, envName, &configs, &count);
+    err = GetVaporCloudConfig(ctx, envApp(ctx), envEnv(ctx), &configs, &count);
     if (err != NetError_None) {
         return err;
     }
 
-    dumpConfig(envAppName, envName, configs, count);
-    
+    // NOTE: the listing is sorted by key as a side effect
+    struct EnvIndex index;
+    BuildEnvIndex(&index, configs, count);
+    SaveEnvIndex(&index, envApp(ctx), envEnv(ctx));
+    FreeEnvIndex(&index);
+
+    dumpConfig(ctx, configs, count);
+
     return PLUGIN_OK;
 }
 
-static i32 setEnv(const char **args, size_t count) {
+static i32 setEnv(VolContext *ctx, const char **args, size_t count) {
     if (!count) {
-        printf("ERROR: expected a list of key-value pairs\n");
+        VolPrintf(ctx, "ERROR: expected a list of key-value pairs\n");
         return PLUGIN_SHOW_HELP;
     }
 
@@ -108,7 +611,7 @@ static i32 setEnv(const char **args, size_t count) {
 
             key = buffer;
         } else {
-            printf("TODO. Skipping arg\n");
+            VolPrintf(ctx, "TODO. Skipping arg\n");
             continue;
         }
 
@@ -117,28 +620,56 @@ static i32 setEnv(const char **args, size_t count) {
         config->value = value;
     }
 
-    dumpConfig(envAppName, envName, configs, configCount);
+    dumpConfig(ctx, configs, configCount);
 
-    if (!UserConfirmation("Is the above correct?")) {
-        printf("Aborted\n");
+    if (!VolConfirm(ctx, "Is the above correct?")) {
+        VolPrintf(ctx, "Aborted\n");
         return PLUGIN_OK;
     }
 
-    SetVaporCloudConfig(envAppName, envName, &configs, &configCount);
+    InvalidateEnvIndex(envApp(ctx), envEnv(ctx));
+
+    if (SetVaporCloudConfig(ctx, envApp(ctx), envEnv(ctx), &configs, &configCount) == NetError_None) {
+        struct EnvIndex index;
+        BuildEnvIndex(&index, configs, configCount);
+        SaveEnvIndex(&index, envApp(ctx), envEnv(ctx));
+        FreeEnvIndex(&index);
+    }
 
-    dumpConfig(envAppName, envName, configs, configCount);
+    dumpConfig(ctx, configs, configCount);
 
     return PLUGIN_OK;
 }
 
-i32 envCommand(const char **args, size_t count) {
-    if (!envAppName) {
-        fprintf(stderr, "ERROR: Please provide an app name with -%s <name>\n", appFlag.name);
+i32 envCommand(VolContext *ctx, const char **args, size_t count) {
+    if (count && strcmp(args[0], "fleet") == 0) {
+        struct CLIFlagList apps = ctx->values[BuiltinFlag_Apps].l;
+        struct CLIFlagList envs = ctx->values[BuiltinFlag_Envs].l;
+        if (!envs.count) {
+            envs.values = &ctx->values[BuiltinFlag_Env].s;
+            envs.count = 1;
+        }
+
+        return FleetCommand(ctx, args+1, count-1, &apps, &envs);
+    }
+
+    if (!envApp(ctx)) {
+        fprintf(stderr, "ERROR: Please provide an app name with -%s <name>\n", flags[BuiltinFlag_App].name);
         return PLUGIN_SHOW_HELP;
     }
 
+    RememberEnvTarget(envApp(ctx), envEnv(ctx));
+
     if (!count) {
-        return getEnv();
+        return getEnv(ctx);
+    }
+
+    if (strcmp(args[0], "diff") == 0) {
+        return diffEnv(ctx, args+1, count-1);
+    }
+
+    if (strcmp(args[0], "get") == 0) {
+        return getEnvKeys(ctx, args+1, count-1);
     }
 
     if (strcmp(args[0], "set") == 0) {
@@ -146,13 +677,5 @@ i32 envCommand(const char **args, size_t count) {
         count--;
     }
 
-    return setEnv(args, count);
-}
-
-void RegisterNodesCommands() {
-    envId = RegisterCommand("env", "Commands for creating and managing VCloud env. variables", envCommand);
-
-    RegisterFlag(envId, appFlag);
-    RegisterFlag(envId, allFlag);
-    RegisterFlag(envId, envFlag);
+    return setEnv(ctx, args, count);
 }
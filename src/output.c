@@ -0,0 +1,178 @@
+// Buffered output for machine readable formats. Everything is appended to one
+// large buffer and written with `write` once it fills up, so dumping thousands
+// of entries costs a handful of syscalls instead of a printf per row.
+
+#define OUTPUT_BLOCK_SIZE (64*1024)
+
+struct Output {
+    int fd;
+    size_t len;
+    char data[OUTPUT_BLOCK_SIZE];
+};
+
+void OutputInit(struct Output *out, int fd) {
+    // NOTE: anything already printed through stdio has to come first
+    fflush(stdout);
+
+    out->fd = fd;
+    out->len = 0;
+}
+
+static void outputWriteAll(int fd, const char *data, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        ssize_t count = write(fd, data + offset, len - offset);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        offset += count;
+    }
+}
+
+void OutputFlush(struct Output *out) {
+    outputWriteAll(out->fd, out->data, out->len);
+    out->len = 0;
+}
+
+void OutputWrite(struct Output *out, const char *data, size_t len) {
+    if (out->len + len > OUTPUT_BLOCK_SIZE) {
+        OutputFlush(out);
+
+        if (len > OUTPUT_BLOCK_SIZE) {
+            outputWriteAll(out->fd, data, len);
+            return;
+        }
+    }
+
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+void OutputString(struct Output *out, const char *str) {
+    OutputWrite(out, str, strlen(str));
+}
+
+void OutputChar(struct Output *out, char c) {
+    if (out->len + 1 > OUTPUT_BLOCK_SIZE)
+        OutputFlush(out);
+    out->data[out->len++] = c;
+}
+
+// Writes the JSON escape for `c` into `escape`. Returns its length, or 0 when
+// `c` doesn't need escaping.
+static u32 jsonEscapeChar(u8 c, char *escape) {
+    static const char hex[] = "0123456789abcdef";
+
+    if (c >= 0x20 && c != '"' && c != '\\') return 0;
+
+    switch (c) {
+        case '"':  memcpy(escape, "\\\"", 2); return 2;
+        case '\\': memcpy(escape, "\\\\", 2); return 2;
+        case '\n': memcpy(escape, "\\n", 2); return 2;
+        case '\r': memcpy(escape, "\\r", 2); return 2;
+        case '\t': memcpy(escape, "\\t", 2); return 2;
+        default:
+            memcpy(escape, (char[6]){ '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] }, 6);
+            return 6;
+    }
+}
+
+// Writes `str` as a quoted JSON string, escaping as needed
+void OutputJsonString(struct Output *out, const char *str, size_t len) {
+    OutputChar(out, '"');
+
+    size_t start = 0;
+    for (size_t i = 0; i < len; i += 1) {
+        char escape[6];
+        u32 escapeLen = jsonEscapeChar(str[i], &escape[0]);
+        if (!escapeLen) continue;
+
+        OutputWrite(out, str + start, i - start);
+        OutputWrite(out, &escape[0], escapeLen);
+        start = i + 1;
+    }
+
+    OutputWrite(out, str + start, len - start);
+    OutputChar(out, '"');
+}
+
+// Same as OutputJsonString but into `dest`, which needs room for `len*6 + 2`
+// bytes. Returns the length written.
+size_t JsonQuote(char *dest, const char *str, size_t len) {
+    size_t out = 0;
+    dest[out++] = '"';
+
+    for (size_t i = 0; i < len; i += 1) {
+        u32 escapeLen = jsonEscapeChar(str[i], dest + out);
+        if (!escapeLen)
+            dest[out++] = str[i];
+        else
+            out += escapeLen;
+    }
+
+    dest[out++] = '"';
+    return out;
+}
+
+// Writes `str` as a TSV field, escaping tabs, newlines and backslashes
+void OutputTsvString(struct Output *out, const char *str, size_t len) {
+    size_t start = 0;
+    for (size_t i = 0; i < len; i += 1) {
+        char c = str[i];
+        if (c != '\t' && c != '\n' && c != '\r' && c != '\\') continue;
+
+        OutputWrite(out, str + start, i - start);
+        start = i + 1;
+
+        switch (c) {
+            case '\t': OutputWrite(out, "\\t", 2); break;
+            case '\n': OutputWrite(out, "\\n", 2); break;
+            case '\r': OutputWrite(out, "\\r", 2); break;
+            default:   OutputWrite(out, "\\\\", 2);
+        }
+    }
+
+    OutputWrite(out, str + start, len - start);
+}
+
+// Writes a JSON string token's raw contents, which are already escaped, as a
+// TSV field. TSV uses the same `\t`, `\n` and `\\` escapes so only the escapes
+// that TSV doesn't have need rewriting.
+void OutputTsvFromJson(struct Output *out, const char *raw, size_t len) {
+    size_t start = 0;
+    for (size_t i = 0; i < len; i += 1) {
+        if (raw[i] != '\\' || i + 1 >= len) continue;
+
+        char next = raw[i+1];
+        if (next == '"' || next == '/') {
+            OutputWrite(out, raw + start, i - start);
+            OutputChar(out, next);
+            start = i + 2;
+            i++;
+        } else if (next == 'u' && i + 5 < len) {
+            u32 cp = strtoul((char[5]){ raw[i+2], raw[i+3], raw[i+4], raw[i+5], 0 }, NULL, 16);
+
+            size_t escapeLen = 6;
+            if (cp >= 0xD800 && cp <= 0xDBFF && i + 11 < len && raw[i+6] == '\\' && raw[i+7] == 'u')
+                escapeLen = 12;
+
+            OutputWrite(out, raw + start, i - start);
+
+            // NOTE: control characters would break the row, keep them escaped
+            if (cp < 0x20) {
+                OutputWrite(out, raw + i, escapeLen);
+            } else {
+                char decoded[8];
+                OutputWrite(out, &decoded[0], jsonUnescape(raw + i, escapeLen, &decoded[0]));
+            }
+
+            start = i + escapeLen;
+            i += escapeLen - 1;
+        } else {
+            i++;
+        }
+    }
+
+    OutputWrite(out, raw + start, len - start);
+}
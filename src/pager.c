@@ -0,0 +1,430 @@
+// Full screen key/value browser for environments too large to print. Only the
+// visible rows are drawn, entries are kept sorted by key so a prefix search is a
+// pair of binary searches, and entries can keep arriving from another thread
+// while the pager is open.
+
+struct PagerEntry {
+    char *key;
+    char *value;
+};
+
+struct Pager {
+    const char *title;
+
+    pthread_mutex_t mutex;
+    struct PagerEntry *pending;
+    u32 pendingCount;
+    u32 pendingCap;
+    b32 finished;
+    const char *error;
+
+    // NOTE: written to whenever there is something new to show
+    int wake[2];
+
+    // NOTE: only touched by the thread running the pager
+    struct PagerEntry *entries;
+    u32 count;
+    u32 cap;
+
+    char search[256];
+    u32 searchLen;
+    b32 searching;
+
+    u32 first;
+    u32 last;
+    u32 top;
+    u32 cursor;
+};
+
+struct Pager *PagerCreate(const char *title) {
+    struct Pager *pager = calloc(1, sizeof(struct Pager));
+    pager->title = title;
+    pthread_mutex_init(&pager->mutex, NULL);
+
+    if (pipe(pager->wake) == 0) {
+        fcntl(pager->wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(pager->wake[1], F_SETFL, O_NONBLOCK);
+    } else {
+        pager->wake[0] = pager->wake[1] = -1;
+    }
+
+    return pager;
+}
+
+void PagerFree(struct Pager *pager) {
+    for (u32 i = 0; i < pager->count; i += 1) {
+        free(pager->entries[i].key);
+        free(pager->entries[i].value);
+    }
+
+    for (u32 i = 0; i < pager->pendingCount; i += 1) {
+        free(pager->pending[i].key);
+        free(pager->pending[i].value);
+    }
+
+    if (pager->wake[0] >= 0) {
+        close(pager->wake[0]);
+        close(pager->wake[1]);
+    }
+
+    pthread_mutex_destroy(&pager->mutex);
+    free(pager->pending);
+    free(pager->entries);
+    free(pager);
+}
+
+static void pagerWake(struct Pager *pager) {
+    if (pager->wake[1] >= 0) {
+        // NOTE: a full pipe already has a wake up pending
+        char c = 0;
+        (void)!write(pager->wake[1], &c, 1);
+    }
+}
+
+// Adds an entry from any thread. The pager takes ownership of both strings.
+void PagerAdd(struct Pager *pager, char *key, char *value) {
+    pthread_mutex_lock(&pager->mutex);
+
+    if (pager->pendingCount >= pager->pendingCap) {
+        pager->pendingCap = pager->pendingCap ? pager->pendingCap * 2 : 256;
+        pager->pending = realloc(pager->pending, pager->pendingCap * sizeof(struct PagerEntry));
+    }
+
+    pager->pending[pager->pendingCount++] = (struct PagerEntry){ key, value };
+    b32 first = pager->pendingCount == 1;
+
+    pthread_mutex_unlock(&pager->mutex);
+
+    if (first)
+        pagerWake(pager);
+}
+
+// Marks the end of the entries, `error` is shown in the status line if set
+void PagerFinish(struct Pager *pager, const char *error) {
+    pthread_mutex_lock(&pager->mutex);
+    pager->finished = true;
+    pager->error = error;
+    pthread_mutex_unlock(&pager->mutex);
+
+    pagerWake(pager);
+}
+
+static int comparePagerEntries(const void *a, const void *b) {
+    return strcmp(((struct PagerEntry *)a)->key, ((struct PagerEntry *)b)->key);
+}
+
+// First entry whose key doesn't sort before `key` when only the first `len`
+// bytes are compared. With `upper` set it's the first one that sorts after it.
+static u32 pagerSearch(struct Pager *pager, const char *key, size_t len, b32 upper) {
+    u32 low = 0, high = pager->count;
+
+    while (low < high) {
+        u32 mid = low + (high - low) / 2;
+        int cmp = strncmp(pager->entries[mid].key, key, len);
+
+        if (cmp < 0 || (upper && cmp == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static void pagerFilter(struct Pager *pager) {
+    pager->first = pagerSearch(pager, &pager->search[0], pager->searchLen, false);
+    pager->last = pagerSearch(pager, &pager->search[0], pager->searchLen, true);
+}
+
+// Moves pending entries into the sorted index. The batch is sorted on its own
+// and merged in, keeping the selected entry selected.
+static b32 pagerMerge(struct Pager *pager) {
+    pthread_mutex_lock(&pager->mutex);
+    struct PagerEntry *pending = pager->pending;
+    u32 pendingCount = pager->pendingCount;
+    pager->pending = NULL;
+    pager->pendingCount = pager->pendingCap = 0;
+    pthread_mutex_unlock(&pager->mutex);
+
+    if (!pendingCount) return false;
+
+    qsort(pending, pendingCount, sizeof(struct PagerEntry), comparePagerEntries);
+
+    char *selected = pager->cursor < pager->last ? pager->entries[pager->cursor].key : NULL;
+
+    if (pager->count + pendingCount > pager->cap) {
+        while (pager->count + pendingCount > pager->cap)
+            pager->cap = pager->cap ? pager->cap * 2 : 1024;
+        pager->entries = realloc(pager->entries, pager->cap * sizeof(struct PagerEntry));
+    }
+
+    // NOTE: merging from the back does it in place
+    i64 a = (i64)pager->count - 1, b = (i64)pendingCount - 1;
+    for (i64 out = (i64)pager->count + pendingCount - 1; b >= 0; out -= 1) {
+        if (a >= 0 && strcmp(pager->entries[a].key, pending[b].key) > 0) {
+            pager->entries[out] = pager->entries[a--];
+        } else {
+            pager->entries[out] = pending[b--];
+        }
+    }
+
+    pager->count += pendingCount;
+    free(pending);
+
+    pagerFilter(pager);
+
+    if (selected) {
+        u32 index = pagerSearch(pager, selected, strlen(selected) + 1, false);
+        while (index < pager->last && pager->entries[index].key != selected)
+            index++;
+        pager->cursor = index;
+    } else {
+        pager->cursor = pager->first;
+    }
+
+    return true;
+}
+
+// Writes up to `width` columns of `str` on a single line, padded with spaces
+static void pagerCell(struct Output *out, const char *str, u32 width) {
+    size_t len = strlen(str);
+    u32 used = 0;
+
+    for (size_t i = 0; i < len;) {
+        u8 c = str[i];
+
+        if (c < 0x80) {
+            if (used + 1 > width) break;
+            OutputChar(out, c < 0x20 || c == 0x7F ? ' ' : c);
+            used++;
+            i++;
+            continue;
+        }
+
+        u32 cpLen;
+        u32 cp = DecodeCodePointN(&cpLen, str+i, len-i);
+        u32 cpWidth = CodePointWidth(cp);
+        if (used + cpWidth > width) break;
+
+        OutputWrite(out, str+i, cpLen);
+        used += cpWidth;
+        i += cpLen;
+    }
+
+    for (; used < width; used += 1)
+        OutputChar(out, ' ');
+}
+
+static void pagerDraw(struct Pager *pager, struct Output *out) {
+    i32 width, height;
+    GetTermDim(&width, &height);
+
+    u32 rows = height > 2 ? height - 1 : 1;
+
+    if (pager->cursor < pager->first || pager->cursor >= pager->last)
+        pager->cursor = pager->first;
+
+    if (pager->top < pager->first || pager->top > pager->cursor)
+        pager->top = pager->cursor < pager->first ? pager->first : pager->cursor;
+    if (pager->cursor >= pager->top + rows)
+        pager->top = pager->cursor - rows + 1;
+
+    // NOTE: the key column fits the widest visible key, up to a third of the screen
+    u32 keyWidth = 0;
+    for (u32 i = pager->top; i < pager->last && i < pager->top + rows; i += 1) {
+        u32 keyLen = DisplayWidth(pager->entries[i].key, strlen(pager->entries[i].key));
+        if (keyLen > keyWidth) keyWidth = keyLen;
+    }
+
+    u32 maxKeyWidth = width > 9 ? width / 3 : 3;
+    if (keyWidth > maxKeyWidth) keyWidth = maxKeyWidth;
+
+    u32 valueWidth = width > (i32)keyWidth + 3 ? width - keyWidth - 3 : 1;
+
+    OutputString(out, "\x1b[H");
+
+    for (u32 row = 0; row < rows; row += 1) {
+        u32 index = pager->top + row;
+
+        if (index < pager->last) {
+            if (index == pager->cursor)
+                OutputString(out, "\x1b[7m");
+
+            OutputChar(out, ' ');
+            pagerCell(out, pager->entries[index].key, keyWidth);
+            OutputString(out, " │ ");
+            pagerCell(out, pager->entries[index].value, valueWidth - 1);
+
+            if (index == pager->cursor)
+                OutputString(out, "\x1b[0m");
+        }
+
+        OutputString(out, "\x1b[K\n");
+    }
+
+    pthread_mutex_lock(&pager->mutex);
+    b32 finished = pager->finished;
+    const char *error = pager->error;
+    pthread_mutex_unlock(&pager->mutex);
+
+    char status[512];
+    u32 matches = pager->last - pager->first;
+    snprintf(
+        &status[0], sizeof(status),
+        " %s  %u/%u%s  %s%.*s%s",
+        pager->title,
+        matches ? pager->cursor - pager->first + 1 : 0,
+        matches,
+        error ? "  (failed)" : finished ? "" : "  loading...",
+        pager->searching || pager->searchLen ? "/" : "",
+        (int)pager->searchLen, &pager->search[0],
+        pager->searching ? "_" : ""
+    );
+
+    OutputString(out, "\x1b[7m");
+    pagerCell(out, &status[0], width);
+    OutputString(out, "\x1b[0m");
+
+    OutputFlush(out);
+}
+
+static void pagerEnd(struct Pager *pager) {
+    if (pager->first != pager->last)
+        pager->cursor = pager->last - 1;
+}
+
+static void pagerMove(struct Pager *pager, i64 delta) {
+    if (pager->first == pager->last) return;
+
+    i64 cursor = (i64)pager->cursor + delta;
+    if (cursor < pager->first) cursor = pager->first;
+    if (cursor >= pager->last) cursor = pager->last - 1;
+
+    pager->cursor = cursor;
+}
+
+// Handles the keys in `input`. Returns false once the pager should close.
+static b32 pagerKeys(struct Pager *pager, const char *input, ssize_t len) {
+    i32 height;
+    GetTermDim(NULL, &height);
+    i64 page = height > 2 ? height - 2 : 1;
+
+    for (ssize_t i = 0; i < len; i += 1) {
+        char c = input[i];
+
+        if (c == '\x1b' && i + 2 < len && input[i+1] == '[') {
+            char code = input[i+2];
+            i += 2;
+
+            switch (code) {
+                case 'A': pagerMove(pager, -1); break;
+                case 'B': pagerMove(pager, 1); break;
+                case 'H': pager->cursor = pager->first; break;
+                case 'F': pagerEnd(pager); break;
+
+                case '5':
+                case '6':
+                    if (i + 1 < len && input[i+1] == '~') i++;
+                    pagerMove(pager, code == '5' ? -page : page);
+                    break;
+            }
+            continue;
+        }
+
+        if (pager->searching) {
+            if (c == '\x1b') {
+                pager->searching = false;
+                pager->searchLen = 0;
+            } else if (c == '\n' || c == '\r') {
+                pager->searching = false;
+            } else if (c == 0x7F || c == '\b') {
+                if (pager->searchLen) pager->searchLen--;
+            } else if (c == 0x03) {
+                return false;
+            } else if ((u8)c >= 0x20 && pager->searchLen < sizeof(pager->search) - 1) {
+                pager->search[pager->searchLen++] = c;
+            }
+
+            pagerFilter(pager);
+            continue;
+        }
+
+        switch (c) {
+            case 'q':
+            case 0x03:
+                return false;
+
+            case 'j': pagerMove(pager, 1); break;
+            case 'k': pagerMove(pager, -1); break;
+            case ' ':
+            case 'f': pagerMove(pager, page); break;
+            case 'b': pagerMove(pager, -page); break;
+            case 'g': pager->cursor = pager->first; break;
+            case 'G': pagerEnd(pager); break;
+
+            case '/':
+                pager->searching = true;
+                pager->searchLen = 0;
+                pagerFilter(pager);
+                break;
+
+            case '\x1b':
+                if (pager->searchLen) {
+                    pager->searchLen = 0;
+                    pagerFilter(pager);
+                }
+                break;
+        }
+    }
+
+    return true;
+}
+
+// Shows the entries until the user quits, picking up new ones as they're added.
+// Expects stdin and stdout to be a terminal.
+i32 PagerRun(struct Pager *pager) {
+    struct Output *out = malloc(sizeof(struct Output));
+    OutputInit(out, STDOUT_FILENO);
+
+    enableRawInput();
+
+    OutputString(out, "\x1b[?1049h\x1b[?25l\x1b[2J");
+    pagerMerge(pager);
+    pagerFilter(pager);
+    pagerDraw(pager, out);
+
+    struct pollfd fds[2] = {
+        { STDIN_FILENO, POLLIN, 0 },
+        { pager->wake[0], POLLIN, 0 }
+    };
+
+    for (;;) {
+        // NOTE: the timeout picks up terminal resizes
+        int ready = poll(&fds[0], pager->wake[0] >= 0 ? 2 : 1, 250);
+        if (ready < 0 && errno != EINTR) break;
+
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            char drain[64];
+            while (read(pager->wake[0], &drain[0], sizeof(drain)) > 0);
+        }
+
+        if (ready > 0 && (fds[0].revents & (POLLIN | POLLHUP))) {
+            char input[64];
+            ssize_t len = read(STDIN_FILENO, &input[0], sizeof(input));
+            if (len <= 0 || !pagerKeys(pager, &input[0], len))
+                break;
+        }
+
+        pagerMerge(pager);
+        pagerDraw(pager, out);
+    }
+
+    OutputString(out, "\x1b[?25h\x1b[?1049l");
+    OutputFlush(out);
+    free(out);
+
+    restoreTerminalState();
+
+    return PLUGIN_OK;
+}
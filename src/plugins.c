@@ -1,9 +1,24 @@
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 static char *pluginDirectory;
-static b32 reloadTerminalSize = true;
+static char *cacheDirectory;
+static char *cCompiler;
 
 void GetTermDim(int *width, int *height) {
-    struct winsize size;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
+    struct winsize size = {0};
+
+    if (!isatty(STDOUT_FILENO) || ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || !size.ws_col) {
+        const char *columns = getenv("COLUMNS");
+        const char *lines = getenv("LINES");
+
+        size.ws_col = columns ? atoi(columns) : 0;
+        size.ws_row = lines ? atoi(lines) : 0;
+
+        if (!size.ws_col) size.ws_col = 80;
+        if (!size.ws_row) size.ws_row = 24;
+    }
 
     if (width)
         *width =  size.ws_col;
@@ -11,31 +26,69 @@ void GetTermDim(int *width, int *height) {
         *height = size.ws_row;
 }
 
+static pthread_once_t directoriesOnce = PTHREAD_ONCE_INIT;
+
+// NOTE: once for every thread, contexts can run commands on several
+static void findDirectories() {
+    const char *home = getenv("HOME");
+    if (!home) {
+        printf("Unable to locate home folder\n");
+        return;
+    }
+
+    pluginDirectory = malloc(1024);
+    snprintf(pluginDirectory, 1024, "%s/.volva/plugins/", home);
+
+    cacheDirectory = malloc(1024);
+    snprintf(cacheDirectory, 1024, "%s/.volva/cache/", home);
+}
+
 const char *GetPluginDir() {
-    if (!pluginDirectory) {
-        pluginDirectory = malloc(1024);
+    pthread_once(&directoriesOnce, findDirectories);
+    return pluginDirectory;
+}
+
+const char *GetCacheDir() {
+    pthread_once(&directoriesOnce, findDirectories);
+    return cacheDirectory;
+}
+
+// Resolves `name` against $PATH without spawning a shell
+static char *findExecutable(const char *name) {
+    const char *path = getenv("PATH");
+    if (!path) return NULL;
+
+    char buffer[1024];
+
+    while (*path) {
+        const char *end = strchr(path, ':');
+        int len = end ? end - path : (int)strlen(path);
 
-        const char *home = getenv("HOME");
-        if (!home) {
-            printf("Unable to locate home folder\n");
-            return NULL;
+        if (len && len + strlen(name) + 2 < sizeof(buffer)) {
+            snprintf(&buffer[0], sizeof(buffer), "%.*s/%s", len, path, name);
+            if (access(&buffer[0], X_OK) == 0)
+                return strdup(&buffer[0]);
         }
 
-        snprintf(pluginDirectory, 1024, "%s/.volva/plugins/", home);
+        if (!end) break;
+        path = end+1;
     }
 
-    return pluginDirectory;
+    return NULL;
 }
 
 const char *GetCCompiler() {
-    b32 hasClang = system("which -s clang") == 0;
-    return hasClang ? "clang" : "gcc";
+    if (!cCompiler) {
+        cCompiler = findExecutable("clang") ?: findExecutable("gcc") ?: strdup("cc");
+    }
+
+    return cCompiler;
 }
 
-b32 UserConfirmation(const char *message) {
+static b32 confirm(b32 yes, const char *message) {
     printf("%s\ny/[n] > ", message);
 
-    if (FlagYes) {
+    if (yes) {
         printf("y\n");
         return true;
     }
@@ -72,6 +125,24 @@ b32 UserConfirmation(const char *message) {
     return confirmation;
 }
 
+b32 UserConfirmation(const char *message) {
+    return confirm(FlagYes, message);
+}
+
+int VolConfirm(VolContext *ctx, const char *message) {
+    b32 yes = ctx->values[BuiltinFlag_Yes].b;
+
+    if (ctx->background) {
+        VolPrintf(ctx, "%s\ny/[n] > %s\n", message, yes ? "y" : "n");
+        return yes;
+    }
+
+    // NOTE: the question goes after what the command printed so far
+    if (ctx->out)
+        OutputFlush(ctx->out);
+    return confirm(yes, message);
+}
+
 b32 UserConfirmationV(const char *fmt, ...) {
     char buffer[1024];
     va_list args;
@@ -82,8 +153,33 @@ b32 UserConfirmationV(const char *fmt, ...) {
     return UserConfirmation(&buffer[0]);
 }
 
-CommandId RegisterCommand(const char *name, const char *helpText, PluginRunFunc *func) {
-    size_t index = commands.count;
+// NOTE: built with the builtin commands in builtins.c
+static struct NameIndexEntry builtinCommandIndex[BuiltinCommandCount];
+
+// The id of the command called `name`, -1 when there is none. Builtins take
+// precedence over plugins.
+i32 CommandForName(const char *name) {
+    u64 hash = HashString(name);
+
+    IndexBuiltins();
+    i32 builtin = FindNameIndex(&builtinCommandIndex[0], BuiltinCommandCount, hash);
+    if (builtin >= 0 && strcmp(commands.names[builtin], name) == 0)
+        return builtin;
+
+    for (size_t i = BuiltinCommandCount; i < commands.count; i += 1) {
+        if (commands.names[i] && commands.hashes[i] == hash && strcmp(commands.names[i], name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static CommandId registerCommand(const char *name, const char *helpText, PluginRunFunc *func, PluginContextRunFunc *contextFunc) {
+    // NOTE: slots of unloaded plugins are reused, ids of other commands stay put
+    size_t index = BuiltinCommandCount;
+    while (index < commands.count && commands.names[index])
+        index++;
+
     if (index >= MAX_COMMAND_COUNT) {
         printf("WARNING: Unable to register command '%s'\n", name);
         return -1;
@@ -92,14 +188,29 @@ CommandId RegisterCommand(const char *name, const char *helpText, PluginRunFunc
     commands.names[index] = strdup(name);
     commands.helpTexts[index] = strdup(helpText);
     commands.functions[index] = func;
-    commands.count++;
-
-    if (FlagVerbose)
+    commands.contextFunctions[index] = contextFunc;
+    commands.helpers[index] = NULL;
+    commands.plugins[index] = loadingPlugin;
+    commands.hashes[index] = HashString(name);
+    if (index == commands.count)
+        commands.count++;
+
+    // NOTE: only while loading, which follows the process' own -verbose
+    if (FlagVerbose && loadingPlugin >= 0)
         printf("Registered command: '%s' (id: %zu)\n", name, index);
 
     return (CommandId)index;
 }
 
+CommandId RegisterCommand(const char *name, const char *helpText, PluginRunFunc *func) {
+    return registerCommand(name, helpText, func, NULL);
+}
+
+// A command that gets a context of its own for every invocation
+CommandId RegisterContextCommand(const char *name, const char *helpText, PluginContextRunFunc *func) {
+    return registerCommand(name, helpText, NULL, func);
+}
+
 void RegisterHelper(CommandId commandId, PluginHelperFunc *helper) {
     if (commandId <= GlobalCommandId)
         return;
@@ -108,41 +219,15 @@ void RegisterHelper(CommandId commandId, PluginHelperFunc *helper) {
 }
 
 i32 System(const char *command, const char *arg) {
-    pid_t pid;
-    pid_t ret;
-    i32 status = 0;
-
     const char *args[3];
     args[0] = command;
     args[1] = arg;
     args[2] = NULL;
 
-    pid = fork();
-    if (pid != 0) {
-        while ((ret = waitpid(pid, &status, 0)) == -1) {
-            if (errno != EINTR) {
-                printf("errno!\n");
-                break;
-            }
-        }
-
-        if (ret != -1 && (!WIFEXITED(status) || !(WEXITSTATUS(status)))) {
-            // TODO(Brett):
-        }
-    } else {
-        if (execvp(command, (char *const *)args) == -1) {
-            exit(127);
-        }
-    }
-
-    return WEXITSTATUS(status);
+    return VolRun(&args[0]);
 }
 
 i32 SystemV(const char *command, ...) {
-    pid_t pid;
-    pid_t ret;
-    i32 status = 0;
-
     const char *args[0x100];
     int argc;
 
@@ -151,7 +236,7 @@ i32 SystemV(const char *command, ...) {
     va_list vargs;
     va_start(vargs, command);
 
-    for (argc = 1; argc < 0x100; argc += 1) {
+    for (argc = 1; argc < 0x100 - 1; argc += 1) {
         const char *arg = va_arg(vargs, char *);
         if (!arg) break;
         args[argc] = arg;
@@ -161,24 +246,226 @@ i32 SystemV(const char *command, ...) {
 
     args[argc] = NULL;
 
-    pid = fork();
-    if (pid != 0) {
-        while ((ret = waitpid(pid, &status, 0)) == -1) {
-            if (errno != EINTR) {
-                break;
-            }
-        }
+    return VolRun(&args[0]);
+}
 
-        if (ret != -1 && (!WIFEXITED(status) || !(WEXITSTATUS(status)))) {
-            // TODO(Brett):
+struct Plugin {
+    char *name;
+    void *handle;
+    // NOTE: set instead of the handle for plugins running in a sandbox
+    struct SandboxWorker *worker;
+    // NOTE: VOL_PLUGIN_* from the plugin's descriptor
+    u32 capabilities;
+
+    // NOTE: a plugin is loaded again when any of these change
+    i64 mtime;
+    i64 mtimeNsec;
+    u64 size;
+    u64 inode;
+};
+
+static struct Plugin *plugins;
+static i32 pluginCount;
+
+static void pluginStat(struct Plugin *plugin, struct stat *st) {
+    plugin->mtime = st->st_mtime;
+#ifdef __APPLE__
+    plugin->mtimeNsec = st->st_mtimespec.tv_nsec;
+#else
+    plugin->mtimeNsec = st->st_mtim.tv_nsec;
+#endif
+    plugin->size = st->st_size;
+    plugin->inode = st->st_ino;
+}
+
+// Drops the commands `plugin` registered, their slots are reused
+void RemovePluginCommands(i32 plugin) {
+    for (size_t i = 0; i < commands.count; i += 1) {
+        if (!commands.names[i] || commands.plugins[i] != plugin) continue;
+
+        free((char *)commands.names[i]);
+        free((char *)commands.helpTexts[i]);
+        commands.names[i] = NULL;
+        commands.helpTexts[i] = NULL;
+        commands.functions[i] = NULL;
+        commands.contextFunctions[i] = NULL;
+        commands.helpers[i] = NULL;
+    }
+}
+
+// Logs on behalf of a plugin, stdout is left to command output
+void VolLog(const char *msg) {
+    fputs(msg, stderr);
+}
+
+static const VolHostApi volHostApi = {
+    VOLV_PLUGINS_VERSION,
+    sizeof(VolHostApi),
+
+    &FlagHelp,
+    &FlagVerbose,
+    &FlagVersion,
+    &FlagYes,
+    &FlagFormat,
+    &CommandName,
+
+    VolLog,
+    RegisterCommand,
+    RegisterHelper,
+    RegisterFlag,
+    PrintFlags,
+    GetCCompiler,
+    UserConfirmation,
+    VolConfigGet,
+
+    VolWorkerCount,
+    VolSubmit,
+    VolWait,
+    VolParallelFor,
+
+    VolJsonParse,
+    VolJsonFree,
+    VolJsonType,
+    VolJsonSize,
+    VolJsonGet,
+    VolJsonIndex,
+    VolJsonNext,
+    VolJsonQuery,
+    VolJsonRaw,
+    VolJsonStr,
+    VolJsonCStr,
+
+    VolHttpRequest,
+
+    VolSpawn,
+    VolProcessWait,
+    VolProcessOutput,
+    VolProcessFree,
+    VolRun,
+    VolProcessPoolCreate,
+    VolProcessPoolSpawn,
+    VolProcessPoolWait,
+    VolProcessPoolFree,
+
+    RegisterContextCommand,
+    VolCommandName,
+    VolFlagBool,
+    VolFlagEnum,
+    VolFlagString,
+    VolFlagList,
+    VolAlloc,
+    VolWrite,
+    VolPrintf,
+    VolConfirm,
+};
+
+// Runs the plugin's init function as plugin `index`. Plugins with a descriptor
+// get the host table, the rest PluginInit. False when the plugin was built
+// for another version of volv and has to be closed again.
+b32 InitPlugin(void *handle, i32 index, const char *name, u32 *capabilities) {
+    *capabilities = 0;
+
+    const VolPluginDescriptor *descriptor = dlsym(handle, "VolPlugin");
+    PluginInitFunc *legacyInit = descriptor ? NULL : dlsym(handle, "PluginInit");
+
+    if (descriptor) {
+        b32 supported = descriptor->version >= VOLV_PLUGINS_MIN_VERSION && descriptor->version <= VOLV_PLUGINS_VERSION;
+        if (!supported || descriptor->apiSize > sizeof(VolHostApi)) {
+            fprintf(
+                stderr, "ERROR: Plugin %s was built for plugin API %d (%zu bytes), volv has %d (%zu bytes)\n",
+                name, descriptor->version, descriptor->apiSize, VOLV_PLUGINS_VERSION, sizeof(VolHostApi)
+            );
+            return false;
         }
+
+        *capabilities = descriptor->capabilities;
+    }
+
+    if (!descriptor && !legacyInit)
+        return true;
+
+    loadingPlugin = index;
+    b32 err = descriptor ? descriptor->init(&volHostApi) : legacyInit();
+    loadingPlugin = -1;
+
+    if (err) {
+        printf("Error trying to init plugin\n");
+    }
+
+    return true;
+}
+
+// How plugins are opened. By default every function a plugin calls is bound
+// when it's opened, so a missing symbol fails the load. `[plugins] load = lazy`
+// binds each one on its first call instead, plugins whose commands don't run
+// then cost little more than mapping them. Either way a plugin's symbols stay
+// its own, only its init function is looked up.
+int PluginOpenFlags() {
+    static int flags;
+
+    if (!flags) {
+        const char *mode = VolConfigGet("plugins", "load");
+        flags = mode && strcmp(mode, "lazy") == 0 ? RTLD_LAZY | RTLD_LOCAL : RTLD_NOW | RTLD_LOCAL;
+    }
+
+    return flags;
+}
+
+static void loadPlugin(i32 index, const char *path) {
+    struct Plugin *plugin = &plugins[index];
+
+    if (FlagVerbose)
+        printf("  Loading: %s\n", plugin->name);
+
+    if (SandboxWanted(plugin->name)) {
+        plugin->worker = SandboxLoadPlugin(index, plugin->name, path, &plugin->capabilities);
+
+        // NOTE: the worker found out the plugin has to run in here
+        if (plugin->worker || !(plugin->capabilities & VOL_PLUGIN_NO_SANDBOX))
+            return;
+    }
+
+    plugin->handle = dlopen(path, PluginOpenFlags());
+    if (!plugin->handle) {
+        if (FlagVerbose)
+            printf("  %s\n", dlerror());
+        return;
+    }
+
+    if (!InitPlugin(plugin->handle, index, plugin->name, &plugin->capabilities)) {
+        RemovePluginCommands(index);
+        RemovePluginFlags(index);
+        dlclose(plugin->handle);
+        plugin->handle = NULL;
+    }
+}
+
+static void unloadPlugin(i32 index) {
+    struct Plugin *plugin = &plugins[index];
+    if (!plugin->handle && !plugin->worker) return;
+
+    // NOTE: nothing may point into the library once it is closed
+    RemovePluginCommands(index);
+    RemovePluginFlags(index);
+
+    if (plugin->worker) {
+        SandboxUnloadPlugin(plugin->worker);
+        plugin->worker = NULL;
     } else {
-        if (execvp(command, (char *const *)args) == -1) {
-            exit(127);
-        }
+        dlclose(plugin->handle);
+        plugin->handle = NULL;
     }
+}
+
+static i32 addPlugin(const char *name, struct stat *st) {
+    plugins = realloc(plugins, (pluginCount + 1) * sizeof(struct Plugin));
+
+    struct Plugin *plugin = &plugins[pluginCount];
+    memset(plugin, 0, sizeof(*plugin));
+    plugin->name = strdup(name);
+    pluginStat(plugin, st);
 
-    return WEXITSTATUS(status);
+    return pluginCount++;
 }
 
 i32 LoadPlugins() {
@@ -190,36 +477,131 @@ i32 LoadPlugins() {
         printf("Path: %s\n", pluginDir);
 
     if ((dir = opendir(pluginDir)) != NULL) {
-        char workingDir[1024];
-        getcwd(&workingDir[0], sizeof(workingDir));
-
-        chdir(pluginDir);
+        char path[1024];
 
         while ((entry = readdir(dir)) != NULL) {
             const char *name = entry->d_name;
-            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            // NOTE: also skips `.`, `..` and in-progress installs
+            if (name[0] == '.')
                 continue;
 
-            if (FlagVerbose)
-                printf("  Loading: %s\n", name);
+            // NOTE: dlopen only looks in the working directory for paths
+            snprintf(&path[0], sizeof(path), "%s%s", pluginDir, name);
 
-            void *plugin = dlopen(name, RTLD_NOW);
-            if (!plugin) {
-                continue;
-            }
+            struct stat st;
+            if (stat(&path[0], &st) != 0) continue;
 
-            PluginInitFunc *init = dlsym(plugin, "PluginInit");
-            if (init) {
-                b32 err = init();
-                if (err) {
-                    printf("Error trying to init plugin\n");
-                }
-            }
+            loadPlugin(addPlugin(name, &st), &path[0]);
         }
 
-        chdir(&workingDir[0]);
         closedir(dir);
     }
 
     return 0;
 }
+
+// Brings the loaded plugins in line with the plugin directory: changed plugins
+// are closed and opened again, removed ones closed and new ones opened. Their
+// commands and flags are replaced along with them. Returns how many changed.
+i32 ReloadPlugins() {
+    const char *pluginDir = GetPluginDir();
+    DIR *dir = opendir(pluginDir);
+
+    b32 *seen = calloc(pluginCount + 1, sizeof(b32));
+    i32 seenCount = pluginCount;
+    i32 changed = 0;
+
+    char path[1024];
+    struct dirent *entry;
+
+    while (dir && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.')
+            continue;
+
+        snprintf(&path[0], sizeof(path), "%s%s", pluginDir, name);
+
+        struct stat st;
+        if (stat(&path[0], &st) != 0) continue;
+
+        i32 index = -1;
+        for (i32 i = 0; i < pluginCount; i += 1) {
+            if (strcmp(plugins[i].name, name) == 0) {
+                index = i;
+                break;
+            }
+        }
+
+        if (index >= 0) {
+            if (index < seenCount) seen[index] = true;
+
+            struct Plugin current = plugins[index];
+            pluginStat(&current, &st);
+
+            if (current.mtime == plugins[index].mtime && current.mtimeNsec == plugins[index].mtimeNsec &&
+                current.size == plugins[index].size && current.inode == plugins[index].inode)
+                continue;
+
+            if (plugins[index].capabilities & VOL_PLUGIN_NO_UNLOAD) {
+                printf("Plugin %s changed, it is loaded by the next volv started\n", name);
+                plugins[index] = current;
+                continue;
+            }
+
+            unloadPlugin(index);
+            plugins[index] = current;
+        } else {
+            index = addPlugin(name, &st);
+        }
+
+        printf("Loading plugin %s\n", name);
+        loadPlugin(index, &path[0]);
+        ApplyPluginConfigFlags(index);
+        changed++;
+    }
+
+    for (i32 i = 0; i < seenCount; i += 1) {
+        if (seen[i] || (!plugins[i].handle && !plugins[i].worker)) continue;
+
+        // NOTE: stays until the process exits, same as when it changes
+        if (plugins[i].capabilities & VOL_PLUGIN_NO_UNLOAD) continue;
+
+        printf("Unloading plugin %s\n", plugins[i].name);
+        unloadPlugin(i);
+        changed++;
+
+        // NOTE: whatever shows up under the name next is new
+        plugins[i].mtime = plugins[i].mtimeNsec = -1;
+    }
+
+    if (dir) closedir(dir);
+    free(seen);
+
+    return changed;
+}
+
+// A descriptor that becomes readable when the plugin directory changes, -1 when
+// it can't be watched and ReloadPlugins has to be called to find out
+int WatchPlugins() {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+
+    // NOTE: close-write catches copies, moved-to catches installs renamed into place
+    u32 mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+    if (inotify_add_watch(fd, GetPluginDir(), mask) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+// Consumes the pending events of WatchPlugins' descriptor
+void DrainPluginWatch(int fd) {
+    char buffer[4096];
+    while (read(fd, &buffer[0], sizeof(buffer)) > 0) {}
+}
@@ -4,17 +4,38 @@
 #include <stddef.h>
 #include<stdbool.h>
 
+// NOTE: bump whenever anything in this header changes, and the minimum with it
+// when the change requires plugins to be rebuilt
+#define VOLV_PLUGINS_VERSION 2
+#define VOLV_PLUGINS_MIN_VERSION 1
+
 extern bool FlagHelp;
 extern bool FlagVerbose;
 extern bool FlagVersion;
 extern bool FlagYes;
 
+enum VolFormat {
+    VolFormat_Table,
+    VolFormat_Json,
+    VolFormat_Ndjson,
+    VolFormat_Tsv,
+};
+
+extern int FlagFormat;
+
 extern const char *CommandName;
 
 enum CLIFlagKind {
     CLIFlagKind_Bool,
     CLIFlagKind_String,
     CLIFlagKind_Enum,
+    // NOTE: can be repeated, every value is appended to the list
+    CLIFlagKind_List,
+};
+
+struct CLIFlagList {
+    const char **values;
+    int count;
 };
 
 struct CLIFlag {
@@ -30,6 +51,7 @@ struct CLIFlag {
         int *i;
         bool *b;
         const char **s;
+        struct CLIFlagList *l;
     } ptr;
 };
 
@@ -52,4 +74,218 @@ VOLV_API void PrintFlags(CommandId commandId);
 
 VOLV_API const char *GetCCompiler();
 VOLV_API int UserConfirmation(const char *message);
+
+// Settings from `~/.volva/config`, NULL when `key` isn't set in `section`.
+// Plugins can keep their settings in a section named after them.
+VOLV_API const char *VolConfigGet(const char *section, const char *key);
+
+// Jobs, run on the host's shared worker pool
+typedef struct VolJob VolJob;
+typedef void VolJobFunc(void *data);
+typedef void VolParallelForFunc(size_t index, void *data);
+
+VOLV_API int VolWorkerCount();
+// Every submitted job has to be waited on exactly once, which also frees it
+VOLV_API VolJob *VolSubmit(VolJobFunc *func, void *data);
+VOLV_API void VolWait(VolJob *job);
+// Calls `func` for every index in [0, count) and returns when all are done
+VOLV_API void VolParallelFor(size_t count, VolParallelForFunc *func, void *data);
+
+// JSON, tokens are indices into the document. The root is token 0
+typedef struct VolJson VolJson;
+
+enum VolJsonType {
+    VolJson_Undefined,
+    VolJson_Object,
+    VolJson_Array,
+    VolJson_String,
+    VolJson_Primitive,
+};
+
+struct VolJsonString {
+    const char *data;
+    size_t len;
+};
+
+// `json` is not copied and has to outlive the document. Returns NULL on error
+VOLV_API VolJson *VolJsonParse(const char *json, size_t len);
+VOLV_API void VolJsonFree(VolJson *doc);
+VOLV_API int VolJsonType(VolJson *doc, int token);
+// Number of keys or elements, 0 for anything else
+VOLV_API int VolJsonSize(VolJson *doc, int token);
+// Return the value's token or -1
+VOLV_API int VolJsonGet(VolJson *doc, int object, const char *key);
+VOLV_API int VolJsonIndex(VolJson *doc, int array, int index);
+// The token after `token` and its children, to walk siblings: `for (t = array+1, i = 0; i < size; i++, t = VolJsonNext(doc, t))`
+VOLV_API int VolJsonNext(VolJson *doc, int token);
+// Matches paths such as `[*].key` or `.data[0].name`, returns the number of tokens written to `out`
+VOLV_API int VolJsonQuery(VolJson *doc, int token, const char *path, int *out, int max);
+// The token's source text, escapes included
+VOLV_API struct VolJsonString VolJsonRaw(VolJson *doc, int token);
+// Unescaped on first use, not NUL terminated
+VOLV_API struct VolJsonString VolJsonStr(VolJson *doc, int token);
+VOLV_API const char *VolJsonCStr(VolJson *doc, int token);
+
+// HTTP, shares connections and the Vapor Cloud token with the host
+struct VolHttpResponse {
+    int status;
+    // NOTE: 0 on success
+    int error;
+    const char *body;
+    size_t len;
+};
+
+typedef void VolHttpCallback(const struct VolHttpResponse *response, void *userData);
+
+// Adds the Vapor Cloud bearer token, refreshing it once on a 401
+#define VOL_HTTP_VAPOR_AUTH 0x1
+// Traces the request, pass it when the command's `verbose` flag is set
+#define VOL_HTTP_VERBOSE 0x2
+
+// `url` may be a path relative to the Vapor Cloud API (`/application/...`).
+// `callback` runs on a worker thread, the response is only valid during it
+VOLV_API VolJob *VolHttpRequest(const char *method, const char *url, const char *body, size_t bodyLen, int flags, VolHttpCallback *callback, void *userData);
+
+// Child processes, spawned with posix_spawn
+typedef struct VolProcess VolProcess;
+typedef struct VolProcessPool VolProcessPool;
+
+enum VolStream {
+    VolStream_Stdout = 1,
+    VolStream_Stderr = 2,
+};
+
+#define VOL_CAPTURE_STDOUT 0x1
+#define VOL_CAPTURE_STDERR 0x2
+
+// `argv` is NULL terminated, argv[0] is looked up in $PATH
+VOLV_API VolProcess *VolSpawn(const char **argv, int flags);
+// Waits for the process to exit, reading any captured output. Returns its exit status
+VOLV_API int VolProcessWait(VolProcess *process);
+VOLV_API const char *VolProcessOutput(VolProcess *process, int stream, size_t *len);
+VOLV_API void VolProcessFree(VolProcess *process);
+// Spawns and waits for `argv` without capturing anything
+VOLV_API int VolRun(const char **argv);
+
+// Runs at most `maxJobs` (0 = one per core) children at once, spawning blocks while full
+VOLV_API VolProcessPool *VolProcessPoolCreate(int maxJobs);
+VOLV_API VolProcess *VolProcessPoolSpawn(VolProcessPool *pool, const char **argv, int flags);
+// Waits for every child. Returns the first non-zero exit status
+VOLV_API int VolProcessPoolWait(VolProcessPool *pool);
+VOLV_API void VolProcessPoolFree(VolProcessPool *pool);
+
+// Contexts, since version 2. One invocation of a command: the flags it was
+// given, memory that lives as long as it and where its output goes. Commands
+// registered with RegisterContextCommand read those from their context instead
+// of the globals above, so several can run at once on different threads.
+typedef struct VolContext VolContext;
+typedef int PluginContextRunFunc(VolContext *ctx, const char **args, size_t count);
+
+VOLV_API CommandId RegisterContextCommand(const char *name, const char *helpText, PluginContextRunFunc *func);
+VOLV_API const char *VolCommandName(VolContext *ctx);
+// The value of the flag called `name` (or its alias) in this invocation.
+// Unknown flags are false, 0, NULL and empty
+VOLV_API bool VolFlagBool(VolContext *ctx, const char *name);
+VOLV_API int VolFlagEnum(VolContext *ctx, const char *name);
+VOLV_API const char *VolFlagString(VolContext *ctx, const char *name);
+VOLV_API struct CLIFlagList VolFlagList(VolContext *ctx, const char *name);
+// Freed when the command returns
+VOLV_API void *VolAlloc(VolContext *ctx, size_t size);
+// Buffered, written out when the buffer fills up and when the command returns
+VOLV_API void VolWrite(VolContext *ctx, const char *data, size_t len);
+VOLV_API void VolPrintf(VolContext *ctx, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// UserConfirmation, answered by the invocation's -yes
+VOLV_API int VolConfirm(VolContext *ctx, const char *message);
+
+// Everything above as one table the host hands to the plugin's init function,
+// so a plugin can be built with -fvisibility=hidden and -Bsymbolic and doesn't
+// resolve any host symbol. Members are only ever added at the end, check for
+// newer ones with VOL_HOST_HAS before calling them.
+typedef struct VolHostApi {
+    int version;
+    size_t size;
+
+    const bool *flagHelp;
+    const bool *flagVerbose;
+    const bool *flagVersion;
+    const bool *flagYes;
+    const int *flagFormat;
+    const char *const *commandName;
+
+    void (*VolLog)(const char *msg);
+    CommandId (*RegisterCommand)(const char *name, const char *helpText, PluginRunFunc *func);
+    void (*RegisterHelper)(CommandId commandId, PluginHelperFunc *helper);
+    void (*RegisterFlag)(CommandId id, struct CLIFlag flag);
+    void (*PrintFlags)(CommandId commandId);
+    const char *(*GetCCompiler)();
+    int (*UserConfirmation)(const char *message);
+    const char *(*VolConfigGet)(const char *section, const char *key);
+
+    int (*VolWorkerCount)();
+    VolJob *(*VolSubmit)(VolJobFunc *func, void *data);
+    void (*VolWait)(VolJob *job);
+    void (*VolParallelFor)(size_t count, VolParallelForFunc *func, void *data);
+
+    VolJson *(*VolJsonParse)(const char *json, size_t len);
+    void (*VolJsonFree)(VolJson *doc);
+    int (*VolJsonType)(VolJson *doc, int token);
+    int (*VolJsonSize)(VolJson *doc, int token);
+    int (*VolJsonGet)(VolJson *doc, int object, const char *key);
+    int (*VolJsonIndex)(VolJson *doc, int array, int index);
+    int (*VolJsonNext)(VolJson *doc, int token);
+    int (*VolJsonQuery)(VolJson *doc, int token, const char *path, int *out, int max);
+    struct VolJsonString (*VolJsonRaw)(VolJson *doc, int token);
+    struct VolJsonString (*VolJsonStr)(VolJson *doc, int token);
+    const char *(*VolJsonCStr)(VolJson *doc, int token);
+
+    VolJob *(*VolHttpRequest)(const char *method, const char *url, const char *body, size_t bodyLen, int flags, VolHttpCallback *callback, void *userData);
+
+    VolProcess *(*VolSpawn)(const char **argv, int flags);
+    int (*VolProcessWait)(VolProcess *process);
+    const char *(*VolProcessOutput)(VolProcess *process, int stream, size_t *len);
+    void (*VolProcessFree)(VolProcess *process);
+    int (*VolRun)(const char **argv);
+    VolProcessPool *(*VolProcessPoolCreate)(int maxJobs);
+    VolProcess *(*VolProcessPoolSpawn)(VolProcessPool *pool, const char **argv, int flags);
+    int (*VolProcessPoolWait)(VolProcessPool *pool);
+    void (*VolProcessPoolFree)(VolProcessPool *pool);
+
+    CommandId (*RegisterContextCommand)(const char *name, const char *helpText, PluginContextRunFunc *func);
+    const char *(*VolCommandName)(VolContext *ctx);
+    bool (*VolFlagBool)(VolContext *ctx, const char *name);
+    int (*VolFlagEnum)(VolContext *ctx, const char *name);
+    const char *(*VolFlagString)(VolContext *ctx, const char *name);
+    struct CLIFlagList (*VolFlagList)(VolContext *ctx, const char *name);
+    void *(*VolAlloc)(VolContext *ctx, size_t size);
+    void (*VolWrite)(VolContext *ctx, const char *data, size_t len);
+    void (*VolPrintf)(VolContext *ctx, const char *fmt, ...);
+    int (*VolConfirm)(VolContext *ctx, const char *message);
+} VolHostApi;
+
+#define VOL_HOST_HAS(api, member) ((api)->size >= offsetof(VolHostApi, member) + sizeof((api)->member))
+
+// Capabilities a plugin declares in its descriptor
+// NOTE: keeps threads or other state that can't survive dlclose, a changed
+// plugin is only picked up by a new process
+#define VOL_PLUGIN_NO_UNLOAD 0x1
+// NOTE: always loaded into the host, even when the config sandboxes plugins
+#define VOL_PLUGIN_NO_SANDBOX 0x2
+
+typedef int VolPluginInitFunc(const VolHostApi *api);
+
+typedef struct VolPluginDescriptor {
+    int version;
+    // NOTE: sizeof(VolHostApi) when the plugin was built, a host with a smaller
+    // table is too old for it
+    size_t apiSize;
+    unsigned capabilities;
+    VolPluginInitFunc *init;
+} VolPluginDescriptor;
+
+// Declares the plugin, the one symbol it has to export. Plugins without it are
+// initialised through PluginInit and the weak symbols above.
+#define VOL_PLUGIN(init, capabilities) \
+    __attribute__((visibility("default"))) const VolPluginDescriptor VolPlugin = { \
+        VOLV_PLUGINS_VERSION, sizeof(VolHostApi), (capabilities), (init) \
+    }
 #endif
@@ -0,0 +1,321 @@
+// Child process runner built on posix_spawn. Unlike fork it never copies the
+// parent's page tables, so spawning stays cheap no matter how large the heap
+// is. Output can be captured through pipes and several children can run at
+// once through a bounded pool.
+
+#include <spawn.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+extern char **environ;
+
+struct VolProcess {
+    pid_t pid;
+    int status;
+    b32 exited;
+
+    // NOTE: indexed by VolStream, -1 when not captured or closed
+    int fds[3];
+    char *output[3];
+    size_t len[3];
+    size_t cap[3];
+};
+
+struct VolProcessPool {
+    u32 maxJobs;
+    u32 running;
+
+    VolProcess **processes;
+    u32 count;
+    u32 cap;
+};
+
+// NOTE: both ends close on exec, otherwise a child spawned from another thread
+// in the meantime keeps the write end open and the reader never sees EOF. The
+// dup2 in our own child clears the flag on its copy.
+static b32 processPipe(int fds[2]) {
+#ifdef __linux__
+    return syscall(SYS_pipe2, fds, O_CLOEXEC) == 0;
+#else
+    if (pipe(fds) != 0) return false;
+
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+#endif
+}
+
+VolProcess *VolSpawn(const char **argv, int flags) {
+    VolProcess *process = calloc(1, sizeof(VolProcess));
+    process->fds[0] = process->fds[1] = process->fds[2] = -1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    int pipes[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+
+    for (int stream = VolStream_Stdout; stream <= VolStream_Stderr; stream += 1) {
+        int flag = stream == VolStream_Stdout ? VOL_CAPTURE_STDOUT : VOL_CAPTURE_STDERR;
+        if (!(flags & flag)) continue;
+
+        if (!processPipe(pipes[stream])) {
+            fprintf(stderr, "ERROR: Unable to create pipe for %s\n", argv[0]);
+            continue;
+        }
+
+        posix_spawn_file_actions_adddup2(&actions, pipes[stream][1], stream);
+        posix_spawn_file_actions_addclose(&actions, pipes[stream][0]);
+        posix_spawn_file_actions_addclose(&actions, pipes[stream][1]);
+    }
+
+    int err = posix_spawnp(&process->pid, argv[0], &actions, NULL, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    for (int stream = VolStream_Stdout; stream <= VolStream_Stderr; stream += 1) {
+        if (pipes[stream][1] == -1) continue;
+
+        close(pipes[stream][1]);
+        if (err) {
+            close(pipes[stream][0]);
+        } else {
+            process->fds[stream] = pipes[stream][0];
+        }
+    }
+
+    if (err) {
+        if (FlagVerbose)
+            printf("Unable to run %s: %s\n", argv[0], strerror(err));
+
+        // NOTE: matches the shell's status for a command that can't be found
+        process->exited = true;
+        process->status = 127;
+    }
+
+    return process;
+}
+
+// Reads whatever is available on `fd` into the process' buffer. Returns false
+// once the pipe is closed.
+static b32 processDrain(VolProcess *process, int stream) {
+    if (process->cap[stream] - process->len[stream] < 4096) {
+        process->cap[stream] = process->cap[stream] ? process->cap[stream] * 2 : 16*1024;
+        process->output[stream] = realloc(process->output[stream], process->cap[stream]);
+    }
+
+    ssize_t count = read(
+        process->fds[stream],
+        process->output[stream] + process->len[stream],
+        process->cap[stream] - process->len[stream] - 1
+    );
+
+    if (count < 0 && errno == EINTR)
+        return true;
+
+    if (count <= 0) {
+        close(process->fds[stream]);
+        process->fds[stream] = -1;
+        return false;
+    }
+
+    process->len[stream] += count;
+    process->output[stream][process->len[stream]] = '\0';
+    return true;
+}
+
+static b32 processReap(VolProcess *process, b32 block) {
+    if (process->exited) return true;
+
+    int status;
+    pid_t ret;
+    while ((ret = waitpid(process->pid, &status, block ? 0 : WNOHANG)) == -1) {
+        if (errno != EINTR) {
+            process->exited = true;
+            process->status = 1;
+            return true;
+        }
+    }
+
+    if (ret == 0) return false;
+
+    process->exited = true;
+    process->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return true;
+}
+
+// Services the pipes of every process until at least one of them exits.
+// Returns the index of a finished process.
+static u32 processPump(VolProcess **processes, u32 count) {
+    struct pollfd fds[128];
+    VolProcess *owners[128];
+    int streams[128];
+
+    for (;;) {
+        u32 fdCount = 0;
+        b32 hasUnpiped = false;
+
+        for (u32 i = 0; i < count; i += 1) {
+            VolProcess *process = processes[i];
+
+            b32 hasPipes = false;
+            for (int stream = VolStream_Stdout; stream <= VolStream_Stderr; stream += 1) {
+                if (process->fds[stream] == -1) continue;
+                hasPipes = true;
+
+                if (fdCount < 128) {
+                    fds[fdCount] = (struct pollfd){ process->fds[stream], POLLIN, 0 };
+                    owners[fdCount] = process;
+                    streams[fdCount] = stream;
+                    fdCount++;
+                }
+            }
+
+            // NOTE: output must be fully read before a process counts as done
+            // or whatever it wrote last would be lost
+            if (!hasPipes) {
+                if (processReap(process, false))
+                    return i;
+                hasUnpiped = true;
+            }
+        }
+
+        if (!fdCount) {
+            if (count == 1) {
+                processReap(processes[0], true);
+                return 0;
+            }
+
+            // NOTE: nothing to read, sleep until some child changes state. The
+            // child isn't reaped here so if it isn't one of ours back off
+            // instead of spinning on it
+            siginfo_t info = {0};
+            waitid(P_ALL, 0, &info, WEXITED | WNOWAIT);
+
+            b32 ours = false;
+            for (u32 i = 0; i < count; i += 1)
+                ours |= processes[i]->pid == info.si_pid;
+
+            if (!ours) usleep(1000);
+            continue;
+        }
+
+        if (poll(&fds[0], fdCount, hasUnpiped ? 10 : -1) < 0 && errno != EINTR)
+            return 0;
+
+        for (u32 i = 0; i < fdCount; i += 1) {
+            if (fds[i].revents)
+                processDrain(owners[i], streams[i]);
+        }
+    }
+}
+
+int VolProcessWait(VolProcess *process) {
+    processPump(&process, 1);
+    return process->status;
+}
+
+const char *VolProcessOutput(VolProcess *process, int stream, size_t *len) {
+    if (stream != VolStream_Stdout && stream != VolStream_Stderr) return NULL;
+
+    if (len) *len = process->len[stream];
+    return process->output[stream] ?: "";
+}
+
+void VolProcessFree(VolProcess *process) {
+    if (!process) return;
+
+    for (int stream = VolStream_Stdout; stream <= VolStream_Stderr; stream += 1) {
+        if (process->fds[stream] != -1) close(process->fds[stream]);
+        free(process->output[stream]);
+    }
+
+    if (!process->exited) processReap(process, true);
+    free(process);
+}
+
+int VolRun(const char **argv) {
+    VolProcess *process = VolSpawn(argv, 0);
+    int status = VolProcessWait(process);
+    VolProcessFree(process);
+    return status;
+}
+
+// How many children run at once unless asked otherwise, `[jobs] processes` or one per core
+u32 ProcessLimit() {
+    i64 limit = ConfigInt("jobs", "processes", 0);
+
+    if (limit <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        limit = cpus > 0 ? cpus : 1;
+    }
+
+    return limit;
+}
+
+VolProcessPool *VolProcessPoolCreate(int maxJobs) {
+    if (maxJobs <= 0)
+        maxJobs = ProcessLimit();
+
+    VolProcessPool *pool = calloc(1, sizeof(VolProcessPool));
+    pool->maxJobs = maxJobs;
+    return pool;
+}
+
+static void processPoolWaitOne(VolProcessPool *pool) {
+    VolProcess *running[128];
+    u32 count = 0;
+
+    for (u32 i = 0; i < pool->count && count < 128; i += 1) {
+        if (!pool->processes[i]->exited || pool->processes[i]->fds[VolStream_Stdout] != -1 || pool->processes[i]->fds[VolStream_Stderr] != -1)
+            running[count++] = pool->processes[i];
+    }
+
+    if (!count) {
+        pool->running = 0;
+        return;
+    }
+
+    processPump(&running[0], count);
+    pool->running--;
+}
+
+VolProcess *VolProcessPoolSpawn(VolProcessPool *pool, const char **argv, int flags) {
+    while (pool->running >= pool->maxJobs)
+        processPoolWaitOne(pool);
+
+    if (pool->count >= pool->cap) {
+        pool->cap = pool->cap ? pool->cap * 2 : 16;
+        pool->processes = realloc(pool->processes, pool->cap * sizeof(VolProcess *));
+    }
+
+    VolProcess *process = VolSpawn(argv, flags);
+    pool->processes[pool->count++] = process;
+    if (!process->exited) pool->running++;
+
+    return process;
+}
+
+int VolProcessPoolWait(VolProcessPool *pool) {
+    while (pool->running)
+        processPoolWaitOne(pool);
+
+    for (u32 i = 0; i < pool->count; i += 1) {
+        if (pool->processes[i]->status)
+            return pool->processes[i]->status;
+    }
+
+    return 0;
+}
+
+void VolProcessPoolFree(VolProcessPool *pool) {
+    if (!pool) return;
+
+    VolProcessPoolWait(pool);
+
+    for (u32 i = 0; i < pool->count; i += 1)
+        VolProcessFree(pool->processes[i]);
+
+    free(pool->processes);
+    free(pool);
+}
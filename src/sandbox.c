@@ -0,0 +1,763 @@
+// Sandboxed plugins run in a worker process of their own, forked from the host
+// when the plugin is loaded. The worker opens the plugin, runs PluginInit and
+// reports what it registered, the host registers stand-ins that forward to it.
+// A call hands the caller's standard streams over the worker's socket while
+// the arguments and flag values go through memory shared with the worker. A
+// plugin that crashes only fails its own call, the next call forks a new worker.
+//
+// NOTE: the worker is a copy of the host, host APIs such as VolLog, the HTTP
+// functions or UserConfirmation run in it directly on the caller's streams
+
+#include <signal.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SANDBOX_SHARED_SIZE (1 << 20)
+#define SANDBOX_NULL UINT32_MAX
+
+enum SandboxCall {
+    SandboxCall_Run,
+    SandboxCall_Help
+};
+
+// Reads and writes the shared memory. Reads are checked against its size, the
+// worker is not trusted to stay inside it.
+struct SandboxBuffer {
+    char *data;
+    u32 offset;
+    b32 failed;
+};
+
+static void sandboxPutU32(struct SandboxBuffer *buffer, u32 value) {
+    if (buffer->failed || buffer->offset + sizeof(u32) > SANDBOX_SHARED_SIZE) {
+        buffer->failed = true;
+        return;
+    }
+
+    memcpy(buffer->data + buffer->offset, &value, sizeof(u32));
+    buffer->offset += sizeof(u32);
+}
+
+static void sandboxPutString(struct SandboxBuffer *buffer, const char *str) {
+    if (!str) {
+        sandboxPutU32(buffer, SANDBOX_NULL);
+        return;
+    }
+
+    u32 len = strlen(str);
+    sandboxPutU32(buffer, len);
+
+    if (buffer->failed || (u64)buffer->offset + len + 1 > SANDBOX_SHARED_SIZE) {
+        buffer->failed = true;
+        return;
+    }
+
+    memcpy(buffer->data + buffer->offset, str, len + 1);
+    buffer->offset += len + 1;
+}
+
+static u32 sandboxGetU32(struct SandboxBuffer *buffer) {
+    if (buffer->failed || buffer->offset + sizeof(u32) > SANDBOX_SHARED_SIZE) {
+        buffer->failed = true;
+        return 0;
+    }
+
+    u32 value;
+    memcpy(&value, buffer->data + buffer->offset, sizeof(u32));
+    buffer->offset += sizeof(u32);
+    return value;
+}
+
+// NOTE: points into the shared memory, copy it to keep it past the call
+static const char *sandboxGetString(struct SandboxBuffer *buffer, u32 *outLen) {
+    u32 len = sandboxGetU32(buffer);
+    if (buffer->failed || len == SANDBOX_NULL) return NULL;
+
+    if ((u64)buffer->offset + len + 1 > SANDBOX_SHARED_SIZE) {
+        buffer->failed = true;
+        return NULL;
+    }
+
+    const char *str = buffer->data + buffer->offset;
+    buffer->offset += len + 1;
+
+    if (outLen) *outLen = len;
+    return str;
+}
+
+static char *sandboxCopyString(struct SandboxBuffer *buffer) {
+    u32 len;
+    const char *str = sandboxGetString(buffer, &len);
+    return str ? strndup(str, len) : NULL;
+}
+
+struct SandboxCommand {
+    char *name;
+    i32 workerId;
+    CommandId id;
+};
+
+struct SandboxWorker {
+    i32 plugin;
+    char *name;
+    char *path;
+
+    pid_t pid;
+    int sock;
+    char *shared;
+    u32 capabilities;
+
+    struct SandboxCommand *commands;
+    u32 commandCount;
+
+    // NOTE: the host's copies of the plugin's flags, with strings it owns
+    union FlagValue *flagValues;
+    char **strings;
+    u32 stringCount;
+};
+
+static struct SandboxWorker **sandboxWorkers;
+static u32 sandboxWorkerCount;
+
+// NOTE: defined with the rest of the plugin loading in plugins.c
+void RemovePluginCommands(i32 plugin);
+b32 InitPlugin(void *handle, i32 index, const char *name, u32 *capabilities);
+int PluginOpenFlags();
+
+static b32 sandboxSend(int sock) {
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), (int[]){ STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO }, 3 * sizeof(int));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static b32 sandboxReceive(int sock, int *fds) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control.data);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, 0);
+    } while (received < 0 && errno == EINTR);
+
+    if (received != 1) return false;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return false;
+
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    return true;
+}
+
+static b32 sandboxWaitReply(int sock) {
+    char byte;
+    ssize_t received;
+    do {
+        received = read(sock, &byte, 1);
+    } while (received < 0 && errno == EINTR);
+
+    return received == 1;
+}
+
+static void sandboxPutFlagValue(struct SandboxBuffer *buffer, struct CLIFlag *flag) {
+    switch (flag->kind) {
+        case CLIFlagKind_Bool:   sandboxPutU32(buffer, *flag->ptr.b); break;
+        case CLIFlagKind_Enum:   sandboxPutU32(buffer, *flag->ptr.i); break;
+        case CLIFlagKind_String: sandboxPutString(buffer, *flag->ptr.s); break;
+        case CLIFlagKind_List:
+            sandboxPutU32(buffer, flag->ptr.l->count);
+            for (int k = 0; k < flag->ptr.l->count; k += 1)
+                sandboxPutString(buffer, flag->ptr.l->values[k]);
+            break;
+    }
+}
+
+// Everything `plugin` registered in this process, for the host to mirror
+static void sandboxWriteRegistrations(struct SandboxBuffer *buffer, i32 plugin) {
+    u32 count = 0;
+    for (size_t i = 0; i < commands.count; i += 1)
+        count += commands.names[i] && commands.plugins[i] == plugin;
+
+    sandboxPutU32(buffer, count);
+    for (size_t i = 0; i < commands.count; i += 1) {
+        if (!commands.names[i] || commands.plugins[i] != plugin) continue;
+
+        sandboxPutU32(buffer, i);
+        sandboxPutString(buffer, commands.names[i]);
+        sandboxPutString(buffer, commands.helpTexts[i]);
+        sandboxPutU32(buffer, commands.helpers[i] != NULL);
+    }
+
+    count = 0;
+    for (u32 i = 0; i < flagCount; i += 1)
+        count += flagPlugins[i] == plugin;
+
+    sandboxPutU32(buffer, count);
+    for (u32 i = 0; i < flagCount; i += 1) {
+        struct CLIFlag *flag = &flags[i];
+        if (flagPlugins[i] != plugin) continue;
+
+        sandboxPutU32(buffer, flag->kind);
+        sandboxPutU32(buffer, flag->commandId);
+        sandboxPutString(buffer, flag->name);
+        sandboxPutString(buffer, flag->alias);
+        sandboxPutString(buffer, flag->argumentName);
+        sandboxPutString(buffer, flag->help);
+
+        sandboxPutU32(buffer, flag->nOptions);
+        for (int k = 0; k < flag->nOptions; k += 1)
+            sandboxPutString(buffer, flag->options[k]);
+
+        // NOTE: the value after PluginInit is the flag's default
+        sandboxPutFlagValue(buffer, flag);
+    }
+}
+
+// The values of every flag, the worker parses none of its own
+static void sandboxWriteFlags(struct SandboxBuffer *buffer) {
+    sandboxPutU32(buffer, flagCount);
+
+    for (u32 i = 0; i < flagCount; i += 1) {
+        struct CLIFlag *flag = &flags[i];
+        sandboxPutString(buffer, flag->name);
+        sandboxPutU32(buffer, flag->kind);
+        sandboxPutFlagValue(buffer, flag);
+    }
+}
+
+static void sandboxReadFlags(struct SandboxBuffer *buffer) {
+    u32 count = sandboxGetU32(buffer);
+
+    for (u32 i = 0; i < count && !buffer->failed; i += 1) {
+        const char *name = sandboxGetString(buffer, NULL);
+        u32 kind = sandboxGetU32(buffer);
+
+        struct CLIFlag *flag = name ? FlagForName(name) : NULL;
+        b32 matches = flag && flag->kind == kind;
+
+        switch (kind) {
+            case CLIFlagKind_Bool: {
+                u32 value = sandboxGetU32(buffer);
+                if (matches) *flag->ptr.b = value;
+            } break;
+
+            case CLIFlagKind_Enum: {
+                u32 value = sandboxGetU32(buffer);
+                if (matches) *flag->ptr.i = value;
+            } break;
+
+            case CLIFlagKind_String: {
+                const char *value = sandboxGetString(buffer, NULL);
+                if (matches) *flag->ptr.s = value;
+            } break;
+
+            case CLIFlagKind_List: {
+                u32 values = sandboxGetU32(buffer);
+                if (matches) {
+                    free(flag->ptr.l->values);
+                    flag->ptr.l->values = calloc(values + 1, sizeof(const char *));
+                    flag->ptr.l->count = 0;
+                }
+
+                for (u32 k = 0; k < values && !buffer->failed; k += 1) {
+                    const char *value = sandboxGetString(buffer, NULL);
+                    if (matches) flag->ptr.l->values[flag->ptr.l->count++] = value;
+                }
+            } break;
+
+            default:
+                buffer->failed = true;
+        }
+    }
+}
+
+// NOTE: a worker holding on to a client's streams keeps its pipes open, the
+// streams only belong to the worker for the call it was handed them for
+static void sandboxReleaseStreams() {
+    int null = open("/dev/null", O_RDWR);
+    if (null < 0) return;
+
+    for (int i = 0; i < 3; i += 1)
+        dup2(null, i);
+
+    if (null > 2) close(null);
+}
+
+// Closes every descriptor the worker inherited from the host but `keep` and
+// the standard streams: sockets and pipes of `serve` and its clients stay open
+// as long as any process has them.
+static void sandboxCloseInherited(int keep) {
+    DIR *dir = opendir("/dev/fd");
+    if (!dir) return;
+
+    int *fds = NULL;
+    u32 count = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        int fd = atoi(entry->d_name);
+        if (fd > 2 && fd != keep && fd != dirfd(dir)) {
+            fds = realloc(fds, (count + 1) * sizeof(int));
+            fds[count++] = fd;
+        }
+    }
+
+    closedir(dir);
+
+    for (u32 i = 0; i < count; i += 1)
+        close(fds[i]);
+    free(fds);
+}
+
+static void sandboxWorkerMain(struct SandboxWorker *worker) {
+    // NOTE: stopping is up to the host, which closes the socket
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    struct SandboxBuffer buffer = { worker->shared };
+
+    // NOTE: a worker forked again has the host's stand-ins for this plugin, its
+    // own registrations take their place
+    RemovePluginCommands(worker->plugin);
+    RemovePluginFlags(worker->plugin);
+
+    void *handle = dlopen(worker->path, PluginOpenFlags());
+    if (!handle) {
+        fprintf(stderr, "ERROR: Unable to load plugin %s: %s\n", worker->name, dlerror());
+        _exit(1);
+    }
+
+    u32 capabilities;
+    if (!InitPlugin(handle, worker->plugin, worker->name, &capabilities))
+        _exit(1);
+
+    sandboxPutU32(&buffer, capabilities);
+    sandboxWriteRegistrations(&buffer, worker->plugin);
+    fflush(stdout);
+
+    fflush(stderr);
+    sandboxReleaseStreams();
+
+    char byte = 0;
+    if (write(worker->sock, &byte, 1) != 1) _exit(1);
+
+    int fds[3];
+    while (sandboxReceive(worker->sock, &fds[0])) {
+        for (int i = 0; i < 3; i += 1) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+
+        setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, BUFSIZ);
+
+        buffer = (struct SandboxBuffer){ worker->shared };
+        u32 call = sandboxGetU32(&buffer);
+        u32 id = sandboxGetU32(&buffer);
+        sandboxReadFlags(&buffer);
+
+        u32 argc = sandboxGetU32(&buffer);
+        const char **args = calloc(argc + 1, sizeof(const char *));
+        for (u32 i = 0; i < argc; i += 1)
+            args[i] = sandboxGetString(&buffer, NULL);
+
+        i32 status = 1;
+        if (!buffer.failed && id < commands.count && commands.names[id]) {
+            CommandName = commands.names[id];
+
+            PluginRunFunc *func = call == SandboxCall_Help ? commands.helpers[id] : commands.functions[id];
+            PluginContextRunFunc *contextFunc = call == SandboxCall_Help ? NULL : commands.contextFunctions[id];
+
+            if (contextFunc) {
+                // NOTE: the flags were just read into the variables, the context starts out with them
+                VolContext *ctx = ContextCreate(STDOUT_FILENO);
+                ctx->commandName = CommandName;
+                status = contextFunc(ctx, args, argc);
+                ContextFree(ctx);
+            } else if (func) {
+                status = func(args, argc);
+            }
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+        free(args);
+
+        sandboxReleaseStreams();
+
+        memcpy(worker->shared, &status, sizeof(status));
+        if (write(worker->sock, &byte, 1) != 1) break;
+    }
+
+    _exit(0);
+}
+
+static const char *sandboxKeepString(struct SandboxWorker *worker, char *str) {
+    if (!str) return NULL;
+
+    worker->strings = realloc(worker->strings, (worker->stringCount + 1) * sizeof(char *));
+    worker->strings[worker->stringCount++] = str;
+    return str;
+}
+
+static void sandboxReportExit(struct SandboxWorker *worker, const char *during) {
+    int status = 0;
+    waitpid(worker->pid, &status, 0);
+
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "ERROR: Plugin %s crashed %s: %s\n", worker->name, during, strsignal(WTERMSIG(status)));
+    } else {
+        fprintf(stderr, "ERROR: Plugin %s exited %s with status %d\n", worker->name, during, WEXITSTATUS(status));
+    }
+
+    close(worker->sock);
+    worker->sock = -1;
+    worker->pid = 0;
+}
+
+static int sandboxRun(const char **args, size_t count);
+static int sandboxHelp(const char **args, size_t count);
+
+// Mirrors the worker's commands and flags in the host, calls go to sandboxRun
+static void sandboxRegister(struct SandboxWorker *worker) {
+    struct SandboxBuffer buffer = { worker->shared };
+
+    sandboxGetU32(&buffer);
+    u32 count = sandboxGetU32(&buffer);
+    if (count > MAX_COMMAND_COUNT) return;
+
+    worker->commands = calloc(count + 1, sizeof(struct SandboxCommand));
+
+    loadingPlugin = worker->plugin;
+
+    for (u32 i = 0; i < count && !buffer.failed; i += 1) {
+        struct SandboxCommand *command = &worker->commands[worker->commandCount];
+        command->workerId = sandboxGetU32(&buffer);
+        command->name = sandboxCopyString(&buffer);
+        char *help = sandboxCopyString(&buffer);
+        b32 hasHelper = sandboxGetU32(&buffer);
+
+        if (buffer.failed || !command->name) {
+            free(command->name);
+            free(help);
+            break;
+        }
+
+        command->id = RegisterCommand(command->name, help ?: "", sandboxRun);
+        free(help);
+
+        if (command->id >= 0 && hasHelper)
+            RegisterHelper(command->id, sandboxHelp);
+
+        worker->commandCount++;
+    }
+
+    count = sandboxGetU32(&buffer);
+    if (count > 256) count = 0;
+
+    worker->flagValues = calloc(count + 1, sizeof(union FlagValue));
+
+    for (u32 i = 0; i < count && !buffer.failed; i += 1) {
+        struct CLIFlag flag = {0};
+        flag.kind = sandboxGetU32(&buffer);
+        i32 commandId = sandboxGetU32(&buffer);
+        flag.name = sandboxKeepString(worker, sandboxCopyString(&buffer));
+        flag.alias = sandboxKeepString(worker, sandboxCopyString(&buffer));
+        flag.argumentName = sandboxKeepString(worker, sandboxCopyString(&buffer));
+        flag.help = sandboxKeepString(worker, sandboxCopyString(&buffer));
+
+        u32 nOptions = sandboxGetU32(&buffer);
+        if (nOptions > 256) buffer.failed = true;
+
+        if (!buffer.failed && nOptions) {
+            char **options = calloc(nOptions, sizeof(char *));
+            sandboxKeepString(worker, (char *)options);
+
+            for (u32 k = 0; k < nOptions; k += 1)
+                options[k] = (char *)sandboxKeepString(worker, sandboxCopyString(&buffer) ?: strdup(""));
+
+            flag.options = (const char **)options;
+            flag.nOptions = nOptions;
+        }
+
+        if (buffer.failed || !flag.name || flag.kind > CLIFlagKind_List) break;
+
+        union FlagValue *value = &worker->flagValues[i];
+        switch (flag.kind) {
+            case CLIFlagKind_Bool:
+                flag.ptr.b = &value->b;
+                value->b = sandboxGetU32(&buffer);
+                break;
+
+            case CLIFlagKind_String:
+                flag.ptr.s = &value->s;
+                value->s = sandboxKeepString(worker, sandboxCopyString(&buffer));
+                break;
+
+            case CLIFlagKind_Enum:
+                flag.ptr.i = &value->i;
+                value->i = sandboxGetU32(&buffer);
+                if (value->i >= flag.nOptions) value->i = 0;
+                break;
+
+            case CLIFlagKind_List: {
+                flag.ptr.l = &value->l;
+
+                u32 values = sandboxGetU32(&buffer);
+                if (values > 256) buffer.failed = true;
+                value->l.values = values && !buffer.failed ? calloc(values, sizeof(const char *)) : NULL;
+
+                for (u32 k = 0; k < values && !buffer.failed; k += 1) {
+                    const char *str = sandboxKeepString(worker, sandboxCopyString(&buffer));
+                    if (str) value->l.values[value->l.count++] = str;
+                }
+            } break;
+        }
+
+        if (buffer.failed) break;
+
+        // NOTE: the worker's command ids mean nothing here
+        CommandId id = GlobalCommandId;
+        for (u32 k = 0; k < worker->commandCount; k += 1) {
+            if (worker->commands[k].workerId == commandId)
+                id = worker->commands[k].id;
+        }
+
+        RegisterFlag(id, flag);
+    }
+
+    loadingPlugin = -1;
+
+    if (buffer.failed)
+        fprintf(stderr, "WARNING: Plugin %s registered more than the sandbox could read\n", worker->name);
+}
+
+static b32 sandboxSpawn(struct SandboxWorker *worker) {
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, &socks[0]) != 0) {
+        fprintf(stderr, "ERROR: Unable to start a worker for %s: %s\n", worker->name, strerror(errno));
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: Unable to start a worker for %s: %s\n", worker->name, strerror(errno));
+        close(socks[0]);
+        close(socks[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        // NOTE: other workers notice the host exiting by their socket closing,
+        // which covers theirs along with everything else the host has open
+        sandboxCloseInherited(socks[1]);
+
+        worker->sock = socks[1];
+        sandboxWorkerMain(worker);
+    }
+
+    close(socks[1]);
+    fcntl(socks[0], F_SETFD, FD_CLOEXEC);
+
+    worker->pid = pid;
+    worker->sock = socks[0];
+
+    if (!sandboxWaitReply(worker->sock)) {
+        sandboxReportExit(worker, "while loading");
+        return false;
+    }
+
+    // NOTE: a new worker may hand out other ids for the same commands
+    struct SandboxBuffer buffer = { worker->shared };
+    worker->capabilities = sandboxGetU32(&buffer);
+    u32 count = sandboxGetU32(&buffer);
+
+    for (u32 i = 0; i < count && !buffer.failed; i += 1) {
+        u32 id = sandboxGetU32(&buffer);
+        const char *name = sandboxGetString(&buffer, NULL);
+        sandboxGetString(&buffer, NULL);
+        sandboxGetU32(&buffer);
+
+        for (u32 k = 0; name && k < worker->commandCount; k += 1) {
+            if (strcmp(worker->commands[k].name, name) == 0)
+                worker->commands[k].workerId = id;
+        }
+    }
+
+    return true;
+}
+
+// Stops the worker, the plugin's commands and flags have to be removed already
+void SandboxUnloadPlugin(struct SandboxWorker *worker) {
+    if (worker->pid) {
+        kill(worker->pid, SIGKILL);
+        waitpid(worker->pid, NULL, 0);
+        close(worker->sock);
+    }
+
+    for (u32 i = 0; i < sandboxWorkerCount; i += 1) {
+        if (sandboxWorkers[i] == worker) {
+            sandboxWorkers[i] = sandboxWorkers[--sandboxWorkerCount];
+            break;
+        }
+    }
+
+    for (u32 i = 0; i < worker->commandCount; i += 1)
+        free(worker->commands[i].name);
+    for (u32 i = 0; i < worker->stringCount; i += 1)
+        free(worker->strings[i]);
+
+    munmap(worker->shared, SANDBOX_SHARED_SIZE);
+    free(worker->commands);
+    free(worker->flagValues);
+    free(worker->strings);
+    free(worker->name);
+    free(worker->path);
+    free(worker);
+}
+
+// Starts a worker for the plugin at `path` and registers its commands and flags
+// as plugin `index`. NULL when the plugin didn't make it through PluginInit or
+// its capabilities say it has to be loaded into the host.
+struct SandboxWorker *SandboxLoadPlugin(i32 index, const char *name, const char *path, u32 *capabilities) {
+    struct SandboxWorker *worker = calloc(1, sizeof(struct SandboxWorker));
+    worker->plugin = index;
+    worker->name = strdup(name);
+    worker->path = strdup(path);
+    worker->sock = -1;
+
+    worker->shared = mmap(NULL, SANDBOX_SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (worker->shared == MAP_FAILED || !sandboxSpawn(worker)) {
+        if (worker->shared != MAP_FAILED) munmap(worker->shared, SANDBOX_SHARED_SIZE);
+        free(worker->name);
+        free(worker->path);
+        free(worker);
+        return NULL;
+    }
+
+    *capabilities = worker->capabilities;
+    if (worker->capabilities & VOL_PLUGIN_NO_SANDBOX) {
+        SandboxUnloadPlugin(worker);
+        return NULL;
+    }
+
+    sandboxRegister(worker);
+
+    sandboxWorkers = realloc(sandboxWorkers, (sandboxWorkerCount + 1) * sizeof(struct SandboxWorker *));
+    sandboxWorkers[sandboxWorkerCount++] = worker;
+
+    return worker;
+}
+
+// For a process forked from the host that goes on to run commands. The workers
+// and their shared memory belong to the parent, the child starts its own
+// workers when it first calls into them.
+void SandboxAfterFork() {
+    for (u32 i = 0; i < sandboxWorkerCount; i += 1) {
+        struct SandboxWorker *worker = sandboxWorkers[i];
+
+        if (worker->sock >= 0) close(worker->sock);
+        worker->sock = -1;
+        worker->pid = 0;
+
+        munmap(worker->shared, SANDBOX_SHARED_SIZE);
+        worker->shared = mmap(NULL, SANDBOX_SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
+}
+
+static int sandboxCall(enum SandboxCall call, const char **args, size_t count) {
+    struct SandboxWorker *worker = NULL;
+    struct SandboxCommand *command = NULL;
+
+    for (u32 i = 0; i < sandboxWorkerCount && !command; i += 1) {
+        for (u32 k = 0; k < sandboxWorkers[i]->commandCount; k += 1) {
+            if (strcmp(sandboxWorkers[i]->commands[k].name, CommandName) == 0) {
+                worker = sandboxWorkers[i];
+                command = &worker->commands[k];
+                break;
+            }
+        }
+    }
+
+    if (!command) return 1;
+
+    // NOTE: the worker that crashed last time is replaced on the next call
+    if (!worker->pid && !sandboxSpawn(worker))
+        return 1;
+
+    struct SandboxBuffer buffer = { worker->shared };
+    sandboxPutU32(&buffer, call);
+    sandboxPutU32(&buffer, command->workerId);
+    sandboxWriteFlags(&buffer);
+
+    sandboxPutU32(&buffer, count);
+    for (size_t i = 0; i < count; i += 1)
+        sandboxPutString(&buffer, args[i]);
+
+    if (buffer.failed) {
+        fprintf(stderr, "ERROR: The arguments for %s don't fit in the sandbox\n", CommandName);
+        return 1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if (!sandboxSend(worker->sock) || !sandboxWaitReply(worker->sock)) {
+        sandboxReportExit(worker, "while running");
+        return 1;
+    }
+
+    i32 status;
+    memcpy(&status, worker->shared, sizeof(status));
+    return status;
+}
+
+static int sandboxRun(const char **args, size_t count) {
+    return sandboxCall(SandboxCall_Run, args, count);
+}
+
+static int sandboxHelp(const char **args, size_t count) {
+    return sandboxCall(SandboxCall_Help, args, count);
+}
+
+// `[sandbox] <plugin> = true` sandboxes one plugin, `[plugins] sandbox = true`
+// every one that isn't turned off by name
+b32 SandboxWanted(const char *name) {
+    return ConfigBool("sandbox", name, ConfigBool("plugins", "sandbox", false));
+}
@@ -0,0 +1,524 @@
+// `volv serve`, a long lived process that keeps plugins loaded, the config
+// mapped and connections to the API open. Later invocations connect to its
+// socket and send their arguments, working directory, environment and standard
+// streams. The server runs the command on those streams and replies with the
+// exit status. Plugins that change on disk are loaded again between commands.
+//
+// Commands run one at a time, they share the flags and the other globals. A
+// client that is interrupted passes the signal on, the command can't be stopped
+// halfway through a process it shares so the server starts over instead.
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#else
+#include <stdio_ext.h>
+#endif
+
+extern char **environ;
+
+#define SERVE_MAGIC 0x766f6c77
+#define SERVE_MAX_REQUEST (1 << 20)
+
+struct ServeHeader {
+    u32 magic;
+    // NOTE: a server of another build runs commands differently, the client
+    // runs them itself instead
+    u32 pluginsVersion;
+    char version[32];
+
+    u32 argc;
+    u32 envc;
+    u32 len;
+};
+
+static volatile sig_atomic_t serveStopped;
+static volatile sig_atomic_t serveInterrupt;
+
+// NOTE: what this process was started with, the server starts over with it
+static const char **invocationArgv;
+
+static b32 serveAddress(struct sockaddr_un *addr) {
+    const char *home = getenv("HOME");
+    if (!home) return false;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    int written = snprintf(&addr->sun_path[0], sizeof(addr->sun_path), "%s/.volva/serve.sock", home);
+    return written > 0 && (size_t)written < sizeof(addr->sun_path);
+}
+
+static b32 serveReadAll(int fd, void *data, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        ssize_t count = read(fd, (char *)data + offset, len - offset);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        offset += count;
+    }
+
+    return true;
+}
+
+static void forwardInterrupt(int signal) {
+    serveInterrupt = signal;
+}
+
+// Reads the server's reply, passing on the signals this process gets meanwhile
+static b32 serveReadReply(int sock, i32 *reply) {
+    size_t offset = 0;
+    while (offset < sizeof(*reply)) {
+        ssize_t count = read(sock, (char *)reply + offset, sizeof(*reply) - offset);
+
+        if (count < 0 && errno == EINTR) {
+            i32 signal = serveInterrupt;
+            serveInterrupt = 0;
+            if (signal)
+                outputWriteAll(sock, (const char *)&signal, sizeof(signal));
+            continue;
+        }
+
+        if (count <= 0) return false;
+        offset += count;
+    }
+
+    return true;
+}
+
+// Hands the invocation to a running `volv serve`. Returns false when there is
+// none, the command then runs in this process.
+b32 ForwardToServer(i32 argc, const char **argv, i32 *status) {
+    invocationArgv = argv;
+
+    // NOTE: set in the server itself, so commands that run volv don't wait on it
+    if (getenv("VOLV_NO_SERVE")) return false;
+
+    struct sockaddr_un addr;
+    if (!serveAddress(&addr)) return false;
+
+    // NOTE: only streams that are open can be passed along
+    for (int fd = 0; fd < 3; fd += 1) {
+        if (fcntl(fd, F_GETFD) < 0) return false;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return false;
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return false;
+    }
+
+    char cwd[4096];
+    if (!getcwd(&cwd[0], sizeof(cwd))) {
+        close(sock);
+        return false;
+    }
+
+    u32 envc = 0;
+    while (environ[envc])
+        envc++;
+
+    size_t len = strlen(&cwd[0]) + 1;
+    for (i32 i = 0; i < argc; i += 1)
+        len += strlen(argv[i]) + 1;
+    for (u32 i = 0; i < envc; i += 1)
+        len += strlen(environ[i]) + 1;
+
+    if (len > SERVE_MAX_REQUEST) {
+        close(sock);
+        return false;
+    }
+
+    char *payload = malloc(len);
+    size_t offset = strlen(&cwd[0]) + 1;
+    memcpy(payload, &cwd[0], offset);
+
+    for (i32 i = 0; i < argc; i += 1) {
+        size_t argLen = strlen(argv[i]) + 1;
+        memcpy(payload + offset, argv[i], argLen);
+        offset += argLen;
+    }
+
+    for (u32 i = 0; i < envc; i += 1) {
+        size_t varLen = strlen(environ[i]) + 1;
+        memcpy(payload + offset, environ[i], varLen);
+        offset += varLen;
+    }
+
+    struct ServeHeader header = { SERVE_MAGIC, VOLV_PLUGINS_VERSION, VERSION, argc, envc, len };
+    struct iovec iov = { &header, sizeof(header) };
+
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), (int[]){ STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO }, 3 * sizeof(int));
+
+    if (sendmsg(sock, &msg, 0) != sizeof(header)) {
+        free(payload);
+        close(sock);
+        return false;
+    }
+
+    outputWriteAll(sock, payload, len);
+    free(payload);
+
+    struct sigaction action = {0}, previous[3];
+    action.sa_handler = forwardInterrupt;
+    sigaction(SIGINT, &action, &previous[0]);
+    sigaction(SIGTERM, &action, &previous[1]);
+    sigaction(SIGHUP, &action, &previous[2]);
+
+    // NOTE: the server accepts the command before it starts, a server that
+    // doesn't leaves it to this process
+    i32 accepted = 0;
+    b32 forwarded = serveReadReply(sock, &accepted) && accepted == SERVE_MAGIC;
+
+    // NOTE: from here on the command may have started, it can't run again locally
+    if (forwarded && !serveReadReply(sock, status)) {
+        fprintf(stderr, "ERROR: Lost the connection to `volv serve`\n");
+        *status = 1;
+    }
+
+    sigaction(SIGINT, &previous[0], NULL);
+    sigaction(SIGTERM, &previous[1], NULL);
+    sigaction(SIGHUP, &previous[2], NULL);
+
+    close(sock);
+
+    // NOTE: the command was stopped, this process goes the way it would have
+    if (forwarded && *status > 128 && *status < 128 + 32) {
+        signal(*status - 128, SIG_DFL);
+        raise(*status - 128);
+    }
+
+    return forwarded;
+}
+
+// Starts the server over once a client was interrupted, the command is
+// abandoned along with every other thread
+static void serveRestart(int *savedFds) {
+    for (int i = 0; i < 3; i += 1)
+        dup2(savedFds[i], i);
+
+    char path[4096];
+#ifdef __APPLE__
+    u32 size = sizeof(path);
+    b32 found = _NSGetExecutablePath(&path[0], &size) == 0;
+#else
+    ssize_t size = readlink("/proc/self/exe", &path[0], sizeof(path) - 1);
+    b32 found = size > 0;
+    if (found) path[size] = '\0';
+#endif
+
+    if (found && invocationArgv)
+        execv(&path[0], (char **)invocationArgv);
+
+    fprintf(stderr, "ERROR: Unable to restart `volv serve` after an interrupted command\n");
+    _exit(1);
+}
+
+struct ServeWatch {
+    int conn;
+    int done[2];
+    int *savedFds;
+    char **env;
+};
+
+// Waits for a signal from the client while its command runs
+static void *serveWatchClient(void *data) {
+    struct ServeWatch *watch = (struct ServeWatch *)data;
+
+    for (;;) {
+        struct pollfd pfds[2] = { { watch->conn, POLLIN, 0 }, { watch->done[0], POLLIN, 0 } };
+        if (poll(&pfds[0], 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+
+        if (pfds[1].revents) return NULL;
+
+        i32 signal;
+        if (read(watch->conn, &signal, sizeof(signal)) != sizeof(signal)) {
+            // NOTE: the client is gone, nobody is waiting for the command
+            return NULL;
+        }
+
+        i32 status = 128 + signal;
+        outputWriteAll(watch->conn, (const char *)&status, sizeof(status));
+
+        environ = watch->env;
+        serveRestart(watch->savedFds);
+    }
+}
+
+static void serveRun(int conn, int *savedFds) {
+    struct ServeHeader header;
+    struct iovec iov = { &header, sizeof(header) };
+
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control.data);
+
+    ssize_t received = recvmsg(conn, &msg, 0);
+
+    int fds[3] = { -1, -1, -1 };
+    struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+        memcpy(&fds[0], CMSG_DATA(cmsg), sizeof(fds));
+
+    char *payload = NULL;
+    const char **argv = NULL;
+
+    b32 valid = received == sizeof(header) && fds[0] >= 0 && header.magic == SERVE_MAGIC
+        && header.pluginsVersion == VOLV_PLUGINS_VERSION
+        && strncmp(&header.version[0], VERSION, sizeof(header.version)) == 0
+        && header.argc >= 1 && header.len <= SERVE_MAX_REQUEST;
+
+    if (valid) {
+        payload = malloc(header.len + 1);
+        valid = serveReadAll(conn, payload, header.len) && header.len && payload[header.len - 1] == '\0';
+    }
+
+    char **env = NULL;
+
+    if (valid) {
+        argv = calloc(header.argc + 1, sizeof(const char *));
+        // NOTE: room for VOLV_NO_SERVE
+        env = calloc(header.envc + 2, sizeof(char *));
+
+        // NOTE: the working directory comes first, then the arguments and the environment
+        char *c = payload + strlen(payload) + 1;
+        char *end = payload + header.len;
+        for (u32 i = 0; i < header.argc + header.envc; i += 1) {
+            if (c >= end) {
+                valid = false;
+                break;
+            }
+
+            if (i < header.argc)
+                argv[i] = c;
+            else
+                env[i - header.argc] = c;
+            c += strlen(c) + 1;
+        }
+    }
+
+    if (!valid) {
+        for (int i = 0; i < 3; i += 1)
+            if (fds[i] >= 0) close(fds[i]);
+        free(env);
+        free(argv);
+        free(payload);
+        return;
+    }
+
+    i32 accepted = SERVE_MAGIC;
+    outputWriteAll(conn, (const char *)&accepted, sizeof(accepted));
+
+    // NOTE: commands that run volv themselves must not wait on this server
+    env[header.envc] = "VOLV_NO_SERVE=1";
+
+    char **serverEnv = environ;
+    environ = env;
+
+    // NOTE: the compiler was found on the previous client's PATH
+    free(cCompiler);
+    cCompiler = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < 3; i += 1) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    // NOTE: a terminal wants its prompts as they are written, a pipe wants blocks
+    setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, BUFSIZ);
+
+    struct ServeWatch watch = { conn, { -1, -1 }, savedFds, serverEnv };
+    pthread_t watchThread;
+    b32 watching = pipe(&watch.done[0]) == 0 && pthread_create(&watchThread, NULL, serveWatchClient, &watch) == 0;
+
+    i32 status = 1;
+    if (chdir(payload) != 0) {
+        fprintf(stderr, "ERROR: Unable to change to %s\n", payload);
+    } else {
+        status = RunCommand(header.argc, argv);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if (watching) {
+        close(watch.done[1]);
+        pthread_join(watchThread, NULL);
+        close(watch.done[0]);
+    }
+
+    environ = serverEnv;
+    free(cCompiler);
+    cCompiler = NULL;
+
+    // NOTE: input the command buffered but didn't read belongs to this client
+    clearerr(stdin);
+#ifdef __APPLE__
+    fpurge(stdin);
+#else
+    __fpurge(stdin);
+#endif
+
+    for (int i = 0; i < 3; i += 1)
+        dup2(savedFds[i], i);
+
+    ResetFlags();
+
+    outputWriteAll(conn, (const char *)&status, sizeof(status));
+
+    free(env);
+    free(argv);
+    free(payload);
+}
+
+static void serveStop(int signal) {
+    serveStopped = true;
+}
+
+int ServeCommand(const char **args, size_t count) {
+    struct sockaddr_un addr;
+    if (!serveAddress(&addr)) {
+        fprintf(stderr, "ERROR: Unable to find a path for the socket\n");
+        return 1;
+    }
+
+    // NOTE: a socket nobody accepts on is left over from a server that died
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    b32 serving = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (probe >= 0) close(probe);
+
+    if (serving) {
+        fprintf(stderr, "ERROR: Already serving on %s\n", &addr.sun_path[0]);
+        return 1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        fprintf(stderr, "ERROR: Unable to create a socket: %s\n", strerror(errno));
+        return 1;
+    }
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+    unlink(&addr.sun_path[0]);
+
+    makeParentDirs(&addr.sun_path[0]);
+
+    mode_t mask = umask(0077);
+    b32 bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(mask);
+
+    if (!bound || listen(sock, 64) != 0) {
+        fprintf(stderr, "ERROR: Unable to listen on %s: %s\n", &addr.sun_path[0], strerror(errno));
+        close(sock);
+        return 1;
+    }
+
+    setenv("VOLV_NO_SERVE", "1", true);
+
+    // NOTE: every command sets up the terminal of the client that sent it
+    restoreTerminalState();
+
+    // NOTE: a client that goes away mid command must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction action = {0};
+    action.sa_handler = serveStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int savedFds[3];
+    for (int i = 0; i < 3; i += 1) {
+        savedFds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+
+        // NOTE: a client's streams must not stay open once its command is done
+        if (savedFds[i] < 0)
+            savedFds[i] = open("/dev/null", O_RDWR | O_CLOEXEC);
+    }
+
+    // NOTE: seconds without a command before the server exits, 0 keeps it running
+    i64 idle = ConfigInt("serve", "idle-timeout", 0);
+
+    printf("Serving on %s\n", &addr.sun_path[0]);
+    fflush(stdout);
+
+    // NOTE: requests parse their own command line, not the one that started the server
+    ResetFlags();
+
+    // NOTE: without a watch the plugin directory is checked before every command
+    int watch = WatchPlugins();
+
+    while (!serveStopped) {
+        struct pollfd pfds[2] = { { sock, POLLIN, 0 }, { watch, POLLIN, 0 } };
+        int ready = poll(&pfds[0], watch >= 0 ? 2 : 1, idle > 0 ? idle * 1000 : -1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) break;
+
+        if (watch >= 0 && pfds[1].revents) {
+            DrainPluginWatch(watch);
+
+            // NOTE: reloaded plugins come with new flags, their defaults are the current values
+            if (ReloadPlugins())
+                SaveFlagDefaults();
+            fflush(stdout);
+        }
+
+        if (!pfds[0].revents) continue;
+
+        if (watch < 0 && ReloadPlugins()) {
+            SaveFlagDefaults();
+            fflush(stdout);
+        }
+
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0) continue;
+
+        // NOTE: commands start processes of their own, they don't get the connection
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+        serveRun(conn, &savedFds[0]);
+        close(conn);
+    }
+
+    unlink(&addr.sun_path[0]);
+    close(sock);
+    if (watch >= 0) close(watch);
+
+    for (int i = 0; i < 3; i += 1)
+        close(savedFds[i]);
+
+    return PLUGIN_OK;
+}
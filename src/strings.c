@@ -1,37 +1,24 @@
-char escapeToChar[256] = {
-    ['\''] = '\'',
-    ['"'] = '"',
-    ['`'] = '`',
-    ['\\'] = '\\',
-    ['n'] = '\n',
-    ['r'] = '\r',
-    ['t'] = '\t',
-    ['v'] = '\v',
-    ['b'] = '\b',
-    ['a'] = '\a',
-    ['0'] = 0,
+// NOTE: the length of a UTF-8 sequence by its first byte
+static const u32 FIRST_LEN[] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1, 1, 1, 1, 1
 };
 
 u32 DecodeCodePoint(u32 *cpLen, const char *str) {
-    static const u32 FIRST_LEN[] = {
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-        2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
-        4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1, 1, 1, 1, 1
-    };
-
     static const u8 MASK[] = {
         0xFF, 0xFF, 0x1F, 0xF, 0x7
     };
@@ -49,37 +36,66 @@ u32 DecodeCodePoint(u32 *cpLen, const char *str) {
     return val;
 }
 
-const char *Unescape(const char *str) {
-    u32 len = 0;
-    b32 sawSlash = false;
+// Number of terminal columns the code point takes up. Only covers the ranges
+// that matter in practice: combining marks are 0, CJK and emoji are 2.
+u32 CodePointWidth(u32 cp) {
+    static const u32 zeroWidth[][2] = {
+        {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A},
+        {0x064B, 0x065F}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F},
+        {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+    };
 
-    for (size_t i=0; str[i] != '\0'; i += 1, len += 1) {
-        if (str[i] == '\\') {
-            sawSlash = true;
-        }
+    static const u32 doubleWidth[][2] = {
+        {0x1100, 0x115F}, {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF},
+        {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF},
+        {0xFE30, 0xFE4F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F300, 0x1F64F},
+        {0x1F900, 0x1F9FF}, {0x20000, 0x3FFFD},
+    };
+
+    if (cp < 0x300) return 1;
+
+    for (size_t i = 0; i < sizeof(zeroWidth)/sizeof(zeroWidth[0]); i += 1) {
+        if (cp >= zeroWidth[i][0] && cp <= zeroWidth[i][1])
+            return 0;
     }
 
-    if (!sawSlash)
-        return str;
+    if (cp < 0x1100) return 1;
 
-    char *newStr = calloc(len+1, sizeof(char));
-    u32 newLen = 0;
+    for (size_t i = 0; i < sizeof(doubleWidth)/sizeof(doubleWidth[0]); i += 1) {
+        if (cp >= doubleWidth[i][0] && cp <= doubleWidth[i][1])
+            return 2;
+    }
 
-    u32 i = 0;
-    while (i < len) {
-        u32 cpLen;
-        u32 cp = DecodeCodePoint(&cpLen, str+i);
-        if (cp == '\\') {
-            // FIXME(Brett): error handling
-            cp = escapeToChar[(u8)DecodeCodePoint(&cpLen, str+(i++))];
-            cpLen = 1;
-        }
+    return 1;
+}
+
+// Decodes the code point at `str`, never reading past `len`. Truncated
+// sequences are treated as a single byte.
+u32 DecodeCodePointN(u32 *cpLen, const char *str, size_t len) {
+    // NOTE: the length comes from the first byte alone, the rest is only read
+    // once it's known to be there
+    if (FIRST_LEN[(u8)str[0]] > len) {
+        *cpLen = 1;
+        return (u8)str[0];
+    }
+    return DecodeCodePoint(cpLen, str);
+}
+
+u32 DisplayWidth(const char *str, size_t len) {
+    u32 width = 0;
 
-        memcpy(newStr+newLen, str+i, cpLen);
+    for (size_t i = 0; i < len;) {
+        if ((u8)str[i] < 0x80) {
+            width++;
+            i++;
+            continue;
+        }
 
+        u32 cpLen;
+        u32 cp = DecodeCodePointN(&cpLen, str+i, len-i);
+        width += CodePointWidth(cp);
         i += cpLen;
-        newLen += cpLen;
     }
 
-    return newStr;
+    return width;
 }
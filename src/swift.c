@@ -0,0 +1,311 @@
+// Minimal streaming reader for `Package.swift`. It only understands enough of
+// Swift to skip comments and string literals and stops reading as soon as it
+// finds the `name:` argument of `Package(`.
+
+#define SWIFT_READ_CHUNK 4096
+
+struct SwiftReader {
+    int fd;
+    u32 pos;
+    u32 len;
+    b32 eof;
+    char buffer[SWIFT_READ_CHUNK];
+};
+
+// Makes sure at least `need` bytes past `pos` are buffered, unless the file
+// ends first. Returns the number of bytes available.
+static u32 swiftFill(struct SwiftReader *r, u32 need) {
+    if (r->len - r->pos >= need || r->eof)
+        return r->len - r->pos;
+
+    memmove(&r->buffer[0], &r->buffer[r->pos], r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+
+    while (r->len < need && !r->eof) {
+        ssize_t count = read(r->fd, &r->buffer[r->len], sizeof(r->buffer) - r->len);
+        if (count <= 0) {
+            r->eof = true;
+            break;
+        }
+        r->len += count;
+    }
+
+    return r->len - r->pos;
+}
+
+static int swiftPeek(struct SwiftReader *r, u32 offset) {
+    if (swiftFill(r, offset+1) <= offset)
+        return -1;
+    return (u8)r->buffer[r->pos + offset];
+}
+
+// Advances past the first occurrence of `ch`. Returns false on EOF.
+static b32 swiftSkipPast(struct SwiftReader *r, char ch) {
+    for (;;) {
+        u32 avail = swiftFill(r, 1);
+        if (!avail) return false;
+
+        char *found = memchr(&r->buffer[r->pos], ch, avail);
+        if (found) {
+            r->pos = (found - &r->buffer[0]) + 1;
+            return true;
+        }
+
+        r->pos = r->len;
+    }
+}
+
+static b32 swiftSkipBlockComment(struct SwiftReader *r) {
+    // NOTE: Swift block comments nest
+    u32 depth = 1;
+    r->pos += 2;
+
+    while (depth) {
+        int c = swiftPeek(r, 0);
+        if (c == -1) return false;
+
+        if (c == '*' && swiftPeek(r, 1) == '/') {
+            depth--;
+            r->pos += 2;
+        } else if (c == '/' && swiftPeek(r, 1) == '*') {
+            depth++;
+            r->pos += 2;
+        } else {
+            r->pos++;
+        }
+    }
+
+    return true;
+}
+
+static b32 swiftSkipString(struct SwiftReader *r) {
+    b32 multiline = swiftPeek(r, 1) == '"' && swiftPeek(r, 2) == '"';
+    r->pos += multiline ? 3 : 1;
+
+    for (;;) {
+        u32 avail = swiftFill(r, 3);
+        if (!avail) return false;
+
+        char *quote = memchr(&r->buffer[r->pos], '"', avail);
+        char *slash = memchr(&r->buffer[r->pos], '\\', quote ? quote - &r->buffer[r->pos] : avail);
+
+        if (slash) {
+            r->pos = slash - &r->buffer[0];
+            if (swiftPeek(r, 1) == -1) return false;
+            r->pos += 2;
+            continue;
+        }
+
+        if (!quote) {
+            r->pos = r->len;
+            continue;
+        }
+
+        r->pos = quote - &r->buffer[0];
+        if (!multiline) {
+            r->pos++;
+            return true;
+        }
+
+        if (swiftPeek(r, 1) == '"' && swiftPeek(r, 2) == '"') {
+            r->pos += 3;
+            return true;
+        }
+
+        r->pos++;
+    }
+}
+
+static b32 isSwiftIdent(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Skips whitespace and comments. Returns the next significant byte or -1.
+static int swiftSkipTrivia(struct SwiftReader *r) {
+    for (;;) {
+        int c = swiftPeek(r, 0);
+        switch (c) {
+            case ' ': case '\t': case '\r': case '\n':
+                r->pos++;
+                break;
+
+            case '/':
+                if (swiftPeek(r, 1) == '/') {
+                    if (!swiftSkipPast(r, '\n')) return -1;
+                } else if (swiftPeek(r, 1) == '*') {
+                    if (!swiftSkipBlockComment(r)) return -1;
+                } else {
+                    return c;
+                }
+                break;
+
+            default:
+                return c;
+        }
+    }
+}
+
+static b32 swiftMatchIdent(struct SwiftReader *r, const char *ident) {
+    u32 len = strlen(ident);
+    if (swiftFill(r, len+1) < len) return false;
+    if (memcmp(&r->buffer[r->pos], ident, len) != 0) return false;
+    if (isSwiftIdent(swiftPeek(r, len))) return false;
+
+    r->pos += len;
+    return true;
+}
+
+// Expects the reader to be just past `Package`
+static const char *swiftParsePackageName(struct SwiftReader *r) {
+    if (swiftSkipTrivia(r) != '(') return NULL;
+    r->pos++;
+
+    if (swiftSkipTrivia(r) != 'n' || !swiftMatchIdent(r, "name")) return NULL;
+    if (swiftSkipTrivia(r) != ':') return NULL;
+    r->pos++;
+
+    if (swiftSkipTrivia(r) != '"') return NULL;
+    r->pos++;
+
+    char name[256];
+    u32 len = 0;
+
+    for (;;) {
+        int c = swiftPeek(r, 0);
+        if (c == -1 || c == '\n' || c == '\\' || len + 1 >= sizeof(name)) return NULL;
+        r->pos++;
+        if (c == '"') break;
+        name[len++] = c;
+    }
+
+    return strndup(&name[0], len);
+}
+
+static const char *readSwiftPackageName(int fd) {
+    struct SwiftReader r;
+    r.fd = fd;
+    r.pos = r.len = 0;
+    r.eof = false;
+
+    int prev = 0;
+    for (;;) {
+        int c = swiftPeek(&r, 0);
+
+        switch (c) {
+            case -1:
+                return NULL;
+
+            case '/':
+                if (swiftPeek(&r, 1) == '/') {
+                    if (!swiftSkipPast(&r, '\n')) return NULL;
+                } else if (swiftPeek(&r, 1) == '*') {
+                    if (!swiftSkipBlockComment(&r)) return NULL;
+                } else {
+                    r.pos++;
+                }
+                c = ' ';
+                break;
+
+            case '"':
+                if (!swiftSkipString(&r)) return NULL;
+                break;
+
+            case 'P':
+                if (!isSwiftIdent(prev) && swiftMatchIdent(&r, "Package")) {
+                    const char *name = swiftParsePackageName(&r);
+                    if (name) return name;
+                    c = ' ';
+                    break;
+                }
+                r.pos++;
+                break;
+
+            default:
+                r.pos++;
+        }
+
+        prev = c;
+    }
+}
+
+// NOTE: keyed by the Package.swift file itself rather than its path, the server
+// changes directories between commands and the file can be edited meanwhile
+struct SwiftPackageNameKey {
+    u64 dev;
+    u64 ino;
+    i64 mtime;
+    i64 mtimeNsec;
+    u64 size;
+};
+
+struct SwiftPackageNameCache {
+    pthread_mutex_t mutex;
+    struct SwiftPackageNameKey keys[256];
+    const char *names[256];
+    u32 count;
+};
+
+static struct SwiftPackageNameCache swiftNameCache = { PTHREAD_MUTEX_INITIALIZER };
+
+// Returns the name declared in `Package.swift` inside the checkout open at
+// `checkoutFd`, or NULL. Results are memoized until the file changes.
+const char *GetSwiftPackageNameAt(int checkoutFd) {
+    int fd = openat(checkoutFd, "Package.swift", O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct SwiftPackageNameKey key = { st.st_dev, st.st_ino, st.st_mtime, 0, st.st_size };
+#ifdef __APPLE__
+    key.mtimeNsec = st.st_mtimespec.tv_nsec;
+#else
+    key.mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+
+    pthread_mutex_lock(&swiftNameCache.mutex);
+    for (u32 i = 0; i < swiftNameCache.count; i += 1) {
+        if (memcmp(&swiftNameCache.keys[i], &key, sizeof(key)) == 0) {
+            const char *name = swiftNameCache.names[i];
+            pthread_mutex_unlock(&swiftNameCache.mutex);
+            close(fd);
+            return name;
+        }
+    }
+    pthread_mutex_unlock(&swiftNameCache.mutex);
+
+    const char *name = readSwiftPackageName(fd);
+    close(fd);
+
+    pthread_mutex_lock(&swiftNameCache.mutex);
+    u32 index = swiftNameCache.count;
+    for (u32 i = 0; i < swiftNameCache.count; i += 1) {
+        // NOTE: an edited file replaces its old entry
+        if (swiftNameCache.keys[i].dev == key.dev && swiftNameCache.keys[i].ino == key.ino) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 256) {
+        if (index == swiftNameCache.count) swiftNameCache.count++;
+        swiftNameCache.keys[index] = key;
+        swiftNameCache.names[index] = name;
+    }
+    pthread_mutex_unlock(&swiftNameCache.mutex);
+
+    return name;
+}
+
+const char *GetSwiftPackageName(const char *checkoutDir) {
+    int fd = open(checkoutDir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return NULL;
+
+    const char *name = GetSwiftPackageNameAt(fd);
+    close(fd);
+    return name;
+}
@@ -0,0 +1,433 @@
+// Incremental resource sync. Every file copied out of a checkout is recorded in
+// `.volva/resources.manifest` together with its size, mtime and content hash so
+// later runs only copy what was added or changed and remove what was deleted.
+
+#define RESOURCE_MANIFEST_DIR   ".volva"
+#define RESOURCE_MANIFEST_PATH  ".volva/resources.manifest"
+#define RESOURCE_MANIFEST_MAGIC "volva-resources 1"
+
+struct ManifestSource {
+    char *source;
+    char *dest;
+    char *version;
+};
+
+struct ManifestFile {
+    char *path;
+    u32 sourceIndex;
+    u64 hash;
+    u64 size;
+    i64 mtime;
+    b32 seen;
+    b32 removed;
+};
+
+struct ResourceManifest {
+    struct ManifestSource *sources;
+    u32 sourceCount;
+    u32 sourceCap;
+
+    struct ManifestFile *files;
+    u32 fileCount;
+    u32 fileCap;
+
+    // NOTE: open addressing index into `files`, stores index+1 so 0 is empty
+    u32 *slots;
+    u32 slotCap;
+
+    b32 dirty;
+    // NOTE: the -verbose of the command doing the sync
+    b32 verbose;
+};
+
+struct SyncStats {
+    u32 copied;
+    u32 unchanged;
+    u32 removed;
+};
+
+static u64 manifestKey(u32 sourceIndex, const char *path) {
+    return HashString(path) ^ ((u64)(sourceIndex + 1) * HASH_PRIME64_1);
+}
+
+static void manifestInsertSlot(struct ResourceManifest *manifest, u32 fileIndex) {
+    struct ManifestFile *file = &manifest->files[fileIndex];
+    u32 mask = manifest->slotCap - 1;
+    u32 slot = manifestKey(file->sourceIndex, file->path) & mask;
+
+    while (manifest->slots[slot])
+        slot = (slot + 1) & mask;
+
+    manifest->slots[slot] = fileIndex + 1;
+}
+
+static void manifestGrow(struct ResourceManifest *manifest) {
+    if (manifest->fileCount < manifest->fileCap) return;
+
+    manifest->fileCap = manifest->fileCap ? manifest->fileCap * 2 : 256;
+    manifest->files = realloc(manifest->files, manifest->fileCap * sizeof(struct ManifestFile));
+
+    free(manifest->slots);
+    manifest->slotCap = manifest->fileCap * 2;
+    manifest->slots = calloc(manifest->slotCap, sizeof(u32));
+
+    for (u32 i = 0; i < manifest->fileCount; i += 1)
+        manifestInsertSlot(manifest, i);
+}
+
+static struct ManifestFile *manifestLookup(struct ResourceManifest *manifest, u32 sourceIndex, const char *path) {
+    if (!manifest->slotCap) return NULL;
+
+    u32 mask = manifest->slotCap - 1;
+    u32 slot = manifestKey(sourceIndex, path) & mask;
+
+    while (manifest->slots[slot]) {
+        struct ManifestFile *file = &manifest->files[manifest->slots[slot] - 1];
+        if (file->sourceIndex == sourceIndex && strcmp(file->path, path) == 0)
+            return file;
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+static struct ManifestFile *manifestAdd(struct ResourceManifest *manifest, u32 sourceIndex, const char *path) {
+    manifestGrow(manifest);
+
+    u32 index = manifest->fileCount++;
+    struct ManifestFile *file = &manifest->files[index];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    file->sourceIndex = sourceIndex;
+
+    manifestInsertSlot(manifest, index);
+    return file;
+}
+
+static u32 manifestSource(struct ResourceManifest *manifest, const char *source) {
+    for (u32 i = 0; i < manifest->sourceCount; i += 1) {
+        if (strcmp(manifest->sources[i].source, source) == 0)
+            return i;
+    }
+
+    if (manifest->sourceCount >= manifest->sourceCap) {
+        manifest->sourceCap = manifest->sourceCap ? manifest->sourceCap * 2 : 16;
+        manifest->sources = realloc(manifest->sources, manifest->sourceCap * sizeof(struct ManifestSource));
+    }
+
+    u32 index = manifest->sourceCount++;
+    manifest->sources[index] = (struct ManifestSource){ strdup(source), strdup(""), strdup("") };
+    manifest->dirty = true;
+    return index;
+}
+
+// Splits `line` in place on tabs. Returns the number of fields found.
+static u32 splitFields(char *line, char **fields, u32 max) {
+    u32 count = 0;
+    while (count < max) {
+        fields[count++] = line;
+        char *tab = strchr(line, '\t');
+        if (!tab) break;
+        *tab = '\0';
+        line = tab+1;
+    }
+
+    char *newline = strchr(fields[count-1], '\n');
+    if (newline) *newline = '\0';
+
+    return count;
+}
+
+void LoadResourceManifest(struct ResourceManifest *manifest, b32 verbose) {
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->verbose = verbose;
+
+    FILE *file = fopen(RESOURCE_MANIFEST_PATH, "r");
+    if (!file) return;
+
+    char line[4096];
+    if (!fgets(&line[0], sizeof(line), file) || strncmp(line, RESOURCE_MANIFEST_MAGIC, strlen(RESOURCE_MANIFEST_MAGIC)) != 0) {
+        if (verbose)
+            printf("Ignoring unknown resource manifest format\n");
+        fclose(file);
+        return;
+    }
+
+    char *fields[6];
+    while (fgets(&line[0], sizeof(line), file)) {
+        u32 count = splitFields(&line[0], &fields[0], 6);
+
+        if (line[0] == 'S' && count == 4) {
+            u32 index = manifestSource(manifest, fields[1]);
+            struct ManifestSource *source = &manifest->sources[index];
+            free(source->dest);
+            free(source->version);
+            source->dest = strdup(fields[2]);
+            source->version = strdup(fields[3]);
+        } else if (line[0] == 'F' && count == 6) {
+            u32 sourceIndex = strtoul(fields[1], NULL, 10);
+            if (sourceIndex >= manifest->sourceCount) continue;
+
+            struct ManifestFile *entry = manifestAdd(manifest, sourceIndex, fields[5]);
+            entry->hash = strtoull(fields[2], NULL, 16);
+            entry->size = strtoull(fields[3], NULL, 10);
+            entry->mtime = strtoll(fields[4], NULL, 10);
+        }
+    }
+
+    fclose(file);
+    manifest->dirty = false;
+}
+
+b32 SaveResourceManifest(struct ResourceManifest *manifest) {
+    if (!manifest->dirty) return true;
+
+    mkdir(RESOURCE_MANIFEST_DIR, 0755);
+
+    const char *tmpPath = RESOURCE_MANIFEST_PATH ".tmp";
+    FILE *file = fopen(tmpPath, "w");
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to write %s\n", RESOURCE_MANIFEST_PATH);
+        return false;
+    }
+
+    fprintf(file, "%s\n", RESOURCE_MANIFEST_MAGIC);
+
+    for (u32 i = 0; i < manifest->sourceCount; i += 1) {
+        struct ManifestSource source = manifest->sources[i];
+        fprintf(file, "S\t%s\t%s\t%s\n", source.source, source.dest, source.version);
+    }
+
+    for (u32 i = 0; i < manifest->fileCount; i += 1) {
+        struct ManifestFile entry = manifest->files[i];
+        if (entry.removed) continue;
+
+        fprintf(
+            file, "F\t%u\t%016llx\t%llu\t%lld\t%s\n",
+            entry.sourceIndex,
+            (unsigned long long)entry.hash,
+            (unsigned long long)entry.size,
+            (long long)entry.mtime,
+            entry.path
+        );
+    }
+
+    fclose(file);
+
+    if (rename(tmpPath, RESOURCE_MANIFEST_PATH) != 0) {
+        fprintf(stderr, "ERROR: Unable to write %s\n", RESOURCE_MANIFEST_PATH);
+        return false;
+    }
+
+    manifest->dirty = false;
+    return true;
+}
+
+// Reads the commit the checkout open at `checkoutFd` is at. SwiftPM checkouts
+// are git clones with a detached HEAD so this is the resolved package version.
+void GetCheckoutVersion(int checkoutFd, char *out, size_t len) {
+    out[0] = '\0';
+
+    int fd = openat(checkoutFd, ".git/HEAD", O_RDONLY);
+    if (fd < 0) return;
+
+    ssize_t count = read(fd, out, len-1);
+    close(fd);
+    if (count <= 0) return;
+
+    out[count] = '\0';
+    char *newline = strchr(out, '\n');
+    if (newline) *newline = '\0';
+}
+
+// Creates every missing directory leading up to the file at `path`
+static void makeParentDirs(char *path) {
+    for (char *c = path+1; *c; c += 1) {
+        if (*c != '/') continue;
+
+        *c = '\0';
+        mkdir(path, 0755);
+        *c = '/';
+    }
+}
+
+static b32 copyFile(const char *from, char *to, mode_t mode) {
+    char tmpPath[1024];
+    snprintf(&tmpPath[0], sizeof(tmpPath), "%s.volva-tmp", to);
+
+    int in = open(from, O_RDONLY);
+    if (in < 0) return false;
+
+    makeParentDirs(to);
+
+    int out = open(&tmpPath[0], O_WRONLY | O_CREAT | O_TRUNC, mode & 0777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    char buffer[64*1024];
+    ssize_t count;
+    b32 ok = true;
+
+    while ((count = read(in, &buffer[0], sizeof(buffer))) > 0) {
+        if (write(out, &buffer[0], count) != count) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (count < 0) ok = false;
+
+    close(in);
+    close(out);
+
+    if (!ok || rename(&tmpPath[0], to) != 0) {
+        unlink(&tmpPath[0]);
+        return false;
+    }
+
+    return true;
+}
+
+static void syncFile(
+    struct ResourceManifest *manifest,
+    u32 sourceIndex,
+    b32 sameVersion,
+    const char *srcPath,
+    const char *relPath,
+    struct stat *srcStat,
+    struct SyncStats *stats
+) {
+    struct ManifestSource *source = &manifest->sources[sourceIndex];
+
+    char destPath[1024];
+    snprintf(&destPath[0], sizeof(destPath), "%s%s", source->dest, relPath);
+
+    struct ManifestFile *entry = manifestLookup(manifest, sourceIndex, relPath);
+
+    struct stat destStat;
+    b32 destOk = stat(&destPath[0], &destStat) == 0 && destStat.st_size == srcStat->st_size;
+
+    if (entry && !entry->removed && destOk) {
+        if (sameVersion && entry->size == srcStat->st_size && entry->mtime == srcStat->st_mtime) {
+            entry->seen = true;
+            stats->unchanged++;
+            return;
+        }
+    }
+
+    u64 hash;
+    if (!HashFile(srcPath, &hash)) {
+        fprintf(stderr, "ERROR: Unable to read %s\n", srcPath);
+        if (entry) entry->seen = true;
+        return;
+    }
+
+    if (!entry) entry = manifestAdd(manifest, sourceIndex, relPath);
+
+    if (entry->removed || entry->hash != hash || !destOk) {
+        if (!copyFile(srcPath, &destPath[0], srcStat->st_mode)) {
+            fprintf(stderr, "ERROR: Unable to copy %s to %s\n", srcPath, &destPath[0]);
+            entry->seen = true;
+            return;
+        }
+
+        if (manifest->verbose)
+            printf("  Copied %s\n", &destPath[0]);
+
+        stats->copied++;
+    } else {
+        stats->unchanged++;
+    }
+
+    entry->hash = hash;
+    entry->size = srcStat->st_size;
+    entry->mtime = srcStat->st_mtime;
+    entry->seen = true;
+    entry->removed = false;
+    manifest->dirty = true;
+}
+
+static void syncDirectory(
+    struct ResourceManifest *manifest,
+    u32 sourceIndex,
+    b32 sameVersion,
+    char *srcPath,
+    size_t srcRootLen,
+    struct SyncStats *stats
+) {
+    DIR *dir = opendir(srcPath);
+    if (!dir) return;
+
+    size_t len = strlen(srcPath);
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        if (len + strlen(name) + 2 >= 1024) continue;
+        snprintf(srcPath+len, 1024-len, "%s", name);
+
+        struct stat st;
+        if (stat(srcPath, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            strcat(srcPath, "/");
+            syncDirectory(manifest, sourceIndex, sameVersion, srcPath, srcRootLen, stats);
+        } else if (S_ISREG(st.st_mode)) {
+            syncFile(manifest, sourceIndex, sameVersion, srcPath, srcPath+srcRootLen, &st, stats);
+        }
+    }
+
+    srcPath[len] = '\0';
+    closedir(dir);
+}
+
+// Mirrors the contents of `source` into `dest`. Both are expected to end in `/`
+b32 SyncResources(struct ResourceManifest *manifest, const char *source, const char *dest, const char *version) {
+    u32 sourceIndex = manifestSource(manifest, source);
+    struct ManifestSource *entry = &manifest->sources[sourceIndex];
+
+    b32 sameVersion = strcmp(entry->version, version) == 0 && strcmp(entry->dest, dest) == 0;
+    if (!sameVersion) {
+        free(entry->version);
+        free(entry->dest);
+        entry->version = strdup(version);
+        entry->dest = strdup(dest);
+        manifest->dirty = true;
+    }
+
+    for (u32 i = 0; i < manifest->fileCount; i += 1) {
+        if (manifest->files[i].sourceIndex == sourceIndex)
+            manifest->files[i].seen = false;
+    }
+
+    struct SyncStats stats = {0};
+
+    char srcPath[1024];
+    snprintf(&srcPath[0], sizeof(srcPath), "%s", source);
+    syncDirectory(manifest, sourceIndex, sameVersion, &srcPath[0], strlen(source), &stats);
+
+    char destPath[1024];
+    for (u32 i = 0; i < manifest->fileCount; i += 1) {
+        struct ManifestFile *file = &manifest->files[i];
+        if (file->sourceIndex != sourceIndex || file->seen || file->removed)
+            continue;
+
+        snprintf(&destPath[0], sizeof(destPath), "%s%s", dest, file->path);
+        if (unlink(&destPath[0]) == 0 || errno == ENOENT) {
+            if (manifest->verbose)
+                printf("  Removed %s\n", &destPath[0]);
+            stats.removed++;
+        }
+
+        file->removed = true;
+        manifest->dirty = true;
+    }
+
+    printf("  %u copied, %u unchanged, %u removed\n", stats.copied, stats.unchanged, stats.removed);
+    return true;
+}
@@ -0,0 +1,254 @@
+// Box drawn tables sized to the terminal. Display widths are measured once when
+// a row is added, values that don't fit wrap over as many lines as they need and
+// the whole table is rendered into one buffer and written with a single call.
+
+#define TABLE_MIN_WIDTH 8
+
+struct TableCell {
+    const char *str;
+    u32 len;
+};
+
+struct Table {
+    u32 columns;
+    u32 rows;
+    u32 cap;
+    struct TableCell *cells;
+    u32 *widths;
+};
+
+struct TableBuffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+void TableInit(struct Table *table, u32 columns) {
+    memset(table, 0, sizeof(*table));
+    table->columns = columns;
+    table->widths = calloc(columns, sizeof(u32));
+}
+
+void TableFree(struct Table *table) {
+    free(table->cells);
+    free(table->widths);
+    memset(table, 0, sizeof(*table));
+}
+
+// Widest line of `str` in terminal columns
+static u32 measureCell(const char *str, u32 len) {
+    u32 widest = 0;
+
+    while (len) {
+        const char *newline = memchr(str, '\n', len);
+        u32 lineLen = newline ? newline - str : len;
+
+        u32 width = DisplayWidth(str, lineLen);
+        if (width > widest) widest = width;
+
+        if (!newline) break;
+        str += lineLen + 1;
+        len -= lineLen + 1;
+    }
+
+    return widest;
+}
+
+// Adds a row of `table->columns` values. The strings aren't copied, they have to
+// outlive the table.
+void TableAddRow(struct Table *table, const char **values) {
+    if (table->rows >= table->cap) {
+        table->cap = table->cap ? table->cap * 2 : 64;
+        table->cells = realloc(table->cells, table->cap * table->columns * sizeof(struct TableCell));
+    }
+
+    struct TableCell *row = &table->cells[table->rows++ * table->columns];
+
+    for (u32 i = 0; i < table->columns; i += 1) {
+        const char *str = values[i] ?: "";
+        u32 len = strlen(str);
+
+        row[i] = (struct TableCell){ str, len };
+
+        u32 width = measureCell(str, len);
+        if (width > table->widths[i])
+            table->widths[i] = width;
+    }
+}
+
+// Splits the space left by the borders between the columns. Columns narrower
+// than an even share get their full width and hand the rest to the wider ones.
+static void fitColumns(struct Table *table, u32 *widths, i32 termWidth) {
+    u32 columns = table->columns;
+
+    i32 available = termWidth - (i32)(3*columns + 1);
+    if (available < (i32)(columns * TABLE_MIN_WIDTH))
+        available = columns * TABLE_MIN_WIDTH;
+
+    u32 remaining = available;
+    u32 left = columns;
+
+    for (u32 i = 0; i < columns; i += 1)
+        widths[i] = 0;
+
+    b32 assigned = true;
+    while (left && assigned) {
+        assigned = false;
+        u32 share = remaining / left;
+
+        for (u32 i = 0; i < columns; i += 1) {
+            u32 natural = table->widths[i] ?: 1;
+            if (widths[i] || natural > share) continue;
+
+            widths[i] = natural;
+            remaining -= natural;
+            left--;
+            assigned = true;
+        }
+    }
+
+    for (u32 i = 0; i < columns && left; i += 1) {
+        if (widths[i]) continue;
+
+        u32 share = remaining / left;
+        widths[i] = share;
+        remaining -= share;
+        left--;
+    }
+}
+
+static void tableReserve(struct TableBuffer *buffer, size_t len) {
+    if (buffer->len + len <= buffer->cap) return;
+
+    while (buffer->len + len > buffer->cap)
+        buffer->cap = buffer->cap ? buffer->cap * 2 : 64*1024;
+
+    buffer->data = realloc(buffer->data, buffer->cap);
+}
+
+static void tableAppend(struct TableBuffer *buffer, const char *data, size_t len) {
+    tableReserve(buffer, len);
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+static void tableRepeat(struct TableBuffer *buffer, const char *str, size_t len, u32 count) {
+    tableReserve(buffer, len * count);
+    for (u32 i = 0; i < count; i += 1) {
+        memcpy(buffer->data + buffer->len, str, len);
+        buffer->len += len;
+    }
+}
+
+static void tableBorder(struct TableBuffer *buffer, u32 *widths, u32 columns, const char *left, const char *middle, const char *right) {
+    tableAppend(buffer, left, strlen(left));
+
+    for (u32 i = 0; i < columns; i += 1) {
+        tableRepeat(buffer, "─", strlen("─"), widths[i] + 2);
+        if (i + 1 != columns)
+            tableAppend(buffer, middle, strlen(middle));
+    }
+
+    tableAppend(buffer, right, strlen(right));
+    tableAppend(buffer, "\n", 1);
+}
+
+// Appends as much of the cell starting at `*pos` as fits in `width` columns,
+// padded out to `width`, and advances `*pos` past it.
+static void tableSegment(struct TableBuffer *buffer, struct TableCell *cell, u32 *pos, u32 width) {
+    const char *str = cell->str;
+    u32 i = *pos;
+    u32 used = 0;
+
+    while (i < cell->len && str[i] != '\n') {
+        u8 c = str[i];
+
+        if (c < 0x80) {
+            if (used + 1 > width) break;
+
+            // NOTE: control characters would break the box, show them as blanks
+            char out = c < 0x20 || c == 0x7F ? ' ' : c;
+            tableAppend(buffer, &out, 1);
+            used++;
+            i++;
+            continue;
+        }
+
+        u32 cpLen;
+        u32 cp = DecodeCodePointN(&cpLen, str+i, cell->len-i);
+        u32 cpWidth = CodePointWidth(cp);
+
+        // NOTE: a wide character never fits a 1 column cell, take it anyway
+        if (used + cpWidth > width && used) break;
+
+        tableAppend(buffer, str+i, cpLen);
+        used += cpWidth;
+        i += cpLen;
+    }
+
+    if (i < cell->len && str[i] == '\n')
+        i++;
+
+    *pos = i;
+
+    if (used < width)
+        tableRepeat(buffer, " ", 1, width - used);
+}
+
+static void tableRow(struct TableBuffer *buffer, struct TableCell *row, u32 *widths, u32 *positions, u32 columns) {
+    for (u32 i = 0; i < columns; i += 1)
+        positions[i] = 0;
+
+    b32 more;
+    do {
+        more = false;
+        tableAppend(buffer, "│", strlen("│"));
+
+        for (u32 i = 0; i < columns; i += 1) {
+            tableAppend(buffer, " ", 1);
+            tableSegment(buffer, &row[i], &positions[i], widths[i]);
+            tableAppend(buffer, " │", strlen(" │"));
+
+            if (positions[i] < row[i].len)
+                more = true;
+        }
+
+        tableAppend(buffer, "\n", 1);
+    } while (more);
+}
+
+// Renders the table to `fd` in a single write, fitting it to `termWidth`
+// columns where possible.
+void TableRender(struct Table *table, i32 termWidth, int fd) {
+    u32 columns = table->columns;
+    if (!columns || !table->rows) return;
+
+    u32 *widths = malloc(columns * sizeof(u32));
+    u32 *positions = malloc(columns * sizeof(u32));
+    fitColumns(table, widths, termWidth);
+
+    struct TableBuffer buffer = {0};
+
+    // NOTE: a rough guess that covers most tables without growing
+    size_t lineSize = (size_t)termWidth * 3 + 16;
+    tableReserve(&buffer, lineSize * (table->rows * 2 + 2));
+
+    tableBorder(&buffer, widths, columns, "┌", "┬", "┐");
+
+    for (u32 i = 0; i < table->rows; i += 1) {
+        tableRow(&buffer, &table->cells[i * columns], widths, positions, columns);
+
+        if (i + 1 != table->rows)
+            tableBorder(&buffer, widths, columns, "├", "┼", "┤");
+    }
+
+    tableBorder(&buffer, widths, columns, "└", "┴", "┘");
+
+    // NOTE: anything already printed through stdio has to come first
+    fflush(stdout);
+    outputWriteAll(fd, buffer.data, buffer.len);
+
+    free(buffer.data);
+    free(positions);
+    free(widths);
+}